@@ -1,3 +1,5 @@
 ca65 -t nes "test/main.asm"
-cl65 -t nes -o "test.nes" "test/main.o"
-gcc -Wall -Iinclude src/fe.c -o FE.exe -lsdl2 -lopengl32 -lgdi32
\ No newline at end of file
+cl65 -t nes -C "test/nes.cfg" -o "test.nes" "test/main.o"
+ca65 -t nes "test/priority.asm"
+cl65 -t nes -C "test/nes.cfg" -o "priority.nes" "test/priority.o"
+gcc -Wall -Iinclude src/core.c src/fe.c -o FE.exe -pthread -lsdl2 -lopengl32 -lgdi32
\ No newline at end of file
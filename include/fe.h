@@ -0,0 +1,99 @@
+#ifndef FE_H
+#define FE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// libfe: the emulator without a front-end, for embedding it into other programs. Emulators share
+// nothing, so any number of them can run side by side, each on one thread at a time. Functions that
+// can fail return 0 or -1 and print why.
+
+#define FE_SCREEN_WIDTH 256
+#define FE_SCREEN_HEIGHT 240
+#define FE_RAM_SIZE 0x800
+#define FE_AUDIO_SAMPLE_RATE 48000
+
+// Buttons of feSetInput(), controller 1 in the low byte and controller 2 in the high one
+#define FE_BUTTON_A 0x01
+#define FE_BUTTON_B 0x02
+#define FE_BUTTON_SELECT 0x04
+#define FE_BUTTON_START 0x08
+#define FE_BUTTON_UP 0x10
+#define FE_BUTTON_DOWN 0x20
+#define FE_BUTTON_LEFT 0x40
+#define FE_BUTTON_RIGHT 0x80
+
+typedef struct emulator fe_emulator_t;
+
+// What an observed emulator publishes at the end of every frame, see feObserve(). The layout is the
+// same in every process that maps it. sequence is odd while a frame is being published, so a
+// reader takes a consistent look without locks or copies:
+//   do { s = sequence; (read ram, frame, screens[screen]) } while ((s & 1) || sequence != s);
+// with acquire ordering on both loads of sequence.
+typedef struct {
+    unsigned long long sequence;
+    unsigned long long frame; // frames completed when ram was published
+    unsigned long long screenFrame; // frame screens[screen] was drawn at, older when frames are skipped
+    unsigned int screen; // which of screens is complete, the emulator draws into the other one
+    unsigned int reserved;
+    unsigned char ram[FE_RAM_SIZE];
+    unsigned char screens[2][FE_SCREEN_WIDTH * FE_SCREEN_HEIGHT]; // NES color index (0-63) of every pixel
+} fe_observation_t;
+
+// A console at power-on without a cartridge, NULL if it could not be allocated
+fe_emulator_t* feCreate(void);
+void feDestroy(fe_emulator_t* emu);
+
+// Inserts an iNES or NES 2.0 image and resets to it, once per emulator. The image is copied.
+int feLoadROM(fe_emulator_t* emu, const void* data, size_t size);
+int feLoadROMFile(fe_emulator_t* emu, const char* path);
+
+// Held until changed
+void feSetInput(fe_emulator_t* emu, unsigned short buttons);
+
+// Runs until the next frame is complete, frames times over. Without a ROM nothing runs and -1 is
+// returned, as by every function below that needs one.
+int feStepFrames(fe_emulator_t* emu, unsigned long frames);
+// Runs at least cycles CPU cycles, up to the end of the instruction that passes them
+int feStepCycles(fe_emulator_t* emu, unsigned long long cycles);
+unsigned long long feFrameCount(const fe_emulator_t* emu);
+unsigned long long feCycleCount(const fe_emulator_t* emu);
+
+// FE_SCREEN_WIDTH * FE_SCREEN_HEIGHT pixels of 0x00RRGGBB, row by row. The pointer stays valid
+// as long as the emulator does and the pixels are updated in place.
+const unsigned int* feFramebuffer(const fe_emulator_t* emu);
+// Signed 16-bit mono samples at FE_AUDIO_SAMPLE_RATE of the last complete frame, valid until the
+// next one completes
+const short* feAudio(const fe_emulator_t* emu, size_t* count);
+
+// Skips drawing skip frames out of every, see --render-skip. feRequestFrame() draws the next
+// frame regardless.
+void feSetRenderSkip(fe_emulator_t* emu, unsigned int skip, unsigned int every);
+void feRequestFrame(fe_emulator_t* emu);
+
+// Save states of the loaded ROM, feStateSize() bytes each (0 without a ROM)
+size_t feStateSize(const fe_emulator_t* emu);
+int feSaveState(fe_emulator_t* emu, void* buffer, size_t size);
+int feLoadState(fe_emulator_t* emu, const void* buffer, size_t size);
+
+// The FE_RAM_SIZE bytes of CPU RAM, in place like the framebuffer
+unsigned char* feRAM(fe_emulator_t* emu);
+// Reads and writes the CPU address space as the CPU would, registers and mappers included. Without
+// a ROM reads are 0 and writes are dropped.
+unsigned char feRead(fe_emulator_t* emu, unsigned short addr);
+void feWrite(fe_emulator_t* emu, unsigned short addr, unsigned char value);
+
+// Starts publishing frames into an fe_observation_t, in this process's memory when name is NULL
+// and otherwise in shared memory of that name (shm_open(), e.g. "/fe-agent-0") that other processes
+// can map read-only. The name must not be in use, the emulator removes it again when destroyed. The
+// screens are written by the PPU as it draws. NULL if it could not be set up.
+const fe_observation_t* feObserve(fe_emulator_t* emu, const char* name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
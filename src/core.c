@@ -0,0 +1,3713 @@
+#include "core.h"
+#include <sys/time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef FE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+const unsigned char cycle_count_table[] = {
+    7, 6, 0, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6,
+    2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+    6, 6, 0, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6,
+    2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+    6, 6, 0, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6,
+    2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, 
+    6, 6, 0, 8, 3, 3, 5, 0, 4, 2, 2, 0, 5, 4, 6, 0,
+    2, 5, 0, 8, 4, 4, 6, 0, 2, 4, 2, 0, 0, 4, 7, 0,
+    2, 6, 0, 6, 3, 3, 3, 0, 2, 2, 2, 0, 4, 4, 4, 0,
+    2, 5, 0, 6, 4, 4, 4, 0, 2, 5, 2, 0, 0, 4, 0, 0,
+    2, 6, 0, 6, 3, 3, 3, 0, 2, 2, 2, 0, 4, 5, 4, 0,
+    2, 5, 0, 5, 4, 4, 4, 0, 2, 4, 2, 0, 4, 4, 4, 0,
+    2, 6, 0, 8, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,
+    2, 5, 0, 8, 4, 4, 6, 0, 2, 4, 2, 0, 0, 4, 7, 0,
+    2, 6, 0, 8, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,
+    2, 5, 0, 8, 4, 4, 6, 0, 2, 4, 2, 0, 0, 4, 7, 0
+};
+
+const unsigned int palette_to_rgb_table[] = {
+    0x545454, 0x001E74, 0x081090, 0x300088, 0x440064, 0x5C0030, 0x540400, 0x3C1800, 0x202A00, 0x083A00, 0x004000, 0x003C00, 0x00323C, 0x000000, 0x000000, 0x000000,
+    0x989698, 0x084CC4, 0x3032EC, 0x5C1EE4, 0x8814B0, 0xA01464, 0x982220, 0x783C00, 0x545A00, 0x287200, 0x087C00, 0x007628, 0x006678, 0x000000, 0x000000, 0x000000,
+    0xECEEEC, 0x4C9AEC, 0x787CEC, 0xB062EC, 0xE454EC, 0xEC58B4, 0xEC6A64, 0xD48820, 0xA0AA00, 0x74C400, 0x4CD020, 0x38CC6C, 0x38B4CC, 0x3C3C3C, 0x000000, 0x000000,
+    0xECEEEC, 0xA8CCEC, 0xBCBCEC, 0xD4B2EC, 0xECAEEC, 0xECAED4, 0xECB4B0, 0xE4C490, 0xCCD278, 0xB4DE78, 0xA8E290, 0x98E2B4, 0xA0D6E4, 0xA0A2A0, 0x000000, 0x000000
+};
+
+const unsigned char length_table[] = {
+    10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+    12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+const unsigned char duty_table[4][8] = {
+    { 0, 1, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 1, 1, 0, 0, 0 },
+    { 1, 0, 0, 1, 1, 1, 1, 1 }
+};
+
+const unsigned char triangle_table[] = {
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+// In CPU cycles
+const unsigned short noise_period_table[] = { 4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068 };
+const unsigned short dmc_rate_table[] = { 428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54 };
+
+// CPU cycles after the start of the frame counter sequence each step is at, and the length of the
+// four and five step sequences
+const unsigned short frame_counter_steps[] = { 7457, 14913, 22371, 29829, 37281 };
+const unsigned short frame_counter_periods[] = { 29830, 37282 };
+
+const char ines_constant[] = "NES\x1A";
+const char save_state_constant[] = "FES\x1A";
+const char movie_constant[] = "FEM\x1A";
+const char trace_constant[] = "FET\x1A";
+
+unsigned char overviewAfterInstruction = 0;
+compose_tile_t composeTile = NULL; // picked by selectCompositor()
+const char* composeTileName = NULL; // "scalar", "ssse3" or "avx2"
+
+// Steps of a level change for every fraction of a sample it can start at, see initBandLimitedStep()
+float bandLimitedStep[AUDIO_KERNEL_PHASES][AUDIO_KERNEL_WIDTH];
+
+// Indexed by scheduler event
+void (* const event_handlers[EVENT_COUNT])(emulator_t* emu) = { ppuVBlankEvent, ppuFrameEndEvent, mapperScanlineEvent, apuFrameEvent };
+
+const mapper_t mapper_table[] = {
+    { 0, "NROM", NULL, nromSync, NULL, NULL },
+    { 1, "MMC1", mmc1Reset, mmc1UpdateBanks, mmc1Write, NULL },
+    { 2, "UxROM", NULL, uxromSync, uxromWrite, NULL },
+    { 3, "CNROM", NULL, cnromSync, cnromWrite, NULL },
+    { 4, "MMC3", mmc3Reset, mmc3UpdateBanks, mmc3Write, mmc3Scanline }
+};
+
+// Emulates a full frame, the front-end paces it to real time. With the PPU pipelined the framebuffer
+// ends up holding the frame before it.
+void emulateFrame(emulator_t* emu)
+{
+#ifdef FE_PROFILE
+    unsigned long long profileStart = emu->profile != NULL ? nanoTimestamp() : 0;
+#endif
+    if (emu->movie.mode != MOVIE_OFF)
+        updateMovie(emu);
+    emu->machine.frameComplete = 0;
+    while (!emu->machine.frameComplete)
+    {
+        while (emu->machine.masterClock < emu->machine.nextEventTime)
+            executeCurrentInstruction(emu);
+        runDueEvents(emu);
+    }
+    if (emu->pipeline != NULL)
+        showPipelinedFrame(emu);
+#ifdef FE_PROFILE
+    if (emu->profile != NULL)
+    {
+        emu->profile->time[PROFILE_EMULATION] += nanoTimestamp() - profileStart;
+        emu->profile->frames++;
+    }
+#endif
+}
+
+// Runs at least the given number of CPU cycles, stopping at the end of the instruction that passes
+// them. Frames completed on the way are neither shown nor fed from the input movie.
+void emulateCycles(emulator_t* emu, unsigned long long cycles)
+{
+    unsigned long long end = emu->machine.masterClock + cycles * CPU_CLOCK_DIVIDER;
+    while (emu->machine.masterClock < end)
+    {
+        while (emu->machine.masterClock < emu->machine.nextEventTime && emu->machine.masterClock < end)
+            executeCurrentInstruction(emu);
+        if (emu->machine.masterClock >= emu->machine.nextEventTime)
+            runDueEvents(emu);
+    }
+}
+
+// Scheduler: components register the master clock time of their next event and the CPU runs
+// until the nearest one. Anything the CPU does in between is caught up on demand.
+
+void scheduleEvent(emulator_t* emu, int event, unsigned long long time)
+{
+    emu->machine.eventTimes[event] = time;
+    emu->machine.nextEventTime = NO_EVENT;
+    for (int i = 0; i < EVENT_COUNT; i++)
+    {
+        if (emu->machine.eventTimes[i] < emu->machine.nextEventTime)
+            emu->machine.nextEventTime = emu->machine.eventTimes[i];
+    }
+}
+
+void runDueEvents(emulator_t* emu)
+{
+    while (emu->machine.nextEventTime <= emu->machine.masterClock)
+    {
+        int event = 0;
+        for (int i = 1; i < EVENT_COUNT; i++)
+        {
+            if (emu->machine.eventTimes[i] < emu->machine.eventTimes[event])
+                event = i;
+        }
+        scheduleEvent(emu, event, NO_EVENT);
+        event_handlers[event](emu);
+    }
+}
+
+void resetScheduler(emulator_t* emu)
+{
+    emu->machine.masterClock = 0;
+    emu->machine.ppu.frameStart = 0;
+    emu->machine.ppu.scanline = PRERENDER_SCANLINE;
+    emu->machine.ppu.renderX = 0;
+    for (int i = 0; i < EVENT_COUNT; i++)
+        emu->machine.eventTimes[i] = NO_EVENT;
+    scheduleEvent(emu, EVENT_VBLANK, ppuScanlineStart(emu, FIRST_VBLANK_SCANLINE));
+    scheduleEvent(emu, EVENT_FRAME_END, ppuScanlineStart(emu, SCANLINES - 1));
+    scheduleEvent(emu, EVENT_APU_FRAME, emu->machine.apu.nextFrameStep * CPU_CLOCK_DIVIDER);
+    if (emu->mapper != NULL && emu->mapper->scanline != NULL)
+    {
+        emu->machine.mapper.scanline = PRERENDER_SCANLINE;
+        emu->machine.mapper.scanlineTime = ppuScanlineStart(emu, PRERENDER_SCANLINE) + MAPPER_SCANLINE_DOT;
+        scheduleEvent(emu, EVENT_MAPPER_SCANLINE, emu->machine.mapper.scanlineTime);
+    }
+}
+
+// Master clock time at which the given scanline of the current frame starts
+unsigned long long ppuScanlineStart(emulator_t* emu, int scanline)
+{
+    return emu->machine.ppu.frameStart + (unsigned long long) (scanline + 1) * PPU_CYCLES_PER_SCANLINE;
+}
+
+void ppuVBlankEvent(emulator_t* emu)
+{
+    ppuEnterVBlank(emu);
+    if (emu->pipeline != NULL)
+        logPpu(emu, PPU_LOG_VBLANK, 0, 0, 0);
+    if (isBitSet(emu->machine.ppu.ctrl, NMI_BIT)) // generate NMI?
+        m6502interrupt(emu, readAddr(emu, NMI_VECTOR));
+}
+
+void ppuFrameEndEvent(emulator_t* emu)
+{
+    ppuStartFrame(emu);
+    if (emu->pipeline != NULL)
+    {
+        logPpu(emu, PPU_LOG_FRAME_END, 0, 0, 0);
+        emu->pipeline->hitPossible = emu->machine.ppu.pOAM[3] != 0;
+    }
+    scheduleEvent(emu, EVENT_VBLANK, ppuScanlineStart(emu, FIRST_VBLANK_SCANLINE));
+    scheduleEvent(emu, EVENT_FRAME_END, ppuScanlineStart(emu, SCANLINES - 1));
+    apuEndFrame(emu);
+    emu->machine.frameCount++;
+    emu->machine.frameComplete = 1;
+    if (emu->observer != NULL)
+        publishObservation(emu);
+    if (emu->renderSkip.every)
+        updateRenderSkip(emu);
+}
+
+// The PPU side of the VBlank and frame end events, shared with the render thread's replay of them
+void ppuEnterVBlank(emulator_t* emu)
+{
+    ppuCatchUp(emu);
+    emu->machine.ppu.scanline = FIRST_VBLANK_SCANLINE;
+    setBit(&emu->machine.ppu.status, VBLANK_BIT);
+}
+
+void ppuStartFrame(emulator_t* emu)
+{
+    emu->machine.ppu.frameStart += PPU_CYCLES_PER_FRAME;
+    emu->machine.ppu.scanline = PRERENDER_SCANLINE;
+    emu->machine.ppu.renderX = 0;
+    clearBit(&emu->machine.ppu.status, VBLANK_BIT); // exit VBlank
+    clearBit(&emu->machine.ppu.status, SPRITE_0_HIT_BIT);
+}
+
+// Clocks the mapper at dot 260 of the pre-render and visible scanlines, where the PPU fetches sprite
+// patterns and MMC3 sees A12 rise. Only scheduled for mappers that count scanlines.
+void mapperScanlineEvent(emulator_t* emu)
+{
+    if (isBitSet(emu->machine.ppu.mask, SHOW_BG_BIT) || isBitSet(emu->machine.ppu.mask, SHOW_SPRITES_BIT))
+        emu->mapper->scanline(emu);
+    emu->machine.mapper.scanlineTime += PPU_CYCLES_PER_SCANLINE;
+    if (++emu->machine.mapper.scanline == POSTRENDER_SCANLINE) // skip to the next frame's pre-render scanline
+    {
+        emu->machine.mapper.scanline = PRERENDER_SCANLINE;
+        emu->machine.mapper.scanlineTime += (SCANLINES - 1 - POSTRENDER_SCANLINE) * PPU_CYCLES_PER_SCANLINE;
+    }
+    scheduleEvent(emu, EVENT_MAPPER_SCANLINE, emu->machine.mapper.scanlineTime);
+}
+
+// Runs the APU through each frame counter step, so its IRQ is raised on time
+void apuFrameEvent(emulator_t* emu)
+{
+    apuCatchUp(emu);
+    scheduleEvent(emu, EVENT_APU_FRAME, emu->machine.apu.nextFrameStep * CPU_CLOCK_DIVIDER);
+}
+
+// Renders everything the PPU would have drawn up to the current master clock time. Called before
+// the CPU touches anything that affects rendering, so mid-scanline changes land on the right pixel.
+// With the PPU pipelined the render thread does this for the shadow instead, with a raster pool
+// whole scanlines are recorded and rasterized in parallel at the end.
+void ppuCatchUp(emulator_t* emu)
+{
+    if (emu->pipeline != NULL)
+        return;
+#ifdef FE_PROFILE
+    unsigned long long profileStart = emu->profile != NULL ? nanoTimestamp() : 0;
+#endif
+    while (emu->machine.ppu.scanline < POSTRENDER_SCANLINE)
+    {
+        unsigned long long lineStart = ppuScanlineStart(emu, emu->machine.ppu.scanline);
+        if (emu->machine.masterClock < lineStart)
+            break;
+        unsigned long long dot = emu->machine.masterClock - lineStart;
+        if (emu->machine.ppu.scanline == PRERENDER_SCANLINE)
+        {
+            if (dot < PPU_CYCLES_PER_SCANLINE)
+                break;
+            loadTwoTiles(emu); // load the first two tiles
+            emu->machine.ppu.scanline++;
+            continue;
+        }
+        if (emu->renderSkip.active && emu->machine.ppu.renderX == 0) // only scanlines a sprite 0 hit can happen on are drawn
+            emu->renderSkip.lineSkipped = !isSpriteZeroHitPossible(emu);
+        int x = dot < SCREEN_WIDTH ? (int) dot : SCREEN_WIDTH;
+        if (emu->renderSkip.active && emu->renderSkip.lineSkipped)
+            skipPixels(emu, emu->machine.ppu.renderX, x);
+        else if (emu->raster != NULL && emu->machine.ppu.renderX == 0 && dot >= PPU_CYCLES_PER_SCANLINE)
+        {
+            deferScanline(emu);
+            continue;
+        }
+        else
+        {
+            if (emu->machine.ppu.renderX == 0)
+                evaluateSprites(emu);
+            renderPixels(emu, emu->machine.ppu.renderX, x);
+        }
+        if (dot < PPU_CYCLES_PER_SCANLINE)
+            break;
+        if ((++emu->machine.ppu.currentVRamAddr.fineYScroll) == 0)
+            emu->machine.ppu.currentVRamAddr.coarseYScroll++;
+        emu->machine.ppu.renderX = 0;
+        emu->machine.ppu.scanline++;
+    }
+    if (emu->raster != NULL)
+        rasterizeDeferred(emu);
+#ifdef FE_PROFILE
+    if (emu->profile != NULL)
+        emu->profile->time[PROFILE_PPU] += nanoTimestamp() - profileStart;
+#endif
+}
+
+// Fills secondary OAM and decodes the sprites found into the scanline's sprite line buffer
+void evaluateSprites(emulator_t* emu)
+{
+    // cycles 1-64 - secondary OAM clear
+    memset(emu->machine.ppu.sOAM, 0xFF, 32);
+    if (emu->machine.ppu.spritesOnLine)
+        memset(emu->machine.ppu.spriteLine, 0, SCREEN_WIDTH);
+    emu->machine.ppu.spritesOnLine = 0;
+    // cycles 65-256 - sprite evaluation
+    for (int i = 0, n = 0, y = (emu->machine.ppu.currentVRamAddr.coarseYScroll * 8) + emu->machine.ppu.currentVRamAddr.fineYScroll; i < 256; i += 4)
+    {
+        if (n >= 32) // 8 sprites found
+            break;
+        unsigned char spriteY = emu->machine.ppu.pOAM[i];
+        // if current sprite is not on this scanline, continue
+        if (y < spriteY || y >= spriteY + 8)
+            continue;
+        for (int j = 0; j < 4; j++) // copy sprite data into secondary OAM
+            emu->machine.ppu.sOAM[n + j] = emu->machine.ppu.pOAM[i + j];
+        n += 4;
+        emu->machine.ppu.spritesOnLine++;
+        int startLine = y - spriteY;
+        const unsigned char* row = tileRow(emu, isBitSet(emu->machine.ppu.ctrl, SPRITE_PATTERN_TABLE_BIT), emu->machine.ppu.pOAM[i + 1], startLine);
+        unsigned char attributes = emu->machine.ppu.pOAM[i + 2];
+        unsigned char spriteFlags = (isBitSet(attributes, SPRITE_PRIORITY_BIT) ? SPRITE_LINE_BEHIND_BG : 0) | (i == 0 ? SPRITE_LINE_SPRITE_0 : 0);
+        int spriteX = emu->machine.ppu.pOAM[i + 3];
+        if (spriteX == 0) // the sprite counters never start a sprite at x = 0
+            continue;
+        // later sprites are drawn over earlier ones, sprite 0 is remembered separately for hit detection
+        for (int p = 0; p < 8 && spriteX + p < SCREEN_WIDTH; p++)
+        {
+            int colorIndex = row[p];
+            if (colorIndex == 0)
+                continue;
+            unsigned char* entry = &emu->machine.ppu.spriteLine[spriteX + p];
+            *entry = (*entry & SPRITE_LINE_SPRITE_0) | spriteFlags | (0x10 + (4 * (attributes & 0b11)) + colorIndex);
+        }
+    }
+}
+
+// Palette RAM offset of a pixel: the sprite's, unless it is transparent or behind an opaque
+// background pixel
+static inline int pixelPaletteIndex(const ppu_t* ppu, unsigned char tilePixel, unsigned char sprite)
+{
+    if ((sprite & SPRITE_LINE_COLOR) && (!(sprite & SPRITE_LINE_BEHIND_BG) || tilePixel == 0))
+        return sprite & SPRITE_LINE_COLOR;
+    return ppu->tilePalette + tilePixel;
+}
+
+// cycles 1-256 - BG rendering for pixels [from, to) of the current scanline
+void renderPixels(emulator_t* emu, int from, int to)
+{
+    unsigned int* line = &emu->framebuffer[emu->machine.ppu.scanline * SCREEN_WIDTH];
+    for (int x = from; x < to;)
+    {
+        int count = 1;
+        if ((x & 7) == 0 && x + 8 <= to) // whole tiles go through the compositor
+        {
+            composeTile(emu, &line[x], emu->machine.ppu.spritesOnLine ? &emu->machine.ppu.spriteLine[x] : NULL);
+            count = 8;
+        }
+        else
+        {
+            unsigned char sprite = emu->machine.ppu.spritesOnLine ? emu->machine.ppu.spriteLine[x] : 0;
+            line[x] = emu->paletteRGB[pixelPaletteIndex(&emu->machine.ppu, emu->machine.ppu.tilePixels[x & 7], sprite)];
+        }
+        if (emu->machine.ppu.spritesOnLine)
+        {
+            for (int p = x; p < x + count; p++)
+            {
+                if ((emu->machine.ppu.spriteLine[p] & SPRITE_LINE_SPRITE_0) && emu->machine.ppu.tilePixels[p & 7] != 0 && p != SCREEN_WIDTH - 1)
+                    setBit(&emu->machine.ppu.status, SPRITE_0_HIT_BIT);
+            }
+        }
+        if (emu->observer != NULL)
+            observePixels(emu, x, x + count);
+        x += count;
+        if ((x & 7) == 0) // on to the next tile
+        {
+            emu->machine.ppu.currentVRamAddr.coarseXScroll++;
+            loadTwoTiles(emu);
+        }
+    }
+    emu->machine.ppu.renderX = to;
+}
+
+// Moves the background fetches along the way renderPixels() does without drawing, only the last
+// tile fetched is ever looked at again
+void skipPixels(emulator_t* emu, int from, int to)
+{
+    int tiles = (to >> 3) - (from >> 3);
+    if (tiles > 0)
+    {
+        emu->machine.ppu.currentVRamAddr.coarseXScroll += tiles;
+        loadTwoTiles(emu);
+    }
+    emu->machine.ppu.renderX = to;
+}
+
+// Render skipping: the CPU only sees the PPU through VBlank, NMIs, PPUSTATUS and PPUDATA, so a
+// skipped frame keeps the VRAM address moving as drawing would and only draws the scanlines sprite 0
+// could hit on. Games run the same whether their frames are drawn or not.
+
+// Skips drawing skip of every frames, 1 of 1 only draws frames asked for with requestFrame()
+void setRenderSkip(emulator_t* emu, unsigned int skip, unsigned int every)
+{
+    emu->renderSkip.skip = skip;
+    emu->renderSkip.every = every;
+    emu->renderSkip.active = 0;
+    if (every)
+        updateRenderSkip(emu);
+}
+
+// Draws the frame emulated next whatever the pattern says, or what is left of the current one
+void requestFrame(emulator_t* emu)
+{
+    emu->renderSkip.active = 0;
+}
+
+// Picks whether the frame about to start is drawn, the last frame of every group is
+void updateRenderSkip(emulator_t* emu)
+{
+    if (emu->renderSkip.active)
+        emu->renderSkip.skippedFrames++;
+    emu->renderSkip.active = emu->machine.frameCount % emu->renderSkip.every < emu->renderSkip.skip;
+}
+
+// Whether sprite 0 is on the scanline about to be drawn and a hit is still news, going by the same
+// y evaluateSprites() does
+int isSpriteZeroHitPossible(emulator_t* emu)
+{
+    int y = (emu->machine.ppu.currentVRamAddr.coarseYScroll * 8) + emu->machine.ppu.currentVRamAddr.fineYScroll;
+    return !isBitSet(emu->machine.ppu.status, SPRITE_0_HIT_BIT) && emu->machine.ppu.pOAM[3] != 0 && y >= emu->machine.ppu.pOAM[0] && y < emu->machine.ppu.pOAM[0] + 8;
+}
+
+// Picks the background compositor by name, or the fastest one the CPU supports
+int selectCompositor(const char* name)
+{
+    const char* selected = "scalar";
+    compose_tile_t compositor = composeTileScalar;
+#ifdef FE_X86_SIMD
+    __builtin_cpu_init();
+    int hasAVX2 = __builtin_cpu_supports("avx2");
+    int hasSSSE3 = __builtin_cpu_supports("ssse3");
+    if ((name == NULL && hasAVX2) || (name != NULL && strcmp(name, "avx2") == 0 && hasAVX2))
+    {
+        selected = "avx2";
+        compositor = composeTileAVX2;
+    }
+    else if ((name == NULL && hasSSSE3) || (name != NULL && strcmp(name, "ssse3") == 0 && hasSSSE3))
+    {
+        selected = "ssse3";
+        compositor = composeTileSSSE3;
+    }
+#endif
+    if (name != NULL && strcmp(name, selected) != 0)
+    {
+        feErr("Requested compositor is unknown or not supported by this CPU");
+        return -1;
+    }
+    composeTile = compositor;
+    composeTileName = selected;
+    return 0;
+}
+
+// Writes 8 pixels of the current background tile with the sprite line (if any) drawn over or behind it
+void composeTileScalar(emulator_t* emu, unsigned int* out, const unsigned char* sprites)
+{
+    for (int p = 0; p < 8; p++)
+        out[p] = emu->paletteRGB[pixelPaletteIndex(&emu->machine.ppu, emu->machine.ppu.tilePixels[p], sprites != NULL ? sprites[p] : 0)];
+}
+
+#ifdef FE_X86_SIMD
+// Palette indices of the 8 pixels of the current background tile, in the low 8 bytes
+__attribute__((target("sse2")))
+static inline __m128i tilePaletteIndices(emulator_t* emu, const unsigned char* sprites)
+{
+    __m128i pixels = _mm_loadl_epi64((const __m128i*) emu->machine.ppu.tilePixels);
+    __m128i index = _mm_add_epi8(pixels, _mm_set1_epi8(emu->machine.ppu.tilePalette));
+    if (sprites == NULL)
+        return index;
+    __m128i line = _mm_loadl_epi64((const __m128i*) sprites);
+    __m128i sprite = _mm_and_si128(line, _mm_set1_epi8(SPRITE_LINE_COLOR));
+    __m128i behind = _mm_cmpeq_epi8(_mm_and_si128(line, _mm_set1_epi8(SPRITE_LINE_BEHIND_BG)), _mm_set1_epi8(SPRITE_LINE_BEHIND_BG));
+    // the background shows where the sprite is transparent or behind an opaque background pixel
+    __m128i background = _mm_or_si128(_mm_cmpeq_epi8(sprite, _mm_setzero_si128()), _mm_andnot_si128(_mm_cmpeq_epi8(pixels, _mm_setzero_si128()), behind));
+    return _mm_or_si128(_mm_and_si128(background, index), _mm_andnot_si128(background, sprite));
+}
+
+// Looks each color channel up with pshufb, 16 palette entries per shuffle
+__attribute__((target("ssse3")))
+void composeTileSSSE3(emulator_t* emu, unsigned int* out, const unsigned char* sprites)
+{
+    __m128i index = tilePaletteIndices(emu, sprites);
+    __m128i upper = _mm_cmpeq_epi8(_mm_and_si128(index, _mm_set1_epi8(0x10)), _mm_set1_epi8(0x10));
+    __m128i channels[3];
+    for (int c = 0; c < 3; c++)
+    {
+        __m128i lo = _mm_shuffle_epi8(_mm_load_si128((const __m128i*) &emu->paletteChannels[c][0]), index);
+        __m128i hi = _mm_shuffle_epi8(_mm_load_si128((const __m128i*) &emu->paletteChannels[c][16]), index);
+        channels[c] = _mm_or_si128(_mm_andnot_si128(upper, lo), _mm_and_si128(upper, hi));
+    }
+    __m128i blueGreen = _mm_unpacklo_epi8(channels[0], channels[1]);
+    __m128i red = _mm_unpacklo_epi8(channels[2], _mm_setzero_si128());
+    _mm_storeu_si128((__m128i*) out, _mm_unpacklo_epi16(blueGreen, red));
+    _mm_storeu_si128((__m128i*) (out + 4), _mm_unpackhi_epi16(blueGreen, red));
+}
+
+// Gathers all 8 pixels from the resolved palette at once
+__attribute__((target("avx2")))
+void composeTileAVX2(emulator_t* emu, unsigned int* out, const unsigned char* sprites)
+{
+    __m256i index = _mm256_cvtepu8_epi32(tilePaletteIndices(emu, sprites));
+    _mm256_storeu_si256((__m256i*) out, _mm256_i32gather_epi32((const int*) emu->paletteRGB, index, 4));
+}
+#endif
+
+// Resolves all of palette RAM, needed whenever it changes other than through PPUDATA
+void resolvePalette(emulator_t* emu)
+{
+    for (int i = 0; i < 32; i++)
+        resolvePaletteEntry(emu, i);
+}
+
+void resolvePaletteEntry(emulator_t* emu, int index)
+{
+    unsigned int rgb = palette_to_rgb_table[emu->machine.ppuMem[0x3F00 + index] & 0x3F];
+    emu->paletteRGB[index] = rgb;
+    emu->paletteChannels[0][index] = rgb & 0xFF;
+    emu->paletteChannels[1][index] = (rgb >> 8) & 0xFF;
+    emu->paletteChannels[2][index] = (rgb >> 16) & 0xFF;
+    emu->paletteColors[index] = emu->machine.ppuMem[0x3F00 + index] & 0x3F;
+}
+
+// Allocates an emulator at power-on, ready for a ROM. The machine starts out zeroed so that
+// headless runs are reproducible.
+emulator_t* createEmulator()
+{
+    emulator_t* emu = calloc(1, sizeof(emulator_t));
+    if (emu == NULL)
+        return NULL;
+    emu->machine.nextEventTime = NO_EVENT;
+    setFlags(emu, (1 << INTERRUPT_FLAG) | (1 << UNUSED_FLAG)); // reset masks IRQs, the frame counter's would fire right away
+    emu->machine.ppu.status = 0b10100000;
+    resetAPU(emu);
+    initBus(emu);
+    resolvePalette(emu);
+    return emu;
+}
+
+// Unloads the cartridge and frees everything the emulator owns
+void destroyEmulator(emulator_t* emu)
+{
+    if (emu->pipeline != NULL)
+        stopPipeline(emu);
+    if (emu->raster != NULL)
+        stopRasterPool(emu);
+    if (emu->trace != NULL)
+        stopTrace(emu);
+    if (emu->observer != NULL)
+        stopObserver(emu);
+#ifdef FE_PROFILE
+    free(emu->profile);
+#endif
+    freeRewind(emu);
+    freeMovie(emu);
+    free(emu->chrRam);
+    free(emu->tileCache.pixels);
+    free(emu->tileCache.valid);
+    closeROM(&emu->cartridge);
+    free(emu);
+}
+
+// Maps a ROM image into memory and parses its header
+int openROM(const char* path, rom_t* rom)
+{
+    memset(rom, 0, sizeof(rom_t));
+#ifdef _WIN32
+    // no mmap here, the image is read with a single call instead
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        feROMErr("Could not open file");
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    rom->data = size > 0 ? malloc(size) : NULL;
+    if (rom->data == NULL || fread(rom->data, 1, size, file) != (size_t) size)
+    {
+        fclose(file);
+        closeROM(rom);
+        feROMErr("Could not read file");
+        return -1;
+    }
+    fclose(file);
+    rom->size = size;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        feROMErr("Could not open file");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0)
+    {
+        close(fd);
+        feROMErr("Could not read file");
+        return -1;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid
+    if (data == MAP_FAILED)
+    {
+        feROMErr("Could not map file");
+        return -1;
+    }
+    rom->data = data;
+    rom->size = st.st_size;
+    rom->mapped = 1;
+#endif
+    if (parseROMHeader(rom) == -1)
+    {
+        closeROM(rom);
+        return -1;
+    }
+    return 0;
+}
+
+// Copies a ROM image out of memory and parses its header
+int openROMImage(const void* data, size_t size, rom_t* rom)
+{
+    memset(rom, 0, sizeof(rom_t));
+    rom->data = size > 0 ? malloc(size) : NULL;
+    if (rom->data == NULL)
+    {
+        feROMErr("Empty image");
+        return -1;
+    }
+    memcpy(rom->data, data, size);
+    rom->size = size;
+    if (parseROMHeader(rom) == -1)
+    {
+        closeROM(rom);
+        return -1;
+    }
+    return 0;
+}
+
+// Fills in the rom fields from an iNES or NES 2.0 header, anything past CHR (PlayChoice data) is ignored
+int parseROMHeader(rom_t* rom)
+{
+    const unsigned char* header = rom->data;
+    if (rom->size < INES_HEADER_SIZE)
+    {
+        feROMErr("End of file");
+        return -1;
+    }
+    if (memcmp(header, ines_constant, 4) != 0)
+    {
+        feROMErr("iNES header constant is incorrect");
+        return -1;
+    }
+    rom->nes2 = (header[7] & 0x0C) == 0x08;
+    if (isBitSet(header[6], 3))
+        rom->mirroring = MIRRORING_FOUR_SCREEN;
+    else
+        rom->mirroring = isBitSet(header[6], 0) ? MIRRORING_VERTICAL : MIRRORING_HORIZONTAL;
+    rom->battery = isBitSet(header[6], 1);
+    rom->mapper = (header[6] >> 4) | (header[7] & 0xF0);
+    if (rom->nes2)
+    {
+        rom->mapper |= (header[8] & 0x0F) << 8;
+        rom->submapper = header[8] >> 4;
+        rom->prgSize = nes2ROMSize(header[4], header[9] & 0x0F, PRG_BANK_SIZE);
+        rom->chrSize = nes2ROMSize(header[5], header[9] >> 4, CHR_BANK_SIZE);
+        // volatile and battery-backed RAM sizes are stored as shift counts of 64 bytes
+        for (int shift = 0; shift <= 4; shift += 4)
+        {
+            if ((header[10] >> shift) & 0x0F)
+                rom->prgRamSize += 64 << ((header[10] >> shift) & 0x0F);
+            if ((header[11] >> shift) & 0x0F)
+                rom->chrRamSize += 64 << ((header[11] >> shift) & 0x0F);
+        }
+    }
+    else
+    {
+        // old dumping tools signed their name into bytes 7-15, which makes the upper mapper nibble junk
+        if (header[12] || header[13] || header[14] || header[15])
+            rom->mapper &= 0x0F;
+        rom->prgSize = header[4] * PRG_BANK_SIZE;
+        rom->chrSize = header[5] * CHR_BANK_SIZE;
+        rom->prgRamSize = (header[8] ? header[8] : 1) * PRG_RAM_SIZE;
+        rom->chrRamSize = rom->chrSize == 0 ? CHR_RAM_SIZE : 0;
+    }
+    size_t offset = INES_HEADER_SIZE;
+    if (isBitSet(header[6], 2))
+    {
+        rom->trainer = rom->data + offset;
+        offset += INES_TRAINER_SIZE;
+    }
+    if (rom->prgSize == 0)
+    {
+        feROMErr("No PRG ROM");
+        return -1;
+    }
+    if (offset + rom->prgSize + rom->chrSize > rom->size)
+    {
+        feROMErr("End of file");
+        return -1;
+    }
+    rom->prg = rom->data + offset;
+    rom->chr = rom->chrSize ? rom->prg + rom->prgSize : NULL;
+    return 0;
+}
+
+// NES 2.0 sizes are a bank count, or 2^E * (MM * 2 + 1) bytes when the MSB nibble is $F
+unsigned long long nes2ROMSize(unsigned char lsb, unsigned char msb, unsigned int bankSize)
+{
+    if (msb != 0x0F)
+        return ((msb << 8) | lsb) * (unsigned long long) bankSize;
+    if ((lsb >> 2) > 40) // larger than any file, but small enough not to overflow later sums
+        return 1ULL << 48;
+    return (1ULL << (lsb >> 2)) * (((lsb & 0b11) * 2) + 1);
+}
+
+void closeROM(rom_t* rom)
+{
+    if (rom->data == NULL)
+        return;
+#ifndef _WIN32
+    if (rom->mapped)
+        munmap(rom->data, rom->size);
+    else
+#endif
+        free(rom->data);
+    memset(rom, 0, sizeof(rom_t));
+}
+
+int loadROM(emulator_t* emu, const char* path)
+{
+    if (openROM(path, &emu->cartridge) == -1)
+        return -1;
+    return insertCartridge(emu);
+}
+
+int loadROMImage(emulator_t* emu, const void* data, size_t size)
+{
+    if (openROMImage(data, size, &emu->cartridge) == -1)
+        return -1;
+    return insertCartridge(emu);
+}
+
+// Maps the opened cartridge into the emulator and points the CPU at its reset vector
+int insertCartridge(emulator_t* emu)
+{
+    for (unsigned int i = 0; i < sizeof(mapper_table) / sizeof(mapper_t); i++)
+    {
+        if (mapper_table[i].number == emu->cartridge.mapper)
+            emu->mapper = &mapper_table[i];
+    }
+    if (emu->mapper == NULL)
+    {
+        ejectCartridge(emu);
+        feROMErr("Unsupported mapper");
+        return -1;
+    }
+    if (emu->cartridge.prgSize % PRG_BANK_SIZE != 0 || emu->cartridge.prgSize > 0x400000)
+    {
+        ejectCartridge(emu);
+        feROMErr("Unsupported PRG ROM size");
+        return -1;
+    }
+    if (emu->cartridge.chrSize % CHR_BANK_SIZE != 0 || emu->cartridge.chrSize > 0x400000)
+    {
+        ejectCartridge(emu);
+        feROMErr("Unsupported CHR ROM size");
+        return -1;
+    }
+    if (emu->cartridge.trainer != NULL)
+        memcpy(emu->machine.prgRam + TRAINER_OFFSET, emu->cartridge.trainer, INES_TRAINER_SIZE);
+    if (emu->cartridge.chr != NULL)
+    {
+        emu->chrMem = (unsigned char*) emu->cartridge.chr;
+        emu->chrMemSize = emu->cartridge.chrSize;
+    }
+    else
+    {
+        emu->chrMemSize = emu->cartridge.chrRamSize > CHR_RAM_SIZE ? (emu->cartridge.chrRamSize / CHR_RAM_SIZE) * CHR_RAM_SIZE : CHR_RAM_SIZE;
+        emu->chrMem = emu->chrRam = calloc(emu->chrMemSize, 1);
+        emu->chrWritable = 1;
+    }
+    emu->tileCache.pixels = malloc((emu->chrMemSize / 16) * sizeof(*emu->tileCache.pixels));
+    emu->tileCache.valid = calloc(emu->chrMemSize / 16, 1);
+    if (emu->chrMem == NULL || emu->tileCache.pixels == NULL || emu->tileCache.valid == NULL)
+    {
+        ejectCartridge(emu);
+        feROMErr("Could not allocate CHR memory");
+        return -1;
+    }
+    // PRG and CHR banks are mapped straight from the image, the mapper only moves pointers around
+    if (emu->mapper->write != NULL)
+        mapBusHandlers(emu, CPU_PRG_OFFSET >> 8, 0xFF, openBusRead, mapperRegisterWrite);
+    setMirroring(emu, emu->cartridge.mirroring);
+    memset(&emu->machine.mapper, 0, sizeof(mapper_state_t));
+    if (emu->mapper->reset != NULL)
+        emu->mapper->reset(emu);
+    emu->mapper->sync(emu);
+    // Load Reset address from vector
+    emu->machine.pc = readAddr(emu, RESET_VECTOR);
+    return 0;
+}
+
+// Undoes what insertCartridge() got to, a rejected ROM leaves the emulator without a cartridge
+void ejectCartridge(emulator_t* emu)
+{
+    free(emu->chrRam);
+    free(emu->tileCache.pixels);
+    free(emu->tileCache.valid);
+    emu->chrMem = emu->chrRam = NULL;
+    emu->chrMemSize = 0;
+    emu->chrWritable = 0;
+    memset(&emu->tileCache, 0, sizeof(emu->tileCache));
+    emu->mapper = NULL;
+    closeROM(&emu->cartridge);
+}
+
+// Bus: every 256-byte page of the CPU address space either points straight at memory or is
+// routed to a register handler. RAM and ROM accesses stay a single indexed load.
+
+void mapBusMemory(emulator_t* emu, int firstPage, int lastPage, unsigned char* mem, unsigned int size, int writable)
+{
+    for (int page = firstPage; page <= lastPage; page++)
+    {
+        emu->readPages[page] = mem + (((page - firstPage) << 8) % size);
+        if (writable)
+            emu->writePages[page] = emu->readPages[page];
+    }
+}
+
+void mapBusHandlers(emulator_t* emu, int firstPage, int lastPage, bus_read_handler_t read, bus_write_handler_t write)
+{
+    for (int page = firstPage; page <= lastPage; page++)
+    {
+        emu->readPages[page] = emu->writePages[page] = NULL;
+        emu->readHandlers[page] = read;
+        emu->writeHandlers[page] = write;
+    }
+}
+
+void initBus(emulator_t* emu)
+{
+    mapBusHandlers(emu, 0x00, 0xFF, openBusRead, openBusWrite);
+    mapBusMemory(emu, 0x00, 0x1F, emu->machine.cpuMem, CPU_RAM_SIZE, 1); // 2kb internal RAM, mirrored up to $1FFF
+    mapBusHandlers(emu, 0x20, 0x3F, ppuRegisterRead, ppuRegisterWrite); // 8 registers, mirrored up to $3FFF
+    mapBusHandlers(emu, 0x40, 0x40, ioRegisterRead, ioRegisterWrite);
+    mapBusMemory(emu, 0x60, 0x7F, emu->machine.prgRam, PRG_RAM_SIZE, 1);
+}
+
+static inline unsigned char cpuRead(emulator_t* emu, unsigned short mem)
+{
+    unsigned char* page = emu->readPages[mem >> 8];
+    if (page != NULL)
+        return page[mem & 0xFF];
+    return emu->readHandlers[mem >> 8](emu, mem);
+}
+
+static inline void cpuWrite(emulator_t* emu, unsigned short mem, unsigned char value)
+{
+    unsigned char* page = emu->writePages[mem >> 8];
+    if (page != NULL)
+        page[mem & 0xFF] = value;
+    else
+        emu->writeHandlers[mem >> 8](emu, mem, value);
+}
+
+// PPU bus: pattern tables and nametables go through their slots, palette RAM lives in PPU memory
+static inline unsigned char ppuRead(emulator_t* emu, unsigned short addr)
+{
+    if (addr < 0x2000)
+        return emu->chrPages[addr >> 10][addr & (CHR_PAGE_SIZE - 1)];
+    if (addr < 0x3F00) // $3000-$3EFF mirrors the nametables
+        return emu->nametablePages[(addr >> 10) & 0b11][addr & 0x3FF];
+    return emu->machine.ppuMem[addr];
+}
+
+static inline void ppuWrite(emulator_t* emu, unsigned short addr, unsigned char value)
+{
+    if (addr < 0x2000)
+    {
+        if (emu->chrWritable)
+        {
+            emu->chrPages[addr >> 10][addr & (CHR_PAGE_SIZE - 1)] = value;
+            invalidateTile(emu, addr);
+        }
+        return;
+    }
+    if (addr < 0x3F00)
+    {
+        emu->nametablePages[(addr >> 10) & 0b11][addr & 0x3FF] = value;
+        return;
+    }
+    emu->machine.ppuMem[addr] = value;
+    if (addr >= 0x3F00 && addr < 0x3F20)
+        resolvePaletteEntry(emu, addr - 0x3F00);
+}
+
+// Unmapped addresses read back the high byte of the address, which is what was last on the bus
+unsigned char openBusRead(emulator_t* emu, unsigned short mem)
+{
+    return hiByte(mem);
+}
+
+void openBusWrite(emulator_t* emu, unsigned short mem, unsigned char value)
+{
+}
+
+unsigned char ppuRegisterRead(emulator_t* emu, unsigned short mem)
+{
+    if (emu->pipeline != NULL)
+        return pipelinedRegisterRead(emu, mem);
+    // rendering only changes what PPUSTATUS reads by a sprite 0 hit, catching up when there can be
+    // none leaves the raster pool more scanlines at a time
+    if (emu->raster == NULL || (mem & 0x07) != (PPUSTATUS & 0x07) || (!isBitSet(emu->machine.ppu.status, SPRITE_0_HIT_BIT) && emu->machine.ppu.pOAM[3] != 0))
+        ppuCatchUp(emu);
+    switch (PPUCTRL | (mem & 0x07))
+    {
+        case PPUSTATUS:
+        {
+            unsigned char value = emu->machine.ppu.status;
+            clearBit(&emu->machine.ppu.status, VBLANK_BIT);
+            emu->machine.ppu.writeToggle = 0; // reset address latch
+            return value;
+        }
+        case OAMDATA:
+            return emu->machine.ppu.pOAM[emu->machine.ppu.oamAddr];
+        case PPUDATA:
+        {
+            unsigned short addr = emu->machine.ppu.currentVRamAddr.exactAddr;
+            unsigned char value = emu->machine.ppu.dataBuffer; // reads outside of palette memory are delayed by one
+            emu->machine.ppu.dataBuffer = ppuRead(emu, addr);
+            if (addr >= 0x3F00)
+                value = emu->machine.ppu.dataBuffer;
+            emu->machine.ppu.currentVRamAddr.exactAddr += isBitSet(emu->machine.ppu.ctrl, VRAM_INC_BIT) ? 0x20 : 1;
+            return value;
+        }
+        default:
+            return emu->machine.ppu.dataBuffer;
+    }
+}
+
+void ppuRegisterWrite(emulator_t* emu, unsigned short mem, unsigned char value)
+{
+    ppuCatchUp(emu);
+    if (emu->pipeline != NULL) // still applied here, NMIs and mappers go by PPUCTRL and PPUMASK
+        logPpu(emu, PPU_LOG_WRITE, mem, value, 0);
+    switch (PPUCTRL | (mem & 0x07))
+    {
+        case PPUCTRL:
+            emu->machine.ppu.ctrl = value;
+            break;
+        case PPUMASK:
+            emu->machine.ppu.mask = value;
+            break;
+        case OAMADDR:
+            emu->machine.ppu.oamAddr = value;
+            break;
+        case OAMDATA:
+            emu->machine.ppu.pOAM[emu->machine.ppu.oamAddr++] = value;
+            if (emu->pipeline != NULL && emu->machine.ppu.pOAM[3] != 0)
+                emu->pipeline->hitPossible = 1;
+            break;
+        case PPUSCROLL:
+        {
+            if (emu->machine.ppu.writeToggle) // changing y scroll
+            {
+                emu->machine.ppu.currentVRamAddr.coarseYScroll = value / 8;
+                emu->machine.ppu.currentVRamAddr.fineYScroll = value % 8;
+                emu->machine.ppu.writeToggle = 0;
+            }
+            else
+            {
+                emu->machine.ppu.currentVRamAddr.coarseXScroll = value / 8;
+                emu->machine.ppu.fineXScroll = value % 8;
+                emu->machine.ppu.writeToggle = 1;
+            }
+            break;
+        }
+        case PPUADDR: // some goofy bit mirroring because i was lazy earlier
+        {
+            if (emu->machine.ppu.writeToggle) // write latch set, low byte being updated
+            {
+                emu->machine.ppu.currentVRamAddr.exactAddr = (emu->machine.ppu.currentVRamAddr.exactAddr & 0x3F00) | value;
+                emu->machine.ppu.writeToggle = 0;
+            }
+            else
+            {
+                emu->machine.ppu.currentVRamAddr.exactAddr = (emu->machine.ppu.currentVRamAddr.exactAddr & 0xFF) | (((unsigned short) value) << 8);
+                emu->machine.ppu.writeToggle = 1;
+            }
+            break;
+        }
+        case PPUDATA:
+        {
+            ppuWrite(emu, emu->machine.ppu.currentVRamAddr.exactAddr, value);
+            emu->machine.ppu.currentVRamAddr.exactAddr += isBitSet(emu->machine.ppu.ctrl, VRAM_INC_BIT) ? 0x20 : 1;
+            break;
+        }
+    }
+}
+
+// $4000-$40FF: APU and I/O registers, everything past $401F is open bus
+unsigned char ioRegisterRead(emulator_t* emu, unsigned short mem)
+{
+    if (mem == CONTROLLER_1)
+    {
+        unsigned char value;
+        if (emu->machine.readNC1 >= 8)
+            value = (unsigned char) 1;
+        else
+            value = (unsigned char) ((emu->machine.buttons & (1 << emu->machine.readNC1)) != 0);
+        emu->machine.readNC1++;
+        return value;
+    }
+    if (mem == CONTROLLER_2) // the high byte of buttons, shifted out the same way
+    {
+        unsigned char value;
+        if (emu->machine.readNC2 >= 8)
+            value = (unsigned char) 1;
+        else
+            value = (unsigned char) (((emu->machine.buttons >> 8) & (1 << emu->machine.readNC2)) != 0);
+        emu->machine.readNC2++;
+        return value;
+    }
+    if (mem == APU_STATUS)
+        return apuReadStatus(emu);
+    return openBusRead(emu, mem);
+}
+
+void ioRegisterWrite(emulator_t* emu, unsigned short mem, unsigned char value)
+{
+    if (mem == OAMDMA)
+    {
+        ppuCatchUp(emu);
+        unsigned short basePageAddr = ((unsigned short) value) << 8;
+        for (int i = 0; i < 256; i++)
+        {
+            unsigned char index = emu->machine.ppu.oamAddr + i;
+            emu->machine.ppu.pOAM[index] = cpuRead(emu, basePageAddr + i);
+            if (emu->pipeline != NULL)
+                logPpu(emu, PPU_LOG_OAM, index, emu->machine.ppu.pOAM[index], 0);
+        }
+        if (emu->pipeline != NULL && emu->machine.ppu.pOAM[3] != 0)
+            emu->pipeline->hitPossible = 1;
+        emu->machine.masterClock += OAM_DMA_CYCLES * CPU_CLOCK_DIVIDER; // the CPU is stalled while the copy happens
+    }
+    if (mem <= 0x4013 || mem == APU_STATUS || mem == APU_FRAME_COUNTER)
+        apuWrite(emu, mem, value);
+    if (mem == CONTROLLER_1)
+    {
+        if (value == 0)
+        {
+            emu->machine.readNC1 = 0;
+            emu->machine.readNC2 = 0;
+        }
+    }
+}
+
+// APU state at power-on
+void resetAPU(emulator_t* emu)
+{
+    apu_t* apu = &emu->machine.apu;
+    apu->noise.shift = 1;
+    apu->noise.period = noise_period_table[0];
+    apu->dmc.period = dmc_rate_table[0];
+    apu->dmc.bits = 8;
+    apu->dmc.silence = 1;
+    apu->frameStart = apu->clock;
+    apu->frameStep = 0;
+    apu->nextFrameStep = apu->frameStart + frame_counter_steps[0];
+    apu->output = apuMix(apu);
+    resetAudio(emu);
+}
+
+// Runs the APU up to the CPU. Only audible channels are clocked, a channel that becomes audible
+// picks its timer up from the present.
+void apuCatchUp(emulator_t* emu)
+{
+    apu_t* apu = &emu->machine.apu;
+    unsigned long long target = emu->machine.masterClock / CPU_CLOCK_DIVIDER;
+    while (apu->clock < target)
+    {
+        unsigned char pulseAudible[2] = { isPulseAudible(&apu->pulse[0], 0), isPulseAudible(&apu->pulse[1], 1) };
+        unsigned char triangleAudible = apu->triangle.length && apu->triangle.linearCounter && apu->triangle.period >= 2; // ultrasonic periods are held
+        unsigned char noiseAudible = apu->noise.length != 0;
+        unsigned char dmcAudible = !apu->dmc.silence || apu->dmc.bufferFull || apu->dmc.remaining;
+        unsigned long long* timers[5] = { pulseAudible[0] ? &apu->pulse[0].timer : NULL, pulseAudible[1] ? &apu->pulse[1].timer : NULL,
+            triangleAudible ? &apu->triangle.timer : NULL, noiseAudible ? &apu->noise.timer : NULL, dmcAudible ? &apu->dmc.timer : NULL };
+        unsigned long long next = apu->nextFrameStep < target ? apu->nextFrameStep : target;
+        for (int i = 0; i < 5; i++)
+        {
+            if (timers[i] == NULL)
+                continue;
+            if (*timers[i] < apu->clock)
+                *timers[i] = apu->clock;
+            if (*timers[i] < next)
+                next = *timers[i];
+        }
+        apu->clock = next;
+        for (int i = 0; i < 2; i++)
+        {
+            apu_pulse_t* pulse = &apu->pulse[i];
+            if (pulseAudible[i] && pulse->timer == next)
+            {
+                pulse->step = (pulse->step + 1) & 7;
+                pulse->timer += (pulse->period + 1) * 2; // clocked every other CPU cycle
+            }
+        }
+        if (triangleAudible && apu->triangle.timer == next)
+        {
+            apu->triangle.step = (apu->triangle.step + 1) & 31;
+            apu->triangle.timer += apu->triangle.period + 1;
+        }
+        if (noiseAudible && apu->noise.timer == next)
+        {
+            apu_noise_t* noise = &apu->noise;
+            unsigned short feedback = (noise->shift ^ (noise->shift >> (noise->mode ? 6 : 1))) & 1;
+            noise->shift = (noise->shift >> 1) | (feedback << 14);
+            noise->timer += noise->period;
+        }
+        if (dmcAudible && apu->dmc.timer == next)
+        {
+            apuClockDmc(emu);
+            apu->dmc.timer += apu->dmc.period;
+        }
+        if (next == apu->nextFrameStep)
+            apuFrameStep(emu);
+        apuUpdateOutput(emu);
+    }
+}
+
+// Adds a change of the mixer output at the current APU clock to the audio
+void apuUpdateOutput(emulator_t* emu)
+{
+    apu_t* apu = &emu->machine.apu;
+    float output = apuMix(apu);
+    if (output != apu->output)
+    {
+        addAudioDelta(emu, apu->clock, output - apu->output);
+        apu->output = output;
+    }
+}
+
+// The 2A03's nonlinear mixer
+float apuMix(apu_t* apu)
+{
+    int pulse = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        if (isPulseAudible(&apu->pulse[i], i) && duty_table[apu->pulse[i].duty][apu->pulse[i].step])
+            pulse += envelopeVolume(&apu->pulse[i].envelope);
+    }
+    int noise = apu->noise.length && !(apu->noise.shift & 1) ? envelopeVolume(&apu->noise.envelope) : 0;
+    float tnd = triangle_table[apu->triangle.step] / 8227.0f + noise / 12241.0f + apu->dmc.level / 22638.0f;
+    return (pulse ? 95.88f / (8128.0f / pulse + 100) : 0) + (tnd > 0 ? 159.79f / (1 / tnd + 100) : 0);
+}
+
+unsigned char apuReadStatus(emulator_t* emu)
+{
+    apuCatchUp(emu);
+    apu_t* apu = &emu->machine.apu;
+    unsigned char value = (apu->pulse[0].length > 0) | ((apu->pulse[1].length > 0) << 1) | ((apu->triangle.length > 0) << 2) | ((apu->noise.length > 0) << 3) | ((apu->dmc.remaining > 0) << 4);
+    if (emu->machine.irqLines & IRQ_SOURCE_FRAME_COUNTER)
+        value |= 0x40;
+    if (emu->machine.irqLines & IRQ_SOURCE_DMC)
+        value |= 0x80;
+    emu->machine.irqLines &= ~IRQ_SOURCE_FRAME_COUNTER; // acknowledged by reading
+    return value;
+}
+
+void apuWrite(emulator_t* emu, unsigned short mem, unsigned char value)
+{
+    apu_t* apu = &emu->machine.apu;
+    apuCatchUp(emu);
+    if (mem < 0x4008)
+    {
+        int channel = (mem >> 2) & 1;
+        apu_pulse_t* pulse = &apu->pulse[channel];
+        switch (mem & 3)
+        {
+            case 0:
+            {
+                pulse->duty = value >> 6;
+                setEnvelope(&pulse->envelope, value);
+                break;
+            }
+            case 1:
+            {
+                pulse->sweepEnabled = isBitSet(value, 7);
+                pulse->sweepPeriod = (value >> 4) & 0x07;
+                pulse->sweepNegate = isBitSet(value, 3);
+                pulse->sweepShift = value & 0x07;
+                pulse->sweepReload = 1;
+                break;
+            }
+            case 2:
+            {
+                pulse->period = (pulse->period & 0x700) | value;
+                break;
+            }
+            case 3:
+            {
+                pulse->period = (pulse->period & 0xFF) | ((value & 0x07) << 8);
+                if (apu->enabled & (1 << channel))
+                    pulse->length = length_table[value >> 3];
+                pulse->step = 0;
+                pulse->envelope.start = 1;
+                break;
+            }
+        }
+    }
+    switch (mem)
+    {
+        case 0x4008:
+        {
+            apu->triangle.control = isBitSet(value, 7);
+            apu->triangle.linearPeriod = value & 0x7F;
+            break;
+        }
+        case 0x400A:
+        {
+            apu->triangle.period = (apu->triangle.period & 0x700) | value;
+            break;
+        }
+        case 0x400B:
+        {
+            apu->triangle.period = (apu->triangle.period & 0xFF) | ((value & 0x07) << 8);
+            if (apu->enabled & 0x04)
+                apu->triangle.length = length_table[value >> 3];
+            apu->triangle.linearReload = 1;
+            break;
+        }
+        case 0x400C:
+        {
+            setEnvelope(&apu->noise.envelope, value);
+            break;
+        }
+        case 0x400E:
+        {
+            apu->noise.mode = isBitSet(value, 7);
+            apu->noise.period = noise_period_table[value & 0x0F];
+            break;
+        }
+        case 0x400F:
+        {
+            if (apu->enabled & 0x08)
+                apu->noise.length = length_table[value >> 3];
+            apu->noise.envelope.start = 1;
+            break;
+        }
+        case 0x4010:
+        {
+            apu->dmc.irqEnabled = isBitSet(value, 7);
+            apu->dmc.loop = isBitSet(value, 6);
+            apu->dmc.period = dmc_rate_table[value & 0x0F];
+            if (!apu->dmc.irqEnabled)
+                emu->machine.irqLines &= ~IRQ_SOURCE_DMC;
+            break;
+        }
+        case 0x4011:
+        {
+            apu->dmc.level = value & 0x7F;
+            break;
+        }
+        case 0x4012:
+        {
+            apu->dmc.sampleAddress = 0xC000 + (value << 6);
+            break;
+        }
+        case 0x4013:
+        {
+            apu->dmc.sampleLength = (value << 4) + 1;
+            break;
+        }
+        case APU_STATUS:
+        {
+            apu->enabled = value & 0x1F;
+            if (!isBitSet(value, 0))
+                apu->pulse[0].length = 0;
+            if (!isBitSet(value, 1))
+                apu->pulse[1].length = 0;
+            if (!isBitSet(value, 2))
+                apu->triangle.length = 0;
+            if (!isBitSet(value, 3))
+                apu->noise.length = 0;
+            if (!isBitSet(value, 4))
+                apu->dmc.remaining = 0;
+            else if (apu->dmc.remaining == 0)
+            {
+                apu->dmc.address = apu->dmc.sampleAddress;
+                apu->dmc.remaining = apu->dmc.sampleLength;
+                apuFetchDmcSample(emu);
+            }
+            emu->machine.irqLines &= ~IRQ_SOURCE_DMC;
+            break;
+        }
+        case APU_FRAME_COUNTER:
+        {
+            apu->frameMode = isBitSet(value, 7);
+            apu->irqInhibit = isBitSet(value, 6);
+            if (apu->irqInhibit)
+                emu->machine.irqLines &= ~IRQ_SOURCE_FRAME_COUNTER;
+            if (apu->frameMode) // the five step sequence clocks everything right away
+            {
+                apuQuarterFrame(apu);
+                apuHalfFrame(apu);
+            }
+            apu->frameStart = apu->clock;
+            apu->frameStep = 0;
+            apu->nextFrameStep = apu->frameStart + frame_counter_steps[0];
+            scheduleEvent(emu, EVENT_APU_FRAME, apu->nextFrameStep * CPU_CLOCK_DIVIDER);
+            break;
+        }
+    }
+    apuUpdateOutput(emu);
+}
+
+// Four steps: quarter, quarter and half, quarter, quarter and half with IRQ. Five steps: the same
+// without the IRQ, with an extra step doing nothing before the last.
+void apuFrameStep(emulator_t* emu)
+{
+    apu_t* apu = &emu->machine.apu;
+    int steps = apu->frameMode ? 5 : 4;
+    if (apu->frameStep != 3 || !apu->frameMode)
+        apuQuarterFrame(apu);
+    if (apu->frameStep == 1 || apu->frameStep == steps - 1)
+        apuHalfFrame(apu);
+    if (apu->frameStep == 3 && !apu->frameMode && !apu->irqInhibit)
+        emu->machine.irqLines |= IRQ_SOURCE_FRAME_COUNTER;
+    if (++apu->frameStep == steps)
+    {
+        apu->frameStep = 0;
+        apu->frameStart += frame_counter_periods[apu->frameMode];
+    }
+    apu->nextFrameStep = apu->frameStart + frame_counter_steps[apu->frameStep];
+}
+
+// Envelopes and the triangle's linear counter
+void apuQuarterFrame(apu_t* apu)
+{
+    clockEnvelope(&apu->pulse[0].envelope);
+    clockEnvelope(&apu->pulse[1].envelope);
+    clockEnvelope(&apu->noise.envelope);
+    apu_triangle_t* triangle = &apu->triangle;
+    if (triangle->linearReload)
+        triangle->linearCounter = triangle->linearPeriod;
+    else if (triangle->linearCounter)
+        triangle->linearCounter--;
+    if (!triangle->control)
+        triangle->linearReload = 0;
+}
+
+// Length counters and sweeps
+void apuHalfFrame(apu_t* apu)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        apu_pulse_t* pulse = &apu->pulse[i];
+        if (pulse->length && !pulse->envelope.loop)
+            pulse->length--;
+        unsigned short target = pulseSweepTarget(pulse, i);
+        if (!pulse->sweepDivider && pulse->sweepEnabled && pulse->sweepShift && pulse->period >= 8 && target <= 0x7FF)
+            pulse->period = target;
+        if (!pulse->sweepDivider || pulse->sweepReload)
+        {
+            pulse->sweepDivider = pulse->sweepPeriod;
+            pulse->sweepReload = 0;
+        }
+        else
+            pulse->sweepDivider--;
+    }
+    if (apu->triangle.length && !apu->triangle.control)
+        apu->triangle.length--;
+    if (apu->noise.length && !apu->noise.envelope.loop)
+        apu->noise.length--;
+}
+
+// Plays a bit of the output shift register, refilling it from the sample buffer after the eighth
+void apuClockDmc(emulator_t* emu)
+{
+    apu_dmc_t* dmc = &emu->machine.apu.dmc;
+    if (!dmc->silence)
+    {
+        if (dmc->shift & 1)
+        {
+            if (dmc->level <= 125)
+                dmc->level += 2;
+        }
+        else if (dmc->level >= 2)
+            dmc->level -= 2;
+        dmc->shift >>= 1;
+    }
+    if (--dmc->bits == 0)
+    {
+        dmc->bits = 8;
+        dmc->silence = !dmc->bufferFull;
+        dmc->shift = dmc->sampleBuffer;
+        dmc->bufferFull = 0;
+        apuFetchDmcSample(emu);
+    }
+}
+
+// Fills the sample buffer from the CPU bus. The CPU stall this causes is not emulated.
+void apuFetchDmcSample(emulator_t* emu)
+{
+    apu_dmc_t* dmc = &emu->machine.apu.dmc;
+    if (dmc->bufferFull || !dmc->remaining)
+        return;
+    dmc->sampleBuffer = cpuRead(emu, dmc->address);
+    dmc->bufferFull = 1;
+    dmc->address = dmc->address == 0xFFFF ? 0x8000 : dmc->address + 1;
+    if (--dmc->remaining == 0)
+    {
+        if (dmc->loop)
+        {
+            dmc->address = dmc->sampleAddress;
+            dmc->remaining = dmc->sampleLength;
+        }
+        else if (dmc->irqEnabled)
+            emu->machine.irqLines |= IRQ_SOURCE_DMC;
+    }
+}
+
+void setEnvelope(apu_envelope_t* envelope, unsigned char value)
+{
+    envelope->loop = isBitSet(value, 5);
+    envelope->constant = isBitSet(value, 4);
+    envelope->volume = value & 0x0F;
+}
+
+void clockEnvelope(apu_envelope_t* envelope)
+{
+    if (envelope->start)
+    {
+        envelope->start = 0;
+        envelope->decay = 15;
+        envelope->divider = envelope->volume;
+    }
+    else if (envelope->divider)
+        envelope->divider--;
+    else
+    {
+        envelope->divider = envelope->volume;
+        if (envelope->decay)
+            envelope->decay--;
+        else if (envelope->loop)
+            envelope->decay = 15;
+    }
+}
+
+unsigned char envelopeVolume(apu_envelope_t* envelope)
+{
+    return envelope->constant ? envelope->volume : envelope->decay;
+}
+
+// Period the sweep unit would set, pulse 1 subtracts the one's complement of the change
+unsigned short pulseSweepTarget(apu_pulse_t* pulse, int channel)
+{
+    unsigned short change = pulse->period >> pulse->sweepShift;
+    if (!pulse->sweepNegate)
+        return pulse->period + change;
+    return pulse->period - change - (channel == 0);
+}
+
+// Silenced by its length counter, or muted by the sweep unit whether sweeping or not
+int isPulseAudible(apu_pulse_t* pulse, int channel)
+{
+    return pulse->length && pulse->period >= 8 && pulseSweepTarget(pulse, channel) <= 0x7FF;
+}
+
+// Audio: the APU's level changes are turned into band-limited steps, windowed sinc impulses
+// integrated over time, so nothing above AUDIO_CUTOFF aliases into the output.
+
+void initBandLimitedStep()
+{
+    const double pi = 3.14159265358979323846;
+    for (int phase = 0; phase < AUDIO_KERNEL_PHASES; phase++)
+    {
+        double sum = 0;
+        double taps[AUDIO_KERNEL_WIDTH];
+        for (int i = 0; i < AUDIO_KERNEL_WIDTH; i++)
+        {
+            double x = i - (AUDIO_KERNEL_WIDTH / 2 - 1) - (double) phase / AUDIO_KERNEL_PHASES; // samples from the change
+            double n = (x + AUDIO_KERNEL_WIDTH / 2) / AUDIO_KERNEL_WIDTH; // position in the Blackman window
+            double window = 0.42 - 0.5 * cos(2 * pi * n) + 0.08 * cos(4 * pi * n);
+            taps[i] = (x == 0 ? 1 : sin(2 * pi * AUDIO_CUTOFF * x) / (2 * pi * AUDIO_CUTOFF * x)) * window;
+            sum += taps[i];
+        }
+        for (int i = 0; i < AUDIO_KERNEL_WIDTH; i++)
+            bandLimitedStep[phase][i] = taps[i] / sum; // each adds up to a step of one
+    }
+}
+
+void addAudioDelta(emulator_t* emu, unsigned long long clock, float delta)
+{
+    audio_t* audio = &emu->audio;
+    double position = (clock - audio->startClock) * AUDIO_SAMPLES_PER_CYCLE;
+    if (position < 0)
+        position = 0;
+    int sample = (int) position;
+    if (sample >= AUDIO_FRAME_SAMPLES) // not read out for a while, only happens outside of emulateFrame()
+        return;
+    const float* step = bandLimitedStep[(int) ((position - sample) * AUDIO_KERNEL_PHASES)];
+    for (int i = 0; i < AUDIO_KERNEL_WIDTH; i++)
+        audio->deltas[sample + i] += delta * step[i];
+}
+
+// Reads out the samples of the frame that just ended. A DC blocking filter centers them, the APU's
+// output is never negative.
+void apuEndFrame(emulator_t* emu)
+{
+    apuCatchUp(emu);
+    audio_t* audio = &emu->audio;
+    int count = (int) ((emu->machine.apu.clock - audio->startClock) * AUDIO_SAMPLES_PER_CYCLE);
+    if (count > AUDIO_FRAME_SAMPLES)
+    {
+        count = AUDIO_FRAME_SAMPLES;
+        audio->startClock = emu->machine.apu.clock - count / AUDIO_SAMPLES_PER_CYCLE;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        audio->level += audio->deltas[i];
+        audio->highPass = audio->level - audio->lastLevel + AUDIO_HIGH_PASS * audio->highPass;
+        audio->lastLevel = audio->level;
+        float sample = audio->highPass * 32767;
+        audio->samples[i] = sample > 32767 ? 32767 : sample < -32768 ? -32768 : (short) sample;
+    }
+    memmove(audio->deltas, audio->deltas + count, (AUDIO_FRAME_SAMPLES + AUDIO_KERNEL_WIDTH - count) * sizeof(float));
+    memset(audio->deltas + AUDIO_FRAME_SAMPLES + AUDIO_KERNEL_WIDTH - count, 0, count * sizeof(float));
+    audio->startClock += count / AUDIO_SAMPLES_PER_CYCLE;
+    audio->sampleCount = count;
+}
+
+// Starts the audio over at the APU's clock and level, after the machine was replaced
+void resetAudio(emulator_t* emu)
+{
+    audio_t* audio = &emu->audio;
+    memset(audio->deltas, 0, sizeof(audio->deltas));
+    audio->startClock = emu->machine.apu.clock;
+    audio->level = emu->machine.apu.output;
+    audio->lastLevel = audio->level;
+    audio->sampleCount = 0;
+}
+
+// Mappers: bank switches only repoint CPU bus pages and PPU pattern table slots into the ROM
+// image, nothing is ever copied.
+
+// Points the bus pages starting at firstPage at a PRG bank of the given size, negative banks count
+// from the end. Images smaller than the bank are mirrored.
+void mapPrgBank(emulator_t* emu, int firstPage, unsigned int size, int bank)
+{
+    unsigned int bankSize = size < emu->cartridge.prgSize ? size : emu->cartridge.prgSize; // both powers of two when smaller
+    int banks = emu->cartridge.prgSize / bankSize;
+    bank = bank < 0 ? ((bank % banks) + banks) % banks : bank % banks;
+    unsigned char* mem = (unsigned char*) emu->cartridge.prg + (bank * bankSize);
+    for (unsigned int page = 0; page < (size >> 8); page++)
+        emu->readPages[firstPage + page] = mem + ((page << 8) & (bankSize - 1));
+}
+
+// Points the pattern table slots starting at firstPage at a CHR bank of the given size, negative
+// banks count from the end
+void mapChrBank(emulator_t* emu, int firstPage, unsigned int size, int bank)
+{
+    int banks = emu->chrMemSize / size;
+    bank = bank < 0 ? ((bank % banks) + banks) % banks : bank % banks;
+    for (unsigned int page = 0; page < size / CHR_PAGE_SIZE; page++)
+    {
+        unsigned int offset = (bank * size) + (page * CHR_PAGE_SIZE);
+        emu->chrPages[firstPage + page] = emu->chrMem + offset;
+        emu->chrPageTiles[firstPage + page] = offset >> 4;
+        if (emu->pipeline != NULL)
+            logPpu(emu, PPU_LOG_CHR_PAGE, firstPage + page, 0, offset);
+    }
+}
+
+// Points the four nametable slots at the 2kb of nametable RAM (or all 4kb for four-screen carts)
+void setMirroring(emulator_t* emu, int mirroring)
+{
+    unsigned char* nametables = emu->machine.ppuMem + 0x2000;
+    emu->machine.mirroring = mirroring;
+    for (int i = 0; i < 4; i++)
+    {
+        switch (mirroring)
+        {
+            case MIRRORING_HORIZONTAL:
+                emu->nametablePages[i] = nametables + ((i >> 1) * 0x400);
+                break;
+            case MIRRORING_VERTICAL:
+                emu->nametablePages[i] = nametables + ((i & 1) * 0x400);
+                break;
+            case MIRRORING_SINGLE_LOWER:
+                emu->nametablePages[i] = nametables;
+                break;
+            case MIRRORING_SINGLE_UPPER:
+                emu->nametablePages[i] = nametables + 0x400;
+                break;
+            default:
+                emu->nametablePages[i] = nametables + (i * 0x400);
+        }
+        if (emu->pipeline != NULL)
+            logPpu(emu, PPU_LOG_NAMETABLE_PAGE, i, 0, emu->nametablePages[i] - emu->machine.ppuMem);
+    }
+}
+
+// $8000-$FFFF writes, brings the PPU up to date first since CHR and mirroring may change under it
+void mapperRegisterWrite(emulator_t* emu, unsigned short mem, unsigned char value)
+{
+    ppuCatchUp(emu);
+    emu->mapper->write(emu, mem, value);
+}
+
+// Mapper 0: 16kb or 32kb PRG, 8kb CHR, no registers
+void nromSync(emulator_t* emu)
+{
+    mapPrgBank(emu, 0x80, 0x8000, 0);
+    mapChrBank(emu, 0, 0x2000, 0);
+}
+
+// Mapper 1: registers are written one bit at a time through a 5-bit shift register
+void mmc1Reset(emulator_t* emu)
+{
+    emu->machine.mapper.control = 0x0C; // 16kb PRG mode with the last bank fixed at $C000
+}
+
+void mmc1Write(emulator_t* emu, unsigned short mem, unsigned char value)
+{
+    if (isBitSet(value, 7)) // reset the shift register
+    {
+        emu->machine.mapper.shift = emu->machine.mapper.shiftCount = 0;
+        emu->machine.mapper.control |= 0x0C;
+        mmc1UpdateBanks(emu);
+        return;
+    }
+    emu->machine.mapper.shift |= (value & 1) << emu->machine.mapper.shiftCount;
+    if (++emu->machine.mapper.shiftCount < 5)
+        return;
+    // the fifth write picks the register from bits 13-14 of its address
+    int reg = (mem >> 13) & 0b11;
+    if (reg == 0)
+        emu->machine.mapper.control = emu->machine.mapper.shift;
+    else
+        emu->machine.mapper.banks[reg - 1] = emu->machine.mapper.shift;
+    emu->machine.mapper.shift = emu->machine.mapper.shiftCount = 0;
+    mmc1UpdateBanks(emu);
+}
+
+void mmc1UpdateBanks(emulator_t* emu)
+{
+    static const unsigned char mirroring[4] = { MIRRORING_SINGLE_LOWER, MIRRORING_SINGLE_UPPER, MIRRORING_VERTICAL, MIRRORING_HORIZONTAL };
+    if (emu->cartridge.mirroring != MIRRORING_FOUR_SCREEN)
+        setMirroring(emu, mirroring[emu->machine.mapper.control & 0b11]);
+    unsigned char prgBank = emu->machine.mapper.banks[2] & 0x0F;
+    switch ((emu->machine.mapper.control >> 2) & 0b11)
+    {
+        case 0:
+        case 1: // 32kb, the low bit of the bank number is ignored
+            mapPrgBank(emu, 0x80, 0x8000, prgBank >> 1);
+            break;
+        case 2: // first bank fixed at $8000
+            mapPrgBank(emu, 0x80, 0x4000, 0);
+            mapPrgBank(emu, 0xC0, 0x4000, prgBank);
+            break;
+        case 3: // last bank fixed at $C000
+            mapPrgBank(emu, 0x80, 0x4000, prgBank);
+            mapPrgBank(emu, 0xC0, 0x4000, -1);
+            break;
+    }
+    if (isBitSet(emu->machine.mapper.control, 4)) // two 4kb CHR banks
+    {
+        mapChrBank(emu, 0, 0x1000, emu->machine.mapper.banks[0]);
+        mapChrBank(emu, 4, 0x1000, emu->machine.mapper.banks[1]);
+    }
+    else
+        mapChrBank(emu, 0, 0x2000, emu->machine.mapper.banks[0] >> 1);
+}
+
+// Mapper 2: switchable 16kb PRG at $8000, last bank fixed at $C000, CHR RAM
+void uxromSync(emulator_t* emu)
+{
+    mapPrgBank(emu, 0x80, 0x4000, emu->machine.mapper.banks[0]);
+    mapPrgBank(emu, 0xC0, 0x4000, -1);
+    mapChrBank(emu, 0, 0x2000, 0);
+}
+
+void uxromWrite(emulator_t* emu, unsigned short mem, unsigned char value)
+{
+    emu->machine.mapper.banks[0] = value;
+    mapPrgBank(emu, 0x80, 0x4000, value);
+}
+
+// Mapper 3: fixed PRG, switchable 8kb CHR
+void cnromSync(emulator_t* emu)
+{
+    mapPrgBank(emu, 0x80, 0x8000, 0);
+    mapChrBank(emu, 0, 0x2000, emu->machine.mapper.banks[0]);
+}
+
+void cnromWrite(emulator_t* emu, unsigned short mem, unsigned char value)
+{
+    emu->machine.mapper.banks[0] = value;
+    mapChrBank(emu, 0, 0x2000, value);
+}
+
+// Mapper 4: 8kb PRG and 1kb/2kb CHR banks selected through R0-R7, plus a scanline counter IRQ
+void mmc3Reset(emulator_t* emu)
+{
+    emu->machine.mapper.banks[7] = 1;
+}
+
+void mmc3Write(emulator_t* emu, unsigned short mem, unsigned char value)
+{
+    switch (mem & 0xE001)
+    {
+        case 0x8000: // bank select, only a change of bank layout remaps anything
+        {
+            unsigned char layoutChanged = (emu->machine.mapper.control ^ value) & 0xC0;
+            emu->machine.mapper.control = value;
+            if (layoutChanged)
+                mmc3UpdateBanks(emu);
+            break;
+        }
+        case 0x8001: // bank data
+            emu->machine.mapper.banks[emu->machine.mapper.control & 0b111] = value;
+            mmc3MapBank(emu, emu->machine.mapper.control & 0b111);
+            break;
+        case 0xA000:
+            if (emu->cartridge.mirroring != MIRRORING_FOUR_SCREEN)
+                setMirroring(emu, (value & 1) ? MIRRORING_HORIZONTAL : MIRRORING_VERTICAL);
+            break;
+        case 0xA001: // PRG RAM protect, not emulated
+            break;
+        case 0xC000:
+            emu->machine.mapper.irqLatch = value;
+            break;
+        case 0xC001:
+            emu->machine.mapper.irqCounter = 0;
+            emu->machine.mapper.irqReload = 1;
+            break;
+        case 0xE000: // disabling also acknowledges a pending IRQ
+            emu->machine.mapper.irqEnabled = 0;
+            emu->machine.irqLines &= ~IRQ_SOURCE_MAPPER;
+            break;
+        case 0xE001:
+            emu->machine.mapper.irqEnabled = 1;
+            break;
+    }
+}
+
+void mmc3UpdateBanks(emulator_t* emu)
+{
+    for (int reg = 0; reg < 8; reg++)
+        mmc3MapBank(emu, reg);
+    // the second to last bank sits at $8000 or $C000, whichever R6 does not
+    mapPrgBank(emu, isBitSet(emu->machine.mapper.control, 6) ? 0x80 : 0xC0, 0x2000, -2);
+    mapPrgBank(emu, 0xE0, 0x2000, -1);
+}
+
+// Maps the bank selected by one of R0-R7 into its slot under the current layout
+void mmc3MapBank(emulator_t* emu, int reg)
+{
+    int chrInversion = isBitSet(emu->machine.mapper.control, 7) ? 4 : 0; // swaps the 2kb and 1kb halves
+    if (reg < 2)
+        mapChrBank(emu, (reg * 2) ^ chrInversion, 0x800, emu->machine.mapper.banks[reg] >> 1);
+    else if (reg < 6)
+        mapChrBank(emu, (reg + 2) ^ chrInversion, 0x400, emu->machine.mapper.banks[reg]);
+    else if (reg == 6)
+        mapPrgBank(emu, isBitSet(emu->machine.mapper.control, 6) ? 0xC0 : 0x80, 0x2000, emu->machine.mapper.banks[6]);
+    else
+        mapPrgBank(emu, 0xA0, 0x2000, emu->machine.mapper.banks[7]);
+}
+
+void mmc3Scanline(emulator_t* emu)
+{
+    if (emu->machine.mapper.irqCounter == 0 || emu->machine.mapper.irqReload)
+    {
+        emu->machine.mapper.irqCounter = emu->machine.mapper.irqLatch;
+        emu->machine.mapper.irqReload = 0;
+    }
+    else
+        emu->machine.mapper.irqCounter--;
+    if (emu->machine.mapper.irqCounter == 0 && emu->machine.mapper.irqEnabled)
+        emu->machine.irqLines |= IRQ_SOURCE_MAPPER;
+}
+
+// Save states: the machine state is a single struct, so a snapshot is a header and one copy (plus
+// CHR RAM for carts that have it). The framebuffer is output, not state, and is not saved.
+
+size_t saveStateSize(emulator_t* emu)
+{
+    return sizeof(save_state_header_t) + sizeof(machine_t) + (emu->chrWritable ? emu->chrMemSize : 0);
+}
+
+// Writes a snapshot of the machine into buffer, returns its size or -1 if the buffer is too small
+long saveState(emulator_t* emu, unsigned char* buffer, size_t size)
+{
+    size_t stateSize = saveStateSize(emu);
+    if (size < stateSize)
+        return -1;
+    if (emu->pipeline != NULL) // the PPU state is the shadow's
+        flushPipeline(emu);
+    save_state_header_t header;
+    memset(&header, 0, sizeof(save_state_header_t));
+    memcpy(header.constant, save_state_constant, 4);
+    header.version = SAVE_STATE_VERSION;
+    header.machineSize = sizeof(machine_t);
+    header.chrRamSize = emu->chrWritable ? emu->chrMemSize : 0;
+    header.prgSize = emu->cartridge.prgSize;
+    header.mapper = emu->mapper->number;
+    memcpy(buffer, &header, sizeof(save_state_header_t));
+    memcpy(buffer + sizeof(save_state_header_t), &emu->machine, sizeof(machine_t));
+    if (emu->chrWritable)
+        memcpy(buffer + sizeof(save_state_header_t) + sizeof(machine_t), emu->chrRam, emu->chrMemSize);
+    return stateSize;
+}
+
+// Restores a snapshot taken with the same build and ROM, then rebuilds everything derived from it
+int loadState(emulator_t* emu, const unsigned char* buffer, size_t size)
+{
+    save_state_header_t header;
+    if (size < sizeof(save_state_header_t))
+    {
+        feErr("Save state is truncated");
+        return -1;
+    }
+    memcpy(&header, buffer, sizeof(save_state_header_t));
+    if (memcmp(header.constant, save_state_constant, 4) != 0 || header.version != SAVE_STATE_VERSION)
+    {
+        feErr("Not a save state of this version");
+        return -1;
+    }
+    if (header.machineSize != sizeof(machine_t) || header.mapper != emu->mapper->number || header.prgSize != emu->cartridge.prgSize || header.chrRamSize != (emu->chrWritable ? emu->chrMemSize : 0))
+    {
+        feErr("Save state belongs to a different build or ROM");
+        return -1;
+    }
+    if (size < saveStateSize(emu))
+    {
+        feErr("Save state is truncated");
+        return -1;
+    }
+    memcpy(&emu->machine, buffer + sizeof(save_state_header_t), sizeof(machine_t));
+    if (emu->chrWritable)
+    {
+        memcpy(emu->chrRam, buffer + sizeof(save_state_header_t) + sizeof(machine_t), emu->chrMemSize);
+        memset(emu->tileCache.valid, 0, emu->chrMemSize / 16);
+    }
+    emu->mapper->sync(emu);
+    setMirroring(emu, emu->machine.mirroring);
+    resolvePalette(emu);
+    resetAudio(emu);
+    if (emu->pipeline != NULL)
+        seedPipeline(emu);
+    return 0;
+}
+
+int saveStateFile(emulator_t* emu, const char* path)
+{
+    size_t size = saveStateSize(emu);
+    unsigned char* buffer = malloc(size);
+    saveState(emu, buffer, size);
+    FILE* file = fopen(path, "wb");
+    int result = file != NULL && fwrite(buffer, 1, size, file) == size ? 0 : -1;
+    if (file != NULL)
+        fclose(file);
+    free(buffer);
+    if (result == -1)
+        feErr("Could not write save state");
+    return result;
+}
+
+int loadStateFile(emulator_t* emu, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        feErr("Could not open save state");
+        return -1;
+    }
+    size_t size = saveStateSize(emu);
+    unsigned char* buffer = malloc(size);
+    size_t read = fread(buffer, 1, size, file);
+    fclose(file);
+    int result = loadState(emu, buffer, read);
+    free(buffer);
+    return result;
+}
+
+// Rewind: every frame is captured as a save state. Every keyframe interval frames the whole
+// state is kept as a keyframe, the frames in between only as XOR deltas against it, run length
+// encoded since little changes from frame to frame.
+
+int initRewind(emulator_t* emu, unsigned long frames, size_t memory)
+{
+    memset(&emu->rewindBuffer, 0, sizeof(rewind_buffer_t));
+    if (frames == 0)
+    {
+        feErr("Rewind needs room for at least one frame");
+        return -1;
+    }
+    emu->rewindBuffer.stateSize = saveStateSize(emu);
+    if (memory < 4 * emu->rewindBuffer.stateSize) // room for the keyframes of two groups and their deltas
+    {
+        feErr("Rewind memory is too small for this ROM");
+        return -1;
+    }
+    emu->rewindBuffer.arena = malloc(memory);
+    emu->rewindBuffer.arenaSize = memory;
+    emu->rewindBuffer.capacity = frames;
+    emu->rewindBuffer.keyframeInterval = frames / 2 < REWIND_KEYFRAME_INTERVAL ? (frames / 2) + 1 : REWIND_KEYFRAME_INTERVAL;
+    emu->rewindBuffer.frames = malloc(frames * sizeof(rewind_frame_t));
+    emu->rewindBuffer.state = malloc(emu->rewindBuffer.stateSize);
+    emu->rewindBuffer.delta = malloc((emu->rewindBuffer.stateSize * 3) + 16);
+    if (emu->rewindBuffer.arena == NULL || emu->rewindBuffer.frames == NULL || emu->rewindBuffer.state == NULL || emu->rewindBuffer.delta == NULL)
+    {
+        freeRewind(emu);
+        feErr("Could not allocate the rewind buffer");
+        return -1;
+    }
+    return 0;
+}
+
+void freeRewind(emulator_t* emu)
+{
+    free(emu->rewindBuffer.arena);
+    free(emu->rewindBuffer.frames);
+    free(emu->rewindBuffer.state);
+    free(emu->rewindBuffer.delta);
+    memset(&emu->rewindBuffer, 0, sizeof(rewind_buffer_t));
+}
+
+// Stores the current state as the newest frame, evicting the oldest groups as needed
+void captureRewindFrame(emulator_t* emu)
+{
+    rewind_buffer_t* rb = &emu->rewindBuffer;
+    saveState(emu, rb->state, rb->stateSize);
+    unsigned long long sequence = rb->next;
+    rewind_frame_t* newest = rb->next > rb->oldest ? &rb->frames[(rb->next - 1) % rb->capacity] : NULL;
+    int keyframe = newest == NULL || sequence - newest->keyframe >= rb->keyframeInterval;
+    const unsigned char* data = rb->state;
+    size_t size = rb->stateSize;
+    if (!keyframe)
+    {
+        size = encodeDelta(rb->arena + rb->frames[newest->keyframe % rb->capacity].offset, rb->state, rb->stateSize, rb->delta);
+        data = rb->delta;
+    }
+    if (rb->next - rb->oldest == rb->capacity)
+        evictRewindKeyframe(emu);
+    if (rb->head + size > rb->arenaSize) // wrap, the frames left at the end are the oldest
+    {
+        while (rb->next > rb->oldest && rb->frames[rb->oldest % rb->capacity].offset >= rb->head)
+            evictRewindKeyframe(emu);
+        rb->head = 0;
+    }
+    while (rb->next > rb->oldest)
+    {
+        rewind_frame_t* oldest = &rb->frames[rb->oldest % rb->capacity];
+        if (oldest->offset >= rb->head + size || oldest->offset + oldest->size <= rb->head)
+            break;
+        evictRewindKeyframe(emu);
+    }
+    if (!keyframe && rb->oldest > newest->keyframe) // the arena is so full that our own keyframe went
+    {
+        rb->oldest = rb->next;
+        rb->head = 0;
+        memcpy(rb->arena, rb->state, rb->stateSize);
+        rb->frames[sequence % rb->capacity] = (rewind_frame_t) { 0, rb->stateSize, sequence };
+        rb->next++;
+        return;
+    }
+    memcpy(rb->arena + rb->head, data, size);
+    rb->frames[sequence % rb->capacity] = (rewind_frame_t) { rb->head, size, keyframe ? sequence : newest->keyframe };
+    rb->head += size;
+    rb->next++;
+}
+
+// Drops the oldest keyframe and every delta against it
+void evictRewindKeyframe(emulator_t* emu)
+{
+    rewind_buffer_t* rb = &emu->rewindBuffer;
+    unsigned long long keyframe = rb->frames[rb->oldest % rb->capacity].keyframe;
+    while (rb->next > rb->oldest && rb->frames[rb->oldest % rb->capacity].keyframe == keyframe)
+        rb->oldest++;
+}
+
+// Drops the newest frames and loads the one before them, which takes at most one delta apply
+int rewindFrames(emulator_t* emu, unsigned long frames)
+{
+    rewind_buffer_t* rb = &emu->rewindBuffer;
+    if (rb->arena == NULL || rb->next - rb->oldest <= frames)
+        return -1;
+    rb->next -= frames;
+    rb->head = rb->frames[rb->next % rb->capacity].offset; // the dropped frames were the last written
+    rewind_frame_t* frame = &rb->frames[(rb->next - 1) % rb->capacity];
+    const unsigned char* keyframe = rb->arena + rb->frames[frame->keyframe % rb->capacity].offset;
+    if (frame->keyframe == rb->next - 1)
+        return loadState(emu, keyframe, rb->stateSize);
+    memcpy(rb->state, keyframe, rb->stateSize);
+    applyDelta(rb->state, rb->arena + frame->offset, frame->size);
+    return loadState(emu, rb->state, rb->stateSize);
+}
+
+static inline unsigned long long load64(const unsigned char* p)
+{
+    unsigned long long value;
+    memcpy(&value, p, 8);
+    return value;
+}
+
+static inline unsigned int load32(const unsigned char* p)
+{
+    unsigned int value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+static inline unsigned int rotl32(unsigned int x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+// xxHash32, four independent lanes keep it fast enough to hash every frame of a run
+unsigned int xxh32(const void* data, size_t size, unsigned int seed)
+{
+    static const unsigned int prime1 = 0x9E3779B1u, prime2 = 0x85EBCA77u, prime3 = 0xC2B2AE3Du, prime4 = 0x27D4EB2Fu, prime5 = 0x165667B1u;
+    const unsigned char* p = data;
+    const unsigned char* end = p + size;
+    unsigned int hash;
+    if (size >= 16)
+    {
+        unsigned int v1 = seed + prime1 + prime2, v2 = seed + prime2, v3 = seed, v4 = seed - prime1;
+        for (; p + 16 <= end; p += 16)
+        {
+            v1 = rotl32(v1 + load32(p) * prime2, 13) * prime1;
+            v2 = rotl32(v2 + load32(p + 4) * prime2, 13) * prime1;
+            v3 = rotl32(v3 + load32(p + 8) * prime2, 13) * prime1;
+            v4 = rotl32(v4 + load32(p + 12) * prime2, 13) * prime1;
+        }
+        hash = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18);
+    }
+    else
+        hash = seed + prime5;
+    hash += (unsigned int) size;
+    for (; p + 4 <= end; p += 4)
+        hash = rotl32(hash + load32(p) * prime3, 17) * prime4;
+    for (; p < end; p++)
+        hash = rotl32(hash + *p * prime5, 11) * prime1;
+    hash ^= hash >> 15;
+    hash *= prime2;
+    hash ^= hash >> 13;
+    hash *= prime3;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+// Encodes current as runs of (16-bit unchanged byte count, 16-bit changed byte count) headers, each
+// followed by the changed bytes XOR base. Trailing unchanged bytes are left out.
+size_t encodeDelta(const unsigned char* base, const unsigned char* current, size_t size, unsigned char* out)
+{
+    size_t length = 0;
+    size_t i = 0;
+    while (i < size)
+    {
+        size_t unchangedStart = i;
+        while (i + 8 <= size && load64(base + i) == load64(current + i))
+            i += 8;
+        while (i < size && base[i] == current[i])
+            i++;
+        if (i == size)
+            break;
+        size_t unchanged = i - unchangedStart;
+        // a change ends at 4 unchanged bytes in a row, shorter gaps cost less than a new header
+        size_t changedStart = i;
+        for (size_t same = 0; i < size && same < 4; i++)
+            same = base[i] == current[i] ? same + 1 : 0;
+        while (i > changedStart && base[i - 1] == current[i - 1])
+            i--;
+        size_t changed = i - changedStart;
+        for (; unchanged > 0xFFFF; unchanged -= 0xFFFF)
+        {
+            out[length++] = 0xFF;
+            out[length++] = 0xFF;
+            out[length++] = 0;
+            out[length++] = 0;
+        }
+        for (size_t done = 0; done < changed;)
+        {
+            size_t count = changed - done > 0xFFFF ? 0xFFFF : changed - done;
+            out[length++] = loByte(unchanged);
+            out[length++] = hiByte(unchanged);
+            out[length++] = loByte(count);
+            out[length++] = hiByte(count);
+            for (size_t k = 0; k < count; k++)
+                out[length++] = base[changedStart + done + k] ^ current[changedStart + done + k];
+            done += count;
+            unchanged = 0;
+        }
+    }
+    return length;
+}
+
+void applyDelta(unsigned char* target, const unsigned char* delta, size_t size)
+{
+    size_t position = 0;
+    for (size_t i = 0; i < size;)
+    {
+        position += combineBytes(delta[i], delta[i + 1]);
+        size_t count = combineBytes(delta[i + 2], delta[i + 3]);
+        i += 4;
+        for (size_t k = 0; k < count; k++)
+            target[position + k] ^= delta[i + k];
+        position += count;
+        i += count;
+    }
+}
+
+// Input movies: the controller is fed from (or logged to) the movie at the start of every frame,
+// so a replay sees exactly the input of the run that was recorded and is bit-exact. The movie is
+// indexed by frame number, so loading a state or rewinding while recording rewrites from there on.
+
+void updateMovie(emulator_t* emu)
+{
+    movie_t* movie = &emu->movie;
+    unsigned long frame = emu->machine.frameCount;
+    if (movie->mode == MOVIE_PLAY)
+    {
+        emu->machine.buttons = frame < movie->length ? movie->frames[frame] : 0;
+        return;
+    }
+    if (frame >= movie->capacity)
+    {
+        movie->capacity = (frame + 1) * 2;
+        movie->frames = realloc(movie->frames, movie->capacity * sizeof(unsigned short));
+    }
+    if (frame > movie->length) // a state from past the end was loaded, nothing was pressed in between
+        memset(movie->frames + movie->length, 0, (frame - movie->length) * sizeof(unsigned short));
+    movie->frames[frame] = emu->machine.buttons;
+    movie->length = frame + 1;
+}
+
+// Loads a movie for the ROM in the emulator and starts playing it
+int loadMovieFile(emulator_t* emu, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        feErr("Could not open input movie");
+        return -1;
+    }
+    movie_header_t header;
+    if (fread(&header, sizeof(movie_header_t), 1, file) != 1 || memcmp(header.constant, movie_constant, 4) != 0 || header.version != MOVIE_VERSION)
+    {
+        fclose(file);
+        feErr("Not an input movie of this version");
+        return -1;
+    }
+    if (header.prgHash != fnv1a(emu->cartridge.prg, emu->cartridge.prgSize))
+    {
+        fclose(file);
+        feErr("Input movie belongs to a different ROM");
+        return -1;
+    }
+    freeMovie(emu);
+    movie_t* movie = &emu->movie;
+    movie->capacity = header.frames;
+    movie->frames = malloc((header.frames ? header.frames : 1) * sizeof(unsigned short));
+    unsigned char run[4];
+    while (movie->length < header.frames && fread(run, 4, 1, file) == 1)
+    {
+        unsigned long count = combineBytes(run[0], run[1]);
+        if (count > header.frames - movie->length)
+            break;
+        for (unsigned long i = 0; i < count; i++)
+            movie->frames[movie->length++] = combineBytes(run[2], run[3]);
+    }
+    fclose(file);
+    if (movie->length != header.frames)
+    {
+        freeMovie(emu);
+        feErr("Input movie is truncated");
+        return -1;
+    }
+    movie->mode = MOVIE_PLAY;
+    return 0;
+}
+
+int saveMovieFile(emulator_t* emu, const char* path)
+{
+    movie_t* movie = &emu->movie;
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        feErr("Could not write input movie");
+        return -1;
+    }
+    movie_header_t header;
+    memset(&header, 0, sizeof(movie_header_t));
+    memcpy(header.constant, movie_constant, 4);
+    header.version = MOVIE_VERSION;
+    header.frames = movie->length;
+    header.prgHash = fnv1a(emu->cartridge.prg, emu->cartridge.prgSize);
+    int result = fwrite(&header, sizeof(movie_header_t), 1, file) == 1 ? 0 : -1;
+    for (unsigned long i = 0; i < movie->length && result == 0;)
+    {
+        unsigned long count = 1;
+        while (i + count < movie->length && count < 0xFFFF && movie->frames[i + count] == movie->frames[i])
+            count++;
+        unsigned char run[4] = { loByte(count), hiByte(count), loByte(movie->frames[i]), hiByte(movie->frames[i]) };
+        if (fwrite(run, 4, 1, file) != 1)
+            result = -1;
+        i += count;
+    }
+    if (fclose(file) != 0)
+        result = -1;
+    if (result == -1)
+        feErr("Could not write input movie");
+    return result;
+}
+
+void freeMovie(emulator_t* emu)
+{
+    free(emu->movie.frames);
+    memset(&emu->movie, 0, sizeof(movie_t));
+}
+
+// Reads a little endian 16-bit address at addr
+unsigned short readAddr(emulator_t* emu, unsigned short addr)
+{
+    return (((unsigned short) cpuRead(emu, addr + 1)) << 8) | ((unsigned short) cpuRead(emu, addr));
+}
+
+// Reads a little endian 16-bit address from the zero page, wrapping within it
+static inline unsigned short readZeroPageAddr(emulator_t* emu, unsigned char addr)
+{
+    return (((unsigned short) emu->machine.cpuMem[(unsigned char) (addr + 1)]) << 8) | ((unsigned short) emu->machine.cpuMem[addr]);
+}
+
+static inline void updateFlagConditionally(emulator_t* emu, int condition, int bit)
+{
+    emu->machine.flags = (emu->machine.flags & ~(1 << bit)) | ((condition != 0) << bit);
+}
+
+// N and Z are evaluated lazily: instructions only record the result they were derived from
+
+static inline void updateSignFlags(emulator_t* emu, unsigned char c)
+{
+    emu->machine.lazyZeroResult = emu->machine.lazyNegativeResult = c;
+}
+
+static inline int isNegativeFlagSet(emulator_t* emu)
+{
+    return (emu->machine.lazyNegativeResult & 0x80) != 0;
+}
+
+static inline int isZeroFlagSet(emulator_t* emu)
+{
+    return emu->machine.lazyZeroResult == 0;
+}
+
+// Effective address calculation for each addressing mode (pc is on the opcode)
+
+static inline unsigned short eaImm(emulator_t* emu)
+{
+    return emu->machine.pc + 1;
+}
+
+static inline unsigned short eaZp(emulator_t* emu)
+{
+    return cpuRead(emu, emu->machine.pc + 1);
+}
+
+static inline unsigned short eaZpX(emulator_t* emu)
+{
+    return (unsigned char) (cpuRead(emu, emu->machine.pc + 1) + emu->machine.regX);
+}
+
+static inline unsigned short eaZpY(emulator_t* emu)
+{
+    return (unsigned char) (cpuRead(emu, emu->machine.pc + 1) + emu->machine.regY);
+}
+
+static inline unsigned short eaAbs(emulator_t* emu)
+{
+    return readAddr(emu, emu->machine.pc + 1);
+}
+
+static inline unsigned short eaAbsX(emulator_t* emu)
+{
+    return readAddr(emu, emu->machine.pc + 1) + emu->machine.regX;
+}
+
+static inline unsigned short eaAbsY(emulator_t* emu)
+{
+    return readAddr(emu, emu->machine.pc + 1) + emu->machine.regY;
+}
+
+static inline unsigned short eaXInd(emulator_t* emu)
+{
+    return readZeroPageAddr(emu, cpuRead(emu, emu->machine.pc + 1) + emu->machine.regX);
+}
+
+static inline unsigned short eaYInd(emulator_t* emu)
+{
+    return readZeroPageAddr(emu, cpuRead(emu, emu->machine.pc + 1)) + emu->machine.regY;
+}
+
+// Operations, independent of addressing mode
+
+static inline void m6502ora(emulator_t* emu, unsigned char v)
+{
+    emu->machine.regA |= v;
+    updateSignFlags(emu, emu->machine.regA);
+}
+
+static inline void m6502and(emulator_t* emu, unsigned char v)
+{
+    emu->machine.regA &= v;
+    updateSignFlags(emu, emu->machine.regA);
+}
+
+static inline void m6502eor(emulator_t* emu, unsigned char v)
+{
+    emu->machine.regA ^= v;
+    updateSignFlags(emu, emu->machine.regA);
+}
+
+// adc and sbc are based on https://stackoverflow.com/questions/29193303/6502-emulation-proper-way-to-implement-adc-and-sbc
+static inline void m6502adc(emulator_t* emu, unsigned char v)
+{
+    unsigned short sum = (unsigned short) emu->machine.regA + (unsigned short) v + (emu->machine.flags & (1 << CARRY_FLAG));
+    updateFlagConditionally(emu, sum > 0xFF, CARRY_FLAG);
+    updateFlagConditionally(emu, ~(emu->machine.regA ^ v) & (emu->machine.regA ^ sum) & 0x80, OVERFLOW_FLAG);
+    emu->machine.regA = sum;
+    updateSignFlags(emu, emu->machine.regA);
+}
+
+static inline void m6502sbc(emulator_t* emu, unsigned char v)
+{
+    m6502adc(emu, ~v);
+}
+
+static inline void m6502compare(emulator_t* emu, unsigned char r, unsigned char v)
+{
+    updateFlagConditionally(emu, r >= v, CARRY_FLAG);
+    updateSignFlags(emu, r - v);
+}
+
+static inline void m6502cmp(emulator_t* emu, unsigned char v)
+{
+    m6502compare(emu, emu->machine.regA, v);
+}
+
+static inline void m6502cpx(emulator_t* emu, unsigned char v)
+{
+    m6502compare(emu, emu->machine.regX, v);
+}
+
+static inline void m6502cpy(emulator_t* emu, unsigned char v)
+{
+    m6502compare(emu, emu->machine.regY, v);
+}
+
+static inline void m6502bit(emulator_t* emu, unsigned char v)
+{
+    emu->machine.flags = (emu->machine.flags & 0b10111111) | (v & 0b01000000);
+    emu->machine.lazyNegativeResult = v;
+    emu->machine.lazyZeroResult = v & emu->machine.regA;
+}
+
+static inline unsigned char m6502asl(emulator_t* emu, unsigned char v)
+{
+    updateFlagConditionally(emu, v & 0x80, CARRY_FLAG);
+    v <<= 1;
+    updateSignFlags(emu, v);
+    return v;
+}
+
+static inline unsigned char m6502lsr(emulator_t* emu, unsigned char v)
+{
+    updateFlagConditionally(emu, v & 0x01, CARRY_FLAG);
+    v >>= 1;
+    updateSignFlags(emu, v);
+    return v;
+}
+
+static inline unsigned char m6502rol(emulator_t* emu, unsigned char v)
+{
+    unsigned char c = emu->machine.flags & (1 << CARRY_FLAG);
+    updateFlagConditionally(emu, v & 0x80, CARRY_FLAG);
+    v = (v << 1) | c;
+    updateSignFlags(emu, v);
+    return v;
+}
+
+static inline unsigned char m6502ror(emulator_t* emu, unsigned char v)
+{
+    unsigned char c = emu->machine.flags & (1 << CARRY_FLAG);
+    updateFlagConditionally(emu, v & 0x01, CARRY_FLAG);
+    v = (v >> 1) | (c << 7);
+    updateSignFlags(emu, v);
+    return v;
+}
+
+static inline unsigned char m6502inc(emulator_t* emu, unsigned char v)
+{
+    updateSignFlags(emu, ++v);
+    return v;
+}
+
+static inline unsigned char m6502dec(emulator_t* emu, unsigned char v)
+{
+    updateSignFlags(emu, --v);
+    return v;
+}
+
+#define HANDLER_READ(name, op, mode, sz) static int name(emulator_t* emu) { op(emu, cpuRead(emu, mode(emu))); emu->machine.pc += sz; return 0; }
+#define HANDLER_LOAD(name, r, mode, sz) static int name(emulator_t* emu) { r = cpuRead(emu, mode(emu)); updateSignFlags(emu, r); emu->machine.pc += sz; return 0; }
+#define HANDLER_STORE(name, r, mode, sz) static int name(emulator_t* emu) { cpuWrite(emu, mode(emu), r); emu->machine.pc += sz; return 0; }
+#define HANDLER_RMW(name, op, mode, sz) static int name(emulator_t* emu) { unsigned short ea = mode(emu); cpuWrite(emu, ea, op(emu, cpuRead(emu, ea))); emu->machine.pc += sz; return 0; }
+#define HANDLER_ACCUMULATOR(name, op, mode, sz) static int name(emulator_t* emu) { emu->machine.regA = op(emu, emu->machine.regA); emu->machine.pc += sz; return 0; }
+#define HANDLER_BRANCH(name, cond, mode, sz) static int name(emulator_t* emu) { if (cond) m6502branch(emu); else emu->machine.pc += 2; return 0; }
+#define HANDLER_IMPLIED(name, unused, mode, sz)
+#define GENERATE_HANDLER(opcode, kind, a, b, c) HANDLER_##kind(op_##opcode, a, b, c)
+
+OPCODE_LIST(GENERATE_HANDLER)
+
+// Implied and control flow instructions
+
+static int op_BRK(emulator_t* emu)
+{
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_NOP(emulator_t* emu)
+{
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_PHP(emulator_t* emu)
+{
+    m6502pushStack(emu, getFlags(emu) | (1 << BREAK_FLAG));
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_PLP(emulator_t* emu)
+{
+    setFlags(emu, m6502pullStack(emu));
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_PHA(emulator_t* emu)
+{
+    m6502pushStack(emu, emu->machine.regA);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_PLA(emulator_t* emu)
+{
+    emu->machine.regA = m6502pullStack(emu);
+    updateSignFlags(emu, emu->machine.regA);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_CLC(emulator_t* emu)
+{
+    emu->machine.flags &= ~(1 << CARRY_FLAG);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_SEC(emulator_t* emu)
+{
+    emu->machine.flags |= (1 << CARRY_FLAG);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_CLI(emulator_t* emu)
+{
+    emu->machine.flags &= ~(1 << INTERRUPT_FLAG);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_SEI(emulator_t* emu)
+{
+    emu->machine.flags |= (1 << INTERRUPT_FLAG);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_CLV(emulator_t* emu)
+{
+    emu->machine.flags &= ~(1 << OVERFLOW_FLAG);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_CLD(emulator_t* emu)
+{
+    emu->machine.flags &= ~(1 << DECIMAL_FLAG);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_SED(emulator_t* emu)
+{
+    emu->machine.flags |= (1 << DECIMAL_FLAG);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_TAX(emulator_t* emu)
+{
+    emu->machine.regX = emu->machine.regA;
+    updateSignFlags(emu, emu->machine.regX);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_TXA(emulator_t* emu)
+{
+    emu->machine.regA = emu->machine.regX;
+    updateSignFlags(emu, emu->machine.regA);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_TAY(emulator_t* emu)
+{
+    emu->machine.regY = emu->machine.regA;
+    updateSignFlags(emu, emu->machine.regY);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_TYA(emulator_t* emu)
+{
+    emu->machine.regA = emu->machine.regY;
+    updateSignFlags(emu, emu->machine.regA);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_TSX(emulator_t* emu)
+{
+    emu->machine.regX = emu->machine.regS;
+    updateSignFlags(emu, emu->machine.regX);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_TXS(emulator_t* emu)
+{
+    emu->machine.regS = emu->machine.regX;
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_INX(emulator_t* emu)
+{
+    updateSignFlags(emu, ++emu->machine.regX);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_DEX(emulator_t* emu)
+{
+    updateSignFlags(emu, --emu->machine.regX);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_INY(emulator_t* emu)
+{
+    updateSignFlags(emu, ++emu->machine.regY);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_DEY(emulator_t* emu)
+{
+    updateSignFlags(emu, --emu->machine.regY);
+    emu->machine.pc++;
+    return 0;
+}
+
+static int op_JMP_ABS(emulator_t* emu)
+{
+    m6502jmp(emu, readAddr(emu, emu->machine.pc + 1));
+    return 0;
+}
+
+static int op_JMP_IND(emulator_t* emu)
+{
+    m6502jmp(emu, readAddr(emu, readAddr(emu, emu->machine.pc + 1)));
+    return 0;
+}
+
+static int op_JSR(emulator_t* emu)
+{
+    m6502pushStack(emu, hiByte(emu->machine.pc + 2));
+    m6502pushStack(emu, loByte(emu->machine.pc + 2));
+    m6502jmp(emu, readAddr(emu, emu->machine.pc + 1));
+    return 0;
+}
+
+static int op_RTS(emulator_t* emu)
+{
+    unsigned char lo = m6502pullStack(emu);
+    unsigned char hi = m6502pullStack(emu);
+    emu->machine.pc = combineBytes(lo, hi) + 1;
+    return 0;
+}
+
+static int op_RTI(emulator_t* emu)
+{
+    setFlags(emu, m6502pullStack(emu));
+    unsigned char lo = m6502pullStack(emu);
+    unsigned char hi = m6502pullStack(emu);
+    emu->machine.pc = combineBytes(lo, hi);
+    return 0;
+}
+
+#define OPCODE_TABLE_ENTRY(opcode, kind, a, b, c) [opcode] = op_##opcode,
+
+// Undocumented opcodes are left NULL
+static int (* const opcode_table[256])(emulator_t* emu) = { OPCODE_LIST(OPCODE_TABLE_ENTRY) };
+
+// Tracing: every instruction is logged as a fixed-size binary record into a ring that a
+// background thread drains to the trace file, so tracing costs little more than the copy.
+// --dump-trace turns a trace into a nestest style log afterwards.
+
+static inline void traceInstruction(emulator_t* emu, unsigned char opcode)
+{
+    trace_t* trace = emu->trace;
+    if (trace->head - trace->cachedTail > trace->mask)
+        waitForTraceSpace(trace);
+    trace_record_t* record = &trace->records[trace->head & trace->mask];
+    unsigned char* page = emu->readPages[(unsigned short) (emu->machine.pc + 1) >> 8]; // operands are only peeked, reading registers has side effects
+    record->clock = emu->machine.masterClock;
+    record->pc = emu->machine.pc;
+    record->opcode = opcode;
+    record->operand[0] = page != NULL ? page[(emu->machine.pc + 1) & 0xFF] : 0;
+    page = emu->readPages[(unsigned short) (emu->machine.pc + 2) >> 8];
+    record->operand[1] = page != NULL ? page[(emu->machine.pc + 2) & 0xFF] : 0;
+    record->a = emu->machine.regA;
+    record->x = emu->machine.regX;
+    record->y = emu->machine.regY;
+    record->p = getFlags(emu);
+    record->s = emu->machine.regS;
+    __atomic_store_n(&trace->head, trace->head + 1, __ATOMIC_RELEASE);
+}
+
+void waitForTraceSpace(trace_t* trace)
+{
+    for (trace->stalls++; trace->head - (trace->cachedTail = __atomic_load_n(&trace->tail, __ATOMIC_ACQUIRE)) > trace->mask;)
+        sleepMilliseconds(1);
+}
+
+int executeCurrentInstruction(emulator_t* emu)
+{
+    if (emu->machine.irqLines && !isFlagSet(emu, INTERRUPT_FLAG))
+        m6502interrupt(emu, readAddr(emu, IRQ_VECTOR));
+    unsigned char opcode = cpuRead(emu, emu->machine.pc);
+    if (emu->trace != NULL)
+        traceInstruction(emu, opcode);
+    int (*handler)(emulator_t* emu) = opcode_table[opcode];
+    if (handler == NULL)
+    {
+        char message[64];
+        snprintf(message, sizeof(message), "Attempted to execute unknown instruction (opcode $%x)", opcode);
+        feErr(message);
+        emu->machine.masterClock += 2 * CPU_CLOCK_DIVIDER;
+        return -1;
+    }
+    emu->machine.masterClock += cycle_count_table[opcode] * CPU_CLOCK_DIVIDER;
+#ifdef FE_PROFILE
+    if (emu->profile != NULL)
+    {
+        emu->profile->pcCount[emu->machine.pc]++;
+        emu->profile->pcCycles[emu->machine.pc] += cycle_count_table[opcode];
+        emu->profile->opcodeCount[opcode]++;
+        emu->profile->opcodeCycles[opcode] += cycle_count_table[opcode];
+    }
+#endif
+    handler(emu);
+    if (overviewAfterInstruction)
+        printEmulatorOverview(emu);
+    emu->machine.instructionCount++;
+    return 0;
+}
+
+int startTrace(emulator_t* emu, const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        feErr("Could not open trace file");
+        return -1;
+    }
+    trace_header_t header;
+    memset(&header, 0, sizeof(trace_header_t));
+    memcpy(header.constant, trace_constant, 4);
+    header.version = TRACE_VERSION;
+    header.recordSize = sizeof(trace_record_t);
+    fwrite(&header, sizeof(trace_header_t), 1, file);
+    trace_t* trace = calloc(1, sizeof(trace_t));
+    trace->records = malloc(TRACE_RING_RECORDS * sizeof(trace_record_t));
+    trace->mask = TRACE_RING_RECORDS - 1;
+    trace->file = file;
+    if (pthread_create(&trace->thread, NULL, traceDrain, trace) != 0)
+    {
+        fclose(file);
+        free(trace->records);
+        free(trace);
+        feErr("Could not start the trace thread");
+        return -1;
+    }
+    emu->trace = trace;
+    return 0;
+}
+
+// Lets the drain thread write out what is left, then closes the trace
+void stopTrace(emulator_t* emu)
+{
+    trace_t* trace = emu->trace;
+    __atomic_store_n(&trace->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(trace->thread, NULL);
+    if (fclose(trace->file) != 0)
+        feErr("Could not write trace file");
+    free(trace->records);
+    free(trace);
+    emu->trace = NULL;
+}
+
+void* traceDrain(void* data)
+{
+    trace_t* trace = data;
+    for (;;)
+    {
+        // stop is set after the last record, so a head read after it is final
+        unsigned char stopping = __atomic_load_n(&trace->stop, __ATOMIC_ACQUIRE);
+        unsigned long head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+        if (head == trace->tail)
+        {
+            if (stopping)
+                return NULL;
+            sleepMilliseconds(1);
+            continue;
+        }
+        // everything up to head, or up to the end of the ring if it wraps before then
+        unsigned long start = trace->tail & trace->mask;
+        unsigned long count = head - trace->tail;
+        if (start + count > trace->mask + 1)
+            count = trace->mask + 1 - start;
+        fwrite(&trace->records[start], sizeof(trace_record_t), count, trace->file);
+        __atomic_store_n(&trace->tail, trace->tail + count, __ATOMIC_RELEASE);
+    }
+}
+
+// PPU pipeline: with --pipeline the PPU renders on a thread of its own, a frame behind the CPU. The
+// CPU thread logs everything rendering depends on with the master clock time it happened at, the
+// render thread catches a shadow emulator up to each entry and applies it, so the shadow renders
+// exactly what the PPU would have. Reads that depend on rendering wait for the shadow to catch up.
+
+int startPipeline(emulator_t* emu)
+{
+    ppu_pipeline_t* pipeline = calloc(1, sizeof(ppu_pipeline_t));
+    emulator_t* shadow = createEmulator();
+    if (pipeline == NULL || shadow == NULL)
+    {
+        free(pipeline);
+        free(shadow);
+        feErr("Could not allocate the PPU pipeline");
+        return -1;
+    }
+    // CHR ROM is shared, CHR RAM is written by both sides and needs a copy of its own
+    shadow->chrMemSize = emu->chrMemSize;
+    shadow->chrWritable = emu->chrWritable;
+    shadow->chrMem = emu->chrWritable ? (shadow->chrRam = malloc(emu->chrMemSize)) : emu->chrMem;
+    shadow->tileCache.pixels = malloc((emu->chrMemSize / 16) * sizeof(*shadow->tileCache.pixels));
+    shadow->tileCache.valid = calloc(emu->chrMemSize / 16, 1);
+    pipeline->entries = malloc(PPU_LOG_ENTRIES * sizeof(ppu_log_entry_t));
+    pipeline->mask = PPU_LOG_ENTRIES - 1;
+    pipeline->shadow = shadow;
+    emu->pipeline = pipeline;
+    seedPipeline(emu);
+    if (pthread_create(&pipeline->thread, NULL, ppuPipelineThread, pipeline) != 0)
+    {
+        emu->pipeline = NULL;
+        destroyEmulator(shadow);
+        free(pipeline->entries);
+        free(pipeline);
+        feErr("Could not start the render thread");
+        return -1;
+    }
+    pipeline->started = 1;
+    return 0;
+}
+
+// Brings the emulator's PPU state up to date and lets the render thread go
+void stopPipeline(emulator_t* emu)
+{
+    ppu_pipeline_t* pipeline = emu->pipeline;
+    flushPipeline(emu);
+    logPpu(emu, PPU_LOG_STOP, 0, 0, 0);
+    pthread_join(pipeline->thread, NULL);
+    emu->pipeline = NULL;
+    destroyEmulator(pipeline->shadow);
+    free(pipeline->entries);
+    free(pipeline);
+}
+
+// Starts the shadow over from the emulator's state, after the pipeline starts or a state is loaded
+void seedPipeline(emulator_t* emu)
+{
+    ppu_pipeline_t* pipeline = emu->pipeline;
+    emulator_t* shadow = pipeline->shadow;
+    if (pipeline->started)
+        syncPipeline(emu);
+    memcpy(&shadow->machine, &emu->machine, sizeof(machine_t));
+    if (emu->chrWritable)
+        memcpy(shadow->chrRam, emu->chrRam, emu->chrMemSize);
+    memset(shadow->tileCache.valid, 0, emu->chrMemSize / 16);
+    for (int i = 0; i < 8; i++)
+    {
+        shadow->chrPages[i] = shadow->chrMem + (emu->chrPages[i] - emu->chrMem);
+        shadow->chrPageTiles[i] = emu->chrPageTiles[i];
+    }
+    for (int i = 0; i < 4; i++)
+        shadow->nametablePages[i] = shadow->machine.ppuMem + (emu->nametablePages[i] - emu->machine.ppuMem);
+    resolvePalette(shadow);
+    memcpy(shadow->framebuffer, emu->framebuffer, sizeof(emu->framebuffer));
+    memcpy(pipeline->frames[0], emu->framebuffer, sizeof(emu->framebuffer));
+    memcpy(pipeline->frames[1], emu->framebuffer, sizeof(emu->framebuffer));
+    pipeline->rendered = emu->machine.frameCount;
+    pipeline->hitPossible = 1;
+    pipeline->hitCheckedAt = 0;
+}
+
+// Waits for the render thread to catch up, then hands the PPU state and the frame being drawn back
+// to the emulator, for anything that looks at them directly
+void flushPipeline(emulator_t* emu)
+{
+    emulator_t* shadow = emu->pipeline->shadow;
+    syncPipeline(emu);
+    memcpy(&emu->machine.ppu, &shadow->machine.ppu, sizeof(ppu_t));
+    memcpy(emu->machine.ppuMem, shadow->machine.ppuMem, sizeof(emu->machine.ppuMem));
+    if (emu->chrWritable)
+    {
+        memcpy(emu->chrRam, shadow->chrRam, emu->chrMemSize);
+        memset(emu->tileCache.valid, 0, emu->chrMemSize / 16);
+    }
+    resolvePalette(emu);
+    memcpy(emu->framebuffer, shadow->framebuffer, sizeof(emu->framebuffer));
+}
+
+// Waits until the render thread has replayed everything logged so far, leaving it idle
+void syncPipeline(emulator_t* emu)
+{
+    ppu_pipeline_t* pipeline = emu->pipeline;
+    logPpu(emu, PPU_LOG_SYNC, 0, 0, 0);
+    pipeline->syncs++;
+    for (int spins = 0; __atomic_load_n(&pipeline->tail, __ATOMIC_ACQUIRE) != pipeline->head; spins++)
+    {
+        if (spins >= PIPELINE_SPINS)
+            sleepMilliseconds(1);
+    }
+    pipeline->cachedTail = pipeline->head;
+}
+
+void logPpu(emulator_t* emu, unsigned char kind, unsigned short addr, unsigned char value, unsigned int offset)
+{
+    ppu_pipeline_t* pipeline = emu->pipeline;
+    if (pipeline->head - pipeline->cachedTail > pipeline->mask)
+        waitForPipelineSpace(pipeline);
+    ppu_log_entry_t* entry = &pipeline->entries[pipeline->head & pipeline->mask];
+    entry->clock = emu->machine.masterClock;
+    entry->offset = offset;
+    entry->addr = addr;
+    entry->kind = kind;
+    entry->value = value;
+    __atomic_store_n(&pipeline->head, pipeline->head + 1, __ATOMIC_RELEASE);
+}
+
+void waitForPipelineSpace(ppu_pipeline_t* pipeline)
+{
+    while (pipeline->head - (pipeline->cachedTail = __atomic_load_n(&pipeline->tail, __ATOMIC_ACQUIRE)) > pipeline->mask)
+        sleepMilliseconds(1);
+}
+
+// Shows the frame before the one just emulated, waiting for the render thread to finish it
+void showPipelinedFrame(emulator_t* emu)
+{
+    ppu_pipeline_t* pipeline = emu->pipeline;
+    unsigned long long frame = emu->machine.frameCount - 1;
+    for (int spins = 0; __atomic_load_n(&pipeline->rendered, __ATOMIC_ACQUIRE) < frame; spins++)
+    {
+        if (spins >= PIPELINE_SPINS)
+            sleepMilliseconds(1);
+    }
+    memcpy(emu->framebuffer, pipeline->frames[frame & 1], sizeof(emu->framebuffer));
+}
+
+// PPUSTATUS and OAMDATA are answered from the emulator's own state, which has everything but the
+// sprite 0 hit. That one is only waited for while it could still show up: sprite 0 was drawable
+// this frame, rendering has started and the shadow was not already looked at past the last
+// visible scanline. Anything else is read from the shadow once it has caught up.
+unsigned char pipelinedRegisterRead(emulator_t* emu, unsigned short mem)
+{
+    ppu_pipeline_t* pipeline = emu->pipeline;
+    switch (PPUCTRL | (mem & 0x07))
+    {
+        case PPUSTATUS:
+        {
+            if (!isBitSet(emu->machine.ppu.status, SPRITE_0_HIT_BIT) && pipeline->hitPossible && emu->machine.masterClock >= ppuScanlineStart(emu, 0) && pipeline->hitCheckedAt < ppuScanlineStart(emu, POSTRENDER_SCANLINE))
+            {
+                syncPipeline(emu);
+                pipeline->hitCheckedAt = emu->machine.masterClock;
+                if (isBitSet(pipeline->shadow->machine.ppu.status, SPRITE_0_HIT_BIT))
+                    setBit(&emu->machine.ppu.status, SPRITE_0_HIT_BIT);
+            }
+            unsigned char value = emu->machine.ppu.status;
+            clearBit(&emu->machine.ppu.status, VBLANK_BIT);
+            emu->machine.ppu.writeToggle = 0;
+            logPpu(emu, PPU_LOG_READ, mem, 0, 0);
+            return value;
+        }
+        case OAMDATA:
+            return emu->machine.ppu.pOAM[emu->machine.ppu.oamAddr];
+        default:
+            syncPipeline(emu);
+            return ppuRegisterRead(pipeline->shadow, mem);
+    }
+}
+
+void replayPpuLogEntry(ppu_pipeline_t* pipeline, const ppu_log_entry_t* entry)
+{
+    emulator_t* shadow = pipeline->shadow;
+    shadow->machine.masterClock = entry->clock;
+    ppuCatchUp(shadow);
+    switch (entry->kind)
+    {
+        case PPU_LOG_WRITE:
+            ppuRegisterWrite(shadow, entry->addr, entry->value);
+            break;
+        case PPU_LOG_READ:
+            ppuRegisterRead(shadow, entry->addr);
+            break;
+        case PPU_LOG_OAM:
+            shadow->machine.ppu.pOAM[entry->addr] = entry->value;
+            break;
+        case PPU_LOG_CHR_PAGE:
+            shadow->chrPages[entry->addr] = shadow->chrMem + entry->offset;
+            shadow->chrPageTiles[entry->addr] = entry->offset >> 4;
+            break;
+        case PPU_LOG_NAMETABLE_PAGE:
+            shadow->nametablePages[entry->addr] = shadow->machine.ppuMem + entry->offset;
+            break;
+        case PPU_LOG_VBLANK:
+            ppuEnterVBlank(shadow);
+            break;
+        case PPU_LOG_FRAME_END:
+            ppuStartFrame(shadow);
+            memcpy(pipeline->frames[(pipeline->rendered + 1) & 1], shadow->framebuffer, sizeof(shadow->framebuffer));
+            __atomic_store_n(&pipeline->rendered, pipeline->rendered + 1, __ATOMIC_RELEASE);
+            break;
+    }
+}
+
+void* ppuPipelineThread(void* data)
+{
+    ppu_pipeline_t* pipeline = data;
+    for (int spins = 0;; spins++)
+    {
+        unsigned long head = __atomic_load_n(&pipeline->head, __ATOMIC_ACQUIRE);
+        if (head == pipeline->tail)
+        {
+            if (spins >= PIPELINE_SPINS)
+                sleepMilliseconds(1);
+            continue;
+        }
+        for (unsigned long tail = pipeline->tail; tail != head; tail++)
+        {
+            const ppu_log_entry_t* entry = &pipeline->entries[tail & pipeline->mask];
+            if (entry->kind == PPU_LOG_STOP)
+                return NULL;
+            replayPpuLogEntry(pipeline, entry);
+        }
+        __atomic_store_n(&pipeline->tail, head, __ATOMIC_RELEASE);
+        spins = 0;
+    }
+}
+
+// Parallel rasterizer: with --raster-threads the PPU records the scanlines it catches up over and
+// renders them across a pool of workers once it is through, see raster_pool_t. A catch-up that ends
+// in the middle of a scanline still renders that one as usual, so the frame comes out the same.
+
+int startRasterPool(emulator_t* emu, int threads)
+{
+    raster_pool_t* pool = calloc(1, sizeof(raster_pool_t));
+    if (pool == NULL)
+    {
+        feErr("Could not allocate the raster pool");
+        return -1;
+    }
+    pool->emu = emu;
+    sem_init(&pool->start, 0, 0);
+    sem_init(&pool->done, 0, 0);
+    for (int i = 0; i < threads; i++)
+    {
+        raster_worker_t* worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->scratch = createEmulator();
+        if (worker->scratch == NULL)
+            break;
+        worker->scratch->chrMem = emu->chrMem;
+        worker->scratch->tileCache = emu->tileCache;
+        // a pool that fails to start all of its threads still works with the ones it has
+        if (i > 0 && pthread_create(&worker->thread, NULL, rasterWorker, worker) != 0)
+        {
+            memset(&worker->scratch->tileCache, 0, sizeof(tile_cache_t));
+            destroyEmulator(worker->scratch);
+            break;
+        }
+        pool->threads++;
+    }
+    if (pool->threads == 0)
+    {
+        sem_destroy(&pool->start);
+        sem_destroy(&pool->done);
+        free(pool);
+        feErr("Could not allocate the raster pool");
+        return -1;
+    }
+    decodeAllTiles(emu); // CHR ROM never has to be decoded again
+    emu->raster = pool;
+    return 0;
+}
+
+void stopRasterPool(emulator_t* emu)
+{
+    raster_pool_t* pool = emu->raster;
+    pool->stop = 1;
+    for (int i = 1; i < pool->threads; i++)
+        sem_post(&pool->start);
+    for (int i = 0; i < pool->threads; i++)
+    {
+        if (i > 0)
+            pthread_join(pool->workers[i].thread, NULL);
+        memset(&pool->workers[i].scratch->tileCache, 0, sizeof(tile_cache_t)); // the emulator's
+        destroyEmulator(pool->workers[i].scratch);
+    }
+    sem_destroy(&pool->start);
+    sem_destroy(&pool->done);
+    free(pool);
+    emu->raster = NULL;
+}
+
+// Records what the current scanline depends on and moves the PPU past it the way rendering it would
+void deferScanline(emulator_t* emu)
+{
+    raster_pool_t* pool = emu->raster;
+    ppu_t* ppu = &emu->machine.ppu;
+    if (pool->from == pool->to)
+        pool->from = ppu->scanline;
+    raster_line_t* line = &pool->lines[ppu->scanline];
+    line->vramAddr = ppu->currentVRamAddr;
+    line->ctrl = ppu->ctrl;
+    memcpy(line->tilePixels, ppu->tilePixels, 8);
+    line->tilePalette = ppu->tilePalette;
+    memcpy(line->chrPages, emu->chrPages, sizeof(emu->chrPages));
+    memcpy(line->chrPageTiles, emu->chrPageTiles, sizeof(emu->chrPageTiles));
+    memcpy(line->nametablePages, emu->nametablePages, sizeof(emu->nametablePages));
+    pool->to = ppu->scanline + 1;
+    // coarse x goes around once per scanline, which leaves the tiles at its start fetched
+    loadTwoTiles(emu);
+    if ((++ppu->currentVRamAddr.fineYScroll) == 0)
+        ppu->currentVRamAddr.coarseYScroll++;
+    ppu->scanline++;
+}
+
+// Renders the recorded scanlines, waking the workers when there are enough of them
+void rasterizeDeferred(emulator_t* emu)
+{
+    raster_pool_t* pool = emu->raster;
+    int count = pool->to - pool->from;
+    if (count == 0)
+        return;
+    int helpers = count >= RASTER_PARALLEL_LINES ? pool->threads - 1 : 0;
+    if (helpers > 0)
+    {
+        if (emu->chrWritable)
+            decodeAllTiles(emu);
+        pool->jobs++;
+        pool->parallelLines += count;
+    }
+    __atomic_store_n(&pool->next, pool->from, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&pool->hit, 0, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < helpers; i++)
+        sem_post(&pool->start);
+    rasterizeScanlines(&pool->workers[0]);
+    for (int i = 0; i < helpers; i++)
+        sem_wait(&pool->done);
+    if (__atomic_load_n(&pool->hit, __ATOMIC_SEQ_CST))
+        setBit(&emu->machine.ppu.status, SPRITE_0_HIT_BIT);
+    pool->from = pool->to;
+}
+
+// Takes scanlines until there are none left. Everything read from the emulator stays as it is
+// until all workers are done.
+void rasterizeScanlines(raster_worker_t* worker)
+{
+    raster_pool_t* pool = worker->pool;
+    emulator_t* emu = pool->emu;
+    emulator_t* scratch = worker->scratch;
+    ppu_t* ppu = &scratch->machine.ppu;
+    memcpy(ppu->pOAM, emu->machine.ppu.pOAM, sizeof(ppu->pOAM));
+    memcpy(scratch->paletteRGB, emu->paletteRGB, sizeof(emu->paletteRGB));
+    memcpy(scratch->paletteChannels, emu->paletteChannels, sizeof(emu->paletteChannels));
+    for (int scanline; (scanline = __atomic_fetch_add(&pool->next, 1, __ATOMIC_SEQ_CST)) < pool->to;)
+    {
+        const raster_line_t* line = &pool->lines[scanline];
+        ppu->currentVRamAddr = line->vramAddr;
+        ppu->ctrl = line->ctrl;
+        memcpy(ppu->tilePixels, line->tilePixels, 8);
+        ppu->tilePalette = line->tilePalette;
+        memcpy(scratch->chrPages, line->chrPages, sizeof(scratch->chrPages));
+        memcpy(scratch->chrPageTiles, line->chrPageTiles, sizeof(scratch->chrPageTiles));
+        memcpy(scratch->nametablePages, line->nametablePages, sizeof(scratch->nametablePages));
+        ppu->scanline = scanline;
+        ppu->status = 0;
+        evaluateSprites(scratch);
+        renderPixels(scratch, 0, SCREEN_WIDTH);
+        memcpy(&emu->framebuffer[scanline * SCREEN_WIDTH], &scratch->framebuffer[scanline * SCREEN_WIDTH], SCREEN_WIDTH * sizeof(unsigned int));
+        if (isBitSet(ppu->status, SPRITE_0_HIT_BIT))
+            __atomic_store_n(&pool->hit, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void* rasterWorker(void* data)
+{
+    raster_worker_t* worker = data;
+    for (;;)
+    {
+        sem_wait(&worker->pool->start);
+        if (worker->pool->stop)
+            return NULL;
+        rasterizeScanlines(worker);
+        sem_post(&worker->pool->done);
+    }
+}
+
+// Observation: an observed emulator publishes CPU RAM at the end of every frame and the PPU draws
+// NES color indices into a screen of its own alongside the framebuffer, double buffered so that
+// readers, in this process or another one, never see a screen being drawn. See fe_observation_t.
+
+int startObserver(emulator_t* emu, const char* name)
+{
+    if (emu->pipeline != NULL || emu->raster != NULL)
+    {
+        feErr("Observed emulators have to render in line");
+        return -1;
+    }
+    observer_t* observer = calloc(1, sizeof(observer_t));
+    if (observer == NULL)
+    {
+        feErr("Could not allocate the observer");
+        return -1;
+    }
+    int taken = 0; // by another emulator, or one that did not get to remove it
+    if (name == NULL)
+        observer->region = calloc(1, sizeof(fe_observation_t));
+    else
+    {
+#ifdef _WIN32
+        HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(fe_observation_t), name);
+        if (mapping != NULL && GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            CloseHandle(mapping);
+            taken = 1;
+        }
+        else if (mapping != NULL)
+        {
+            observer->region = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(fe_observation_t));
+            CloseHandle(mapping); // the mapping lives on as long as a view of it does
+        }
+#else
+        int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        taken = fd == -1 && errno == EEXIST;
+        if (fd != -1 && ftruncate(fd, sizeof(fe_observation_t)) == 0)
+        {
+            void* region = mmap(NULL, sizeof(fe_observation_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            observer->region = region != MAP_FAILED ? region : NULL;
+        }
+        if (fd != -1)
+            close(fd);
+        if (observer->region == NULL && fd != -1) // only ever removes a region it created
+            shm_unlink(name);
+#endif
+        observer->name = observer->region != NULL ? strdup(name) : NULL;
+    }
+    if (observer->region == NULL)
+    {
+        free(observer);
+        feErr(taken ? "Shared memory of the observation's name already exists" : "Could not set up the observation region");
+        return -1;
+    }
+    observer->draw = observer->region->screens[1];
+    emu->observer = observer;
+    return 0;
+}
+
+// Unmaps the region, processes that still have it mapped keep it
+void stopObserver(emulator_t* emu)
+{
+    observer_t* observer = emu->observer;
+    if (observer->name == NULL)
+        free(observer->region);
+    else
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(observer->region);
+#else
+        munmap(observer->region, sizeof(fe_observation_t));
+        shm_unlink(observer->name);
+#endif
+        free(observer->name);
+    }
+    free(observer);
+    emu->observer = NULL;
+}
+
+// Publishes the frame just completed, the screen only if it was drawn
+void publishObservation(emulator_t* emu)
+{
+    observer_t* observer = emu->observer;
+    fe_observation_t* region = observer->region;
+    __atomic_store_n(&region->sequence, region->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(region->ram, emu->machine.cpuMem, CPU_RAM_SIZE);
+    region->frame = emu->machine.frameCount;
+    if (!emu->renderSkip.active)
+    {
+        region->screen = observer->draw == region->screens[1];
+        region->screenFrame = emu->machine.frameCount;
+        observer->draw = region->screens[region->screen ^ 1];
+    }
+    __atomic_store_n(&region->sequence, region->sequence + 1, __ATOMIC_RELEASE);
+}
+
+// Draws the NES colors of the pixels renderPixels() just drew, picked the same way
+void observePixels(emulator_t* emu, int from, int to)
+{
+    ppu_t* ppu = &emu->machine.ppu;
+    unsigned char* line = &emu->observer->draw[ppu->scanline * SCREEN_WIDTH];
+    for (int x = from; x < to; x++)
+    {
+        unsigned char sprite = ppu->spritesOnLine ? ppu->spriteLine[x] : 0;
+        line[x] = emu->paletteColors[pixelPaletteIndex(ppu, ppu->tilePixels[x & 7], sprite)];
+    }
+}
+
+// Assembles the status register, evaluating the lazily tracked N and Z flags
+unsigned char getFlags(emulator_t* emu)
+{
+    return (emu->machine.flags & ~((1 << NEGATIVE_FLAG) | (1 << ZERO_FLAG))) | (emu->machine.lazyNegativeResult & (1 << NEGATIVE_FLAG)) | ((emu->machine.lazyZeroResult == 0) << ZERO_FLAG);
+}
+
+void setFlags(emulator_t* emu, unsigned char value)
+{
+    emu->machine.flags = value;
+    emu->machine.lazyNegativeResult = value;
+    emu->machine.lazyZeroResult = !isBitSet(value, ZERO_FLAG);
+}
+
+void setFlag(emulator_t* emu, int bit)
+{
+    setFlags(emu, getFlags(emu) | (1 << bit));
+}
+
+void clearFlag(emulator_t* emu, int bit)
+{
+    setFlags(emu, getFlags(emu) & ~(1 << bit));
+}
+
+int flipFlag(emulator_t* emu, int bit)
+{
+    if (!isFlagSet(emu, bit))
+    {
+        setFlag(emu, bit);
+        return 1;
+    }
+    else
+    {
+        clearFlag(emu, bit);
+        return 0;
+    }
+}
+
+int isFlagSet(emulator_t* emu, int bit)
+{
+    return isBitSet(getFlags(emu), bit);
+}
+
+int isBitSet(unsigned char field, int bit)
+{
+    return (field & (1 << bit)) != 0;
+}
+
+void setBit(unsigned char* field, int bit)
+{
+    *field |= (1 << bit);
+}
+
+void clearBit(unsigned char* field, int bit)
+{
+    *field &= ~(1 << bit);
+}
+
+void m6502pushStack(emulator_t* emu, unsigned char c)
+{
+    emu->machine.cpuMem[((unsigned short) 0x0100) + ((unsigned short) emu->machine.regS--)] = c;
+}
+
+unsigned char m6502pullStack(emulator_t* emu)
+{
+    return emu->machine.cpuMem[((unsigned short) 0x0100) + ((unsigned short) ++emu->machine.regS)];
+}
+
+// pc should be on the branch instruction
+void m6502branch(emulator_t* emu)
+{
+    emu->machine.pc += 2;
+    emu->machine.pc += (char) cpuRead(emu, emu->machine.pc - 1);
+}
+
+// NMIs and IRQs alike: pushes the return address and the status with B clear, masks IRQs so that
+// none preempts the handler and takes the 7 cycles the sequence does
+void m6502interrupt(emulator_t* emu, unsigned short addr)
+{
+    m6502pushStack(emu, hiByte(emu->machine.pc));
+    m6502pushStack(emu, loByte(emu->machine.pc));
+    m6502pushStack(emu, (getFlags(emu) & ~(1 << BREAK_FLAG)) | (1 << UNUSED_FLAG));
+    setFlag(emu, INTERRUPT_FLAG);
+    m6502jmp(emu, addr);
+    emu->machine.masterClock += 7 * CPU_CLOCK_DIVIDER;
+}
+
+void m6502jmp(emulator_t* emu, unsigned short addr)
+{
+    emu->machine.pc = addr;
+}
+
+unsigned char loByte(unsigned short addr)
+{
+    return (unsigned char) addr;
+}
+
+unsigned char hiByte(unsigned short addr)
+{
+    return (unsigned char) (addr >> 8);
+}
+
+unsigned short combineBytes(unsigned short lo, unsigned short hi)
+{
+    return (((unsigned short) hi) << 8) | lo;
+}
+
+void printEmulatorOverview(emulator_t* emu)
+{
+    printf("-- EMULATOR STATE --\n");
+    printf("a: $%x      x: $%x      y: $%x      s: $%x\n", emu->machine.regA, emu->machine.regX, emu->machine.regY, emu->machine.regS);
+    printf("pc: $%x     flags: %%", emu->machine.pc);
+    printBin(getFlags(emu));
+    printf("\n");
+}
+
+// Errors go to stderr, stdout is left to whoever embeds the library
+void feErr(const char* message)
+{
+    fprintf(stderr, "FE: error: %s\n", message);
+}
+
+void feROMErr(const char* message)
+{
+    fprintf(stderr, "FE: error: Could not load ROM: %s\n", message);
+}
+
+void printBin(unsigned char c)
+{
+    char number[10];
+    number[8] = '\n';
+    number[9] = '\0';
+    for (int i = 0; i < 8; i++)
+        number[7 - i] = ((c >> i) & 1) ? '1' : '0';
+    printf(number);
+}
+
+// sum stack overflow code
+uint64_t timestamp()
+{
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return tv.tv_sec*(uint64_t)1000000+tv.tv_usec;
+}
+
+// Monotonic, for the profiler
+uint64_t nanoTimestamp()
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (counter.QuadPart / frequency.QuadPart) * 1000000000 + (counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * (uint64_t) 1000000000 + now.tv_nsec;
+#endif
+}
+
+void sleepMilliseconds(unsigned int ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec duration = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&duration, NULL);
+#endif
+}
+
+int cpuCount()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? count : 1;
+#endif
+}
+
+void loadTwoTiles(emulator_t* emu)
+{
+    // nametable 0 base + nametable offset + coarse y offset + coarse x offset
+    unsigned short nametableIndex = (0x20 * emu->machine.ppu.currentVRamAddr.coarseYScroll) + (emu->machine.ppu.currentVRamAddr.coarseXScroll);
+    const unsigned char* nametable = emu->nametablePages[emu->machine.ppu.currentVRamAddr.nametableSelect];
+    // fine y offset
+    int startLine = emu->machine.ppu.currentVRamAddr.fineYScroll;
+    memcpy(emu->machine.ppu.tilePixels, tileRow(emu, isBitSet(emu->machine.ppu.ctrl, BG_PATTERN_TABLE_BIT), nametable[nametableIndex], startLine), 8);
+    // attr table offset 
+    unsigned char attr = nametable[0x3C0 + ((nametableIndex / 0x80) * 8) + ((nametableIndex / 4) % 8)];
+    unsigned char loAttrBitIndex = ((1 << (4 * ((nametableIndex / 0x40) % 2)))) << (2 * ((nametableIndex / 0x02) % 2));
+    int paletteIndex = 0;
+    if (attr & (loAttrBitIndex << 1))
+        paletteIndex |= 0b10;
+    if (attr & loAttrBitIndex)
+        paletteIndex |= 0b01;
+    emu->machine.ppu.tilePalette = 4 * paletteIndex;
+}
+
+// Returns the decoded color indices for one row of a pattern table tile
+const unsigned char* tileRow(emulator_t* emu, int table, unsigned char tile, int fineY)
+{
+    // each 1kb slot holds 64 tiles
+    unsigned int index = emu->chrPageTiles[(table << 2) | (tile >> 6)] + (tile & 0x3F);
+    if (!emu->tileCache.valid[index])
+        decodeTile(emu, index);
+    return emu->tileCache.pixels[index][fineY];
+}
+
+void decodeTile(emulator_t* emu, unsigned int index)
+{
+    const unsigned char* pattern = emu->chrMem + (index << 4);
+    for (int row = 0; row < 8; row++)
+    {
+        unsigned char patternHi = pattern[row + 8];
+        unsigned char patternLo = pattern[row];
+        for (int p = 0; p < 8; p++)
+            emu->tileCache.pixels[index][row][p] = (((patternHi << p) & 0x80) >> 6) | (((patternLo << p) & 0x80) >> 7);
+    }
+    emu->tileCache.valid[index] = 1;
+}
+
+// Must be called whenever CHR RAM behind the pattern table address changes
+void invalidateTile(emulator_t* emu, unsigned short addr)
+{
+    emu->tileCache.valid[emu->chrPageTiles[addr >> 10] + ((addr & (CHR_PAGE_SIZE - 1)) >> 4)] = 0;
+}
+
+// Decodes every tile that is not in the cache, so raster workers only ever read it
+void decodeAllTiles(emulator_t* emu)
+{
+    for (unsigned int index = 0; index < emu->chrMemSize / 16; index++)
+    {
+        if (!emu->tileCache.valid[index])
+            decodeTile(emu, index);
+    }
+}
+
+unsigned short inc5BitInt(unsigned short addr, int offset)
+{
+    unsigned short bi = ((addr >> offset) & 0b11111);
+    bi++;
+    if (bi > 0b11111) bi = 0;
+    return (addr & (~(((unsigned short) 0b11111) << offset))) | (bi << offset);
+}
+
+// 32-bit FNV-1a, used to compare emulation results
+unsigned int fnv1a(const void* data, size_t size)
+{
+    const unsigned char* bytes = data;
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+// Library API, see fe.h. Emulators made through it always render in line, the render thread and
+// the raster pool are left to the front-end.
+
+pthread_once_t coreInitialized = PTHREAD_ONCE_INIT;
+
+// Tables every emulator shares, the compositor is picked once for the CPU unless the front-end has
+void initCore()
+{
+    if (composeTile == NULL)
+        selectCompositor(NULL);
+    initBandLimitedStep();
+}
+
+fe_emulator_t* feCreate(void)
+{
+    pthread_once(&coreInitialized, initCore);
+    return createEmulator();
+}
+
+void feDestroy(fe_emulator_t* emu)
+{
+    if (emu != NULL)
+        destroyEmulator(emu);
+}
+
+int feLoadROM(fe_emulator_t* emu, const void* data, size_t size)
+{
+    if (emu->cartridge.data != NULL)
+    {
+        feErr("A ROM is already loaded");
+        return -1;
+    }
+    if (loadROMImage(emu, data, size) == -1)
+        return -1;
+    resetScheduler(emu);
+    return 0;
+}
+
+int feLoadROMFile(fe_emulator_t* emu, const char* path)
+{
+    if (emu->cartridge.data != NULL)
+    {
+        feErr("A ROM is already loaded");
+        return -1;
+    }
+    if (loadROM(emu, path) == -1)
+        return -1;
+    resetScheduler(emu);
+    return 0;
+}
+
+// Running the console or touching its state needs a cartridge in it, the mapper is what reads it
+int requireROM(const fe_emulator_t* emu)
+{
+    if (emu->cartridge.data != NULL)
+        return 0;
+    feErr("No ROM is loaded");
+    return -1;
+}
+
+void feSetInput(fe_emulator_t* emu, unsigned short buttons)
+{
+    emu->machine.buttons = buttons;
+}
+
+int feStepFrames(fe_emulator_t* emu, unsigned long frames)
+{
+    if (requireROM(emu) == -1)
+        return -1;
+    for (unsigned long f = 0; f < frames; f++)
+        emulateFrame(emu);
+    return 0;
+}
+
+int feStepCycles(fe_emulator_t* emu, unsigned long long cycles)
+{
+    if (requireROM(emu) == -1)
+        return -1;
+    emulateCycles(emu, cycles);
+    return 0;
+}
+
+unsigned long long feFrameCount(const fe_emulator_t* emu)
+{
+    return emu->machine.frameCount;
+}
+
+unsigned long long feCycleCount(const fe_emulator_t* emu)
+{
+    return emu->machine.masterClock / CPU_CLOCK_DIVIDER;
+}
+
+const unsigned int* feFramebuffer(const fe_emulator_t* emu)
+{
+    return emu->framebuffer;
+}
+
+const short* feAudio(const fe_emulator_t* emu, size_t* count)
+{
+    *count = emu->audio.sampleCount;
+    return emu->audio.samples;
+}
+
+void feSetRenderSkip(fe_emulator_t* emu, unsigned int skip, unsigned int every)
+{
+    setRenderSkip(emu, skip, every);
+}
+
+void feRequestFrame(fe_emulator_t* emu)
+{
+    requestFrame(emu);
+}
+
+size_t feStateSize(const fe_emulator_t* emu)
+{
+    if (emu->cartridge.data == NULL)
+        return 0;
+    return saveStateSize((emulator_t*) emu);
+}
+
+int feSaveState(fe_emulator_t* emu, void* buffer, size_t size)
+{
+    if (requireROM(emu) == -1)
+        return -1;
+    return saveState(emu, buffer, size) == -1 ? -1 : 0;
+}
+
+int feLoadState(fe_emulator_t* emu, const void* buffer, size_t size)
+{
+    if (requireROM(emu) == -1)
+        return -1;
+    return loadState(emu, buffer, size);
+}
+
+unsigned char* feRAM(fe_emulator_t* emu)
+{
+    return emu->machine.cpuMem;
+}
+
+unsigned char feRead(fe_emulator_t* emu, unsigned short addr)
+{
+    if (emu->cartridge.data == NULL)
+        return 0;
+    return cpuRead(emu, addr);
+}
+
+void feWrite(fe_emulator_t* emu, unsigned short addr, unsigned char value)
+{
+    if (emu->cartridge.data != NULL)
+        cpuWrite(emu, addr, value);
+}
+
+const fe_observation_t* feObserve(fe_emulator_t* emu, const char* name)
+{
+    if (emu->observer != NULL)
+    {
+        feErr("The emulator is already observed");
+        return NULL;
+    }
+    if (startObserver(emu, name) == -1)
+        return NULL;
+    return emu->observer->region;
+}
\ No newline at end of file
@@ -0,0 +1,1088 @@
+#ifndef FE_CORE_H
+#define FE_CORE_H
+
+// Internals of libfe (core.c), shared with the front-end (fe.c). Embedders go through fe.h instead.
+
+#include "fe.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FE_X86_SIMD
+#endif
+
+#define CPU_RAM_SIZE FE_RAM_SIZE
+#define PRG_RAM_SIZE 0x2000
+#define PPU_SIZE 0x4000
+
+#define CPU_PRG_OFFSET 0x8000
+#define PRG_BANK_SIZE 0x4000
+#define CHR_BANK_SIZE 0x2000
+#define CHR_PAGE_SIZE 0x400
+#define CHR_RAM_SIZE 0x2000
+
+#define INES_HEADER_SIZE 16
+#define INES_TRAINER_SIZE 0x200
+#define TRAINER_OFFSET 0x1000 // trainers are loaded to $7000
+
+#define MIRRORING_HORIZONTAL 0
+#define MIRRORING_VERTICAL 1
+#define MIRRORING_FOUR_SCREEN 2
+#define MIRRORING_SINGLE_LOWER 3
+#define MIRRORING_SINGLE_UPPER 4
+
+#define CPU_CYCLES_PER_FRAME 29781
+#define PPU_CYCLES_PER_FRAME 89342
+
+#define PPU_CYCLES_PER_SCANLINE 341
+
+#define CPU_CLOCK_DIVIDER 3 // the master clock counts PPU cycles, three per CPU cycle
+#define OAM_DMA_CYCLES 513
+
+#define SCANLINES 262
+#define PRERENDER_SCANLINE -1
+#define POSTRENDER_SCANLINE 240
+#define FIRST_VBLANK_SCANLINE 241
+
+#define SCREEN_WIDTH FE_SCREEN_WIDTH
+#define SCREEN_HEIGHT FE_SCREEN_HEIGHT
+
+#define IMPL_SIZE 1
+#define IMM_SIZE 2
+#define IND_SIZE 2
+#define ZP_SIZE 2
+#define ABS_SIZE 3
+
+// Instruction Opcodes
+#define BRK 0x00
+#define ORA_X_IND 0x01
+#define ORA_ZP 0x05
+#define ASL_ZP 0x06
+#define PHP 0x08
+#define ORA_IMM 0x09
+#define ASL_A 0x0A
+#define ORA_ABS 0x0D
+#define ASL_ABS 0x0E
+#define BPL 0x10
+#define ORA_Y_IND 0x11
+#define ORA_ZP_X 0x15
+#define ASL_ZP_X 0x16
+#define CLC 0x18
+#define ORA_ABS_Y 0x19
+#define ORA_ABS_X 0x1D
+#define ASL_ABS_X 0x1E
+#define JSR 0x20
+#define AND_X_IND 0x21
+#define BIT_ZP 0x24
+#define AND_ZP 0x25
+#define ROL_ZP 0x26
+#define PLP 0x28
+#define AND_IMM 0x29
+#define ROL_A 0x2A
+#define BIT_ABS 0x2C
+#define AND_ABS 0x2D
+#define ROL_ABS 0x2E
+#define BMI 0x30
+#define AND_Y_IND 0x31
+#define AND_ZP_X 0x35
+#define ROL_ZP_X 0x36
+#define SEC 0x38
+#define AND_ABS_Y 0x39
+#define AND_ABS_X 0x3D
+#define ROL_ABS_X 0x3E
+#define RTI 0x40
+#define EOR_X_IND 0x41
+#define EOR_ZP 0x45
+#define LSR_ZP 0x46
+#define PHA 0x48
+#define EOR_IMM 0x49
+#define LSR_A 0x4A
+#define JMP_ABS 0x4C
+#define EOR_ABS 0x4D
+#define LSR_ABS 0x4E
+#define BVC 0x50
+#define EOR_Y_IND 0x51
+#define EOR_ZP_X 0x55
+#define LSR_ZP_X 0x56
+#define CLI 0x58
+#define EOR_ABS_Y 0x59
+#define EOR_ABS_X 0x5D
+#define LSR_ABS_X 0x5E
+#define RTS 0x60
+#define ADC_X_IND 0x61
+#define ADC_ZP 0x65
+#define ROR_ZP 0x66
+#define PLA 0x68
+#define ADC_IMM 0x69
+#define ROR_A 0x6A
+#define JMP_IND 0x6C
+#define ADC_ABS 0x6D
+#define ROR_ABS 0x6E
+#define BVS 0x70
+#define ADC_Y_IND 0x71
+#define ADC_ZP_X 0x75
+#define ROR_ZP_X 0x76
+#define SEI 0x78
+#define ADC_ABS_Y 0x79
+#define ADC_ABS_X 0x7D
+#define ROR_ABS_X 0x7E
+#define STA_X_IND 0x81
+#define STY_ZP 0x84
+#define STA_ZP 0x85
+#define STX_ZP 0x86
+#define DEY 0x88
+#define TXA 0x8A
+#define STY_ABS 0x8C
+#define STA_ABS 0x8D
+#define STX_ABS 0x8E
+#define BCC 0x90
+#define STA_Y_IND 0x91
+#define STY_ZP_X 0x94
+#define STA_ZP_X 0x95
+#define STX_ZP_Y 0x96
+#define TYA 0x98
+#define STA_ABS_Y 0x99
+#define TXS 0x9A
+#define STA_ABS_X 0x9D
+#define LDY_IMM 0xA0
+#define LDA_X_IND 0xA1
+#define LDX_IMM 0xA2
+#define LDY_ZP 0xA4
+#define LDA_ZP 0xA5
+#define LDX_ZP 0xA6
+#define TAY 0xA8
+#define LDA_IMM 0xA9
+#define TAX 0xAA
+#define LDY_ABS 0xAC
+#define LDA_ABS 0xAD
+#define LDX_ABS 0xAE
+#define BCS 0xB0
+#define LDA_Y_IND 0xB1
+#define LDY_ZP_X 0xB4
+#define LDA_ZP_X 0xB5
+#define LDX_ZP_Y 0xB6
+#define CLV 0xB8
+#define LDA_ABS_Y 0xB9
+#define TSX 0xBA
+#define LDY_ABS_X 0xBC
+#define LDA_ABS_X 0xBD
+#define LDX_ABS_Y 0xBE
+#define CPY_IMM 0xC0
+#define CMP_X_IND 0xC1
+#define CPY_ZP 0xC4
+#define CMP_ZP 0xC5
+#define DEC_ZP 0xC6
+#define INY 0xC8
+#define CMP_IMM 0xC9
+#define DEX 0xCA
+#define CPY_ABS 0xCC
+#define CMP_ABS 0xCD
+#define DEC_ABS 0xCE
+#define BNE 0xD0
+#define CMP_Y_IND 0xD1
+#define CMP_ZP_X 0xD5
+#define DEC_ZP_X 0xD6
+#define CLD 0xD8
+#define CMP_ABS_Y 0xD9
+#define CMP_ABS_X 0xDD
+#define DEC_ABS_X 0xDE
+#define CPX_IMM 0xE0
+#define SBC_X_IND 0xE1
+#define CPX_ZP 0xE4
+#define SBC_ZP 0xE5
+#define INC_ZP 0xE6
+#define INX 0xE8
+#define SBC_IMM 0xE9
+#define NOP 0xEA
+#define CPX_ABS 0xEC
+#define SBC_ABS 0xED
+#define INC_ABS 0xEE
+#define BEQ 0xF0
+#define SBC_Y_IND 0xF1
+#define SBC_ZP_X 0xF5
+#define INC_ZP_X 0xF6
+#define SED 0xF8
+#define SBC_ABS_Y 0xF9
+#define SBC_ABS_X 0xFD
+#define INC_ABS_X 0xFE
+
+// Every documented opcode as (opcode, kind, operation/register/condition, addressing mode, size).
+// core.c generates the handlers of every kind except IMPLIED from it.
+#define OPCODE_LIST(X) \
+    X(BRK, IMPLIED, 0, 0, 0) \
+    X(ORA_X_IND, READ, m6502ora, eaXInd, IND_SIZE) \
+    X(ORA_ZP, READ, m6502ora, eaZp, ZP_SIZE) \
+    X(ASL_ZP, RMW, m6502asl, eaZp, ZP_SIZE) \
+    X(PHP, IMPLIED, 0, 0, 0) \
+    X(ORA_IMM, READ, m6502ora, eaImm, IMM_SIZE) \
+    X(ASL_A, ACCUMULATOR, m6502asl, 0, IMPL_SIZE) \
+    X(ORA_ABS, READ, m6502ora, eaAbs, ABS_SIZE) \
+    X(ASL_ABS, RMW, m6502asl, eaAbs, ABS_SIZE) \
+    X(BPL, BRANCH, !isNegativeFlagSet(emu), 0, 0) \
+    X(ORA_Y_IND, READ, m6502ora, eaYInd, IND_SIZE) \
+    X(ORA_ZP_X, READ, m6502ora, eaZpX, ZP_SIZE) \
+    X(ASL_ZP_X, RMW, m6502asl, eaZpX, ZP_SIZE) \
+    X(CLC, IMPLIED, 0, 0, 0) \
+    X(ORA_ABS_Y, READ, m6502ora, eaAbsY, ABS_SIZE) \
+    X(ORA_ABS_X, READ, m6502ora, eaAbsX, ABS_SIZE) \
+    X(ASL_ABS_X, RMW, m6502asl, eaAbsX, ABS_SIZE) \
+    X(JSR, IMPLIED, 0, 0, 0) \
+    X(AND_X_IND, READ, m6502and, eaXInd, IND_SIZE) \
+    X(BIT_ZP, READ, m6502bit, eaZp, ZP_SIZE) \
+    X(AND_ZP, READ, m6502and, eaZp, ZP_SIZE) \
+    X(ROL_ZP, RMW, m6502rol, eaZp, ZP_SIZE) \
+    X(PLP, IMPLIED, 0, 0, 0) \
+    X(AND_IMM, READ, m6502and, eaImm, IMM_SIZE) \
+    X(ROL_A, ACCUMULATOR, m6502rol, 0, IMPL_SIZE) \
+    X(BIT_ABS, READ, m6502bit, eaAbs, ABS_SIZE) \
+    X(AND_ABS, READ, m6502and, eaAbs, ABS_SIZE) \
+    X(ROL_ABS, RMW, m6502rol, eaAbs, ABS_SIZE) \
+    X(BMI, BRANCH, isNegativeFlagSet(emu), 0, 0) \
+    X(AND_Y_IND, READ, m6502and, eaYInd, IND_SIZE) \
+    X(AND_ZP_X, READ, m6502and, eaZpX, ZP_SIZE) \
+    X(ROL_ZP_X, RMW, m6502rol, eaZpX, ZP_SIZE) \
+    X(SEC, IMPLIED, 0, 0, 0) \
+    X(AND_ABS_Y, READ, m6502and, eaAbsY, ABS_SIZE) \
+    X(AND_ABS_X, READ, m6502and, eaAbsX, ABS_SIZE) \
+    X(ROL_ABS_X, RMW, m6502rol, eaAbsX, ABS_SIZE) \
+    X(RTI, IMPLIED, 0, 0, 0) \
+    X(EOR_X_IND, READ, m6502eor, eaXInd, IND_SIZE) \
+    X(EOR_ZP, READ, m6502eor, eaZp, ZP_SIZE) \
+    X(LSR_ZP, RMW, m6502lsr, eaZp, ZP_SIZE) \
+    X(PHA, IMPLIED, 0, 0, 0) \
+    X(EOR_IMM, READ, m6502eor, eaImm, IMM_SIZE) \
+    X(LSR_A, ACCUMULATOR, m6502lsr, 0, IMPL_SIZE) \
+    X(JMP_ABS, IMPLIED, 0, 0, 0) \
+    X(EOR_ABS, READ, m6502eor, eaAbs, ABS_SIZE) \
+    X(LSR_ABS, RMW, m6502lsr, eaAbs, ABS_SIZE) \
+    X(BVC, BRANCH, !isBitSet(emu->machine.flags, OVERFLOW_FLAG), 0, 0) \
+    X(EOR_Y_IND, READ, m6502eor, eaYInd, IND_SIZE) \
+    X(EOR_ZP_X, READ, m6502eor, eaZpX, ZP_SIZE) \
+    X(LSR_ZP_X, RMW, m6502lsr, eaZpX, ZP_SIZE) \
+    X(CLI, IMPLIED, 0, 0, 0) \
+    X(EOR_ABS_Y, READ, m6502eor, eaAbsY, ABS_SIZE) \
+    X(EOR_ABS_X, READ, m6502eor, eaAbsX, ABS_SIZE) \
+    X(LSR_ABS_X, RMW, m6502lsr, eaAbsX, ABS_SIZE) \
+    X(RTS, IMPLIED, 0, 0, 0) \
+    X(ADC_X_IND, READ, m6502adc, eaXInd, IND_SIZE) \
+    X(ADC_ZP, READ, m6502adc, eaZp, ZP_SIZE) \
+    X(ROR_ZP, RMW, m6502ror, eaZp, ZP_SIZE) \
+    X(PLA, IMPLIED, 0, 0, 0) \
+    X(ADC_IMM, READ, m6502adc, eaImm, IMM_SIZE) \
+    X(ROR_A, ACCUMULATOR, m6502ror, 0, IMPL_SIZE) \
+    X(JMP_IND, IMPLIED, 0, 0, 0) \
+    X(ADC_ABS, READ, m6502adc, eaAbs, ABS_SIZE) \
+    X(ROR_ABS, RMW, m6502ror, eaAbs, ABS_SIZE) \
+    X(BVS, BRANCH, isBitSet(emu->machine.flags, OVERFLOW_FLAG), 0, 0) \
+    X(ADC_Y_IND, READ, m6502adc, eaYInd, IND_SIZE) \
+    X(ADC_ZP_X, READ, m6502adc, eaZpX, ZP_SIZE) \
+    X(ROR_ZP_X, RMW, m6502ror, eaZpX, ZP_SIZE) \
+    X(SEI, IMPLIED, 0, 0, 0) \
+    X(ADC_ABS_Y, READ, m6502adc, eaAbsY, ABS_SIZE) \
+    X(ADC_ABS_X, READ, m6502adc, eaAbsX, ABS_SIZE) \
+    X(ROR_ABS_X, RMW, m6502ror, eaAbsX, ABS_SIZE) \
+    X(STA_X_IND, STORE, emu->machine.regA, eaXInd, IND_SIZE) \
+    X(STY_ZP, STORE, emu->machine.regY, eaZp, ZP_SIZE) \
+    X(STA_ZP, STORE, emu->machine.regA, eaZp, ZP_SIZE) \
+    X(STX_ZP, STORE, emu->machine.regX, eaZp, ZP_SIZE) \
+    X(DEY, IMPLIED, 0, 0, 0) \
+    X(TXA, IMPLIED, 0, 0, 0) \
+    X(STY_ABS, STORE, emu->machine.regY, eaAbs, ABS_SIZE) \
+    X(STA_ABS, STORE, emu->machine.regA, eaAbs, ABS_SIZE) \
+    X(STX_ABS, STORE, emu->machine.regX, eaAbs, ABS_SIZE) \
+    X(BCC, BRANCH, !isBitSet(emu->machine.flags, CARRY_FLAG), 0, 0) \
+    X(STA_Y_IND, STORE, emu->machine.regA, eaYInd, IND_SIZE) \
+    X(STY_ZP_X, STORE, emu->machine.regY, eaZpX, ZP_SIZE) \
+    X(STA_ZP_X, STORE, emu->machine.regA, eaZpX, ZP_SIZE) \
+    X(STX_ZP_Y, STORE, emu->machine.regX, eaZpY, ZP_SIZE) \
+    X(TYA, IMPLIED, 0, 0, 0) \
+    X(STA_ABS_Y, STORE, emu->machine.regA, eaAbsY, ABS_SIZE) \
+    X(TXS, IMPLIED, 0, 0, 0) \
+    X(STA_ABS_X, STORE, emu->machine.regA, eaAbsX, ABS_SIZE) \
+    X(LDY_IMM, LOAD, emu->machine.regY, eaImm, IMM_SIZE) \
+    X(LDA_X_IND, LOAD, emu->machine.regA, eaXInd, IND_SIZE) \
+    X(LDX_IMM, LOAD, emu->machine.regX, eaImm, IMM_SIZE) \
+    X(LDY_ZP, LOAD, emu->machine.regY, eaZp, ZP_SIZE) \
+    X(LDA_ZP, LOAD, emu->machine.regA, eaZp, ZP_SIZE) \
+    X(LDX_ZP, LOAD, emu->machine.regX, eaZp, ZP_SIZE) \
+    X(TAY, IMPLIED, 0, 0, 0) \
+    X(LDA_IMM, LOAD, emu->machine.regA, eaImm, IMM_SIZE) \
+    X(TAX, IMPLIED, 0, 0, 0) \
+    X(LDY_ABS, LOAD, emu->machine.regY, eaAbs, ABS_SIZE) \
+    X(LDA_ABS, LOAD, emu->machine.regA, eaAbs, ABS_SIZE) \
+    X(LDX_ABS, LOAD, emu->machine.regX, eaAbs, ABS_SIZE) \
+    X(BCS, BRANCH, isBitSet(emu->machine.flags, CARRY_FLAG), 0, 0) \
+    X(LDA_Y_IND, LOAD, emu->machine.regA, eaYInd, IND_SIZE) \
+    X(LDY_ZP_X, LOAD, emu->machine.regY, eaZpX, ZP_SIZE) \
+    X(LDA_ZP_X, LOAD, emu->machine.regA, eaZpX, ZP_SIZE) \
+    X(LDX_ZP_Y, LOAD, emu->machine.regX, eaZpY, ZP_SIZE) \
+    X(CLV, IMPLIED, 0, 0, 0) \
+    X(LDA_ABS_Y, LOAD, emu->machine.regA, eaAbsY, ABS_SIZE) \
+    X(TSX, IMPLIED, 0, 0, 0) \
+    X(LDA_ABS_X, LOAD, emu->machine.regA, eaAbsX, ABS_SIZE) \
+    X(LDY_ABS_X, LOAD, emu->machine.regY, eaAbsX, ABS_SIZE) \
+    X(LDX_ABS_Y, LOAD, emu->machine.regX, eaAbsY, ABS_SIZE) \
+    X(CPY_IMM, READ, m6502cpy, eaImm, IMM_SIZE) \
+    X(CMP_X_IND, READ, m6502cmp, eaXInd, IND_SIZE) \
+    X(CPY_ZP, READ, m6502cpy, eaZp, ZP_SIZE) \
+    X(CMP_ZP, READ, m6502cmp, eaZp, ZP_SIZE) \
+    X(DEC_ZP, RMW, m6502dec, eaZp, ZP_SIZE) \
+    X(INY, IMPLIED, 0, 0, 0) \
+    X(CMP_IMM, READ, m6502cmp, eaImm, IMM_SIZE) \
+    X(DEX, IMPLIED, 0, 0, 0) \
+    X(CPY_ABS, READ, m6502cpy, eaAbs, ABS_SIZE) \
+    X(CMP_ABS, READ, m6502cmp, eaAbs, ABS_SIZE) \
+    X(DEC_ABS, RMW, m6502dec, eaAbs, ABS_SIZE) \
+    X(BNE, BRANCH, !isZeroFlagSet(emu), 0, 0) \
+    X(CMP_Y_IND, READ, m6502cmp, eaYInd, IND_SIZE) \
+    X(CMP_ZP_X, READ, m6502cmp, eaZpX, ZP_SIZE) \
+    X(DEC_ZP_X, RMW, m6502dec, eaZpX, ZP_SIZE) \
+    X(CLD, IMPLIED, 0, 0, 0) \
+    X(CMP_ABS_Y, READ, m6502cmp, eaAbsY, ABS_SIZE) \
+    X(CMP_ABS_X, READ, m6502cmp, eaAbsX, ABS_SIZE) \
+    X(DEC_ABS_X, RMW, m6502dec, eaAbsX, ABS_SIZE) \
+    X(CPX_IMM, READ, m6502cpx, eaImm, IMM_SIZE) \
+    X(SBC_X_IND, READ, m6502sbc, eaXInd, IND_SIZE) \
+    X(CPX_ZP, READ, m6502cpx, eaZp, ZP_SIZE) \
+    X(SBC_ZP, READ, m6502sbc, eaZp, ZP_SIZE) \
+    X(INC_ZP, RMW, m6502inc, eaZp, ZP_SIZE) \
+    X(INX, IMPLIED, 0, 0, 0) \
+    X(SBC_IMM, READ, m6502sbc, eaImm, IMM_SIZE) \
+    X(NOP, IMPLIED, 0, 0, 0) \
+    X(CPX_ABS, READ, m6502cpx, eaAbs, ABS_SIZE) \
+    X(SBC_ABS, READ, m6502sbc, eaAbs, ABS_SIZE) \
+    X(INC_ABS, RMW, m6502inc, eaAbs, ABS_SIZE) \
+    X(BEQ, BRANCH, isZeroFlagSet(emu), 0, 0) \
+    X(SBC_Y_IND, READ, m6502sbc, eaYInd, IND_SIZE) \
+    X(SBC_ZP_X, READ, m6502sbc, eaZpX, ZP_SIZE) \
+    X(INC_ZP_X, RMW, m6502inc, eaZpX, ZP_SIZE) \
+    X(SED, IMPLIED, 0, 0, 0) \
+    X(SBC_ABS_Y, READ, m6502sbc, eaAbsY, ABS_SIZE) \
+    X(SBC_ABS_X, READ, m6502sbc, eaAbsX, ABS_SIZE) \
+    X(INC_ABS_X, RMW, m6502inc, eaAbsX, ABS_SIZE)
+
+// Flags
+#define CARRY_FLAG 0
+#define ZERO_FLAG 1
+#define INTERRUPT_FLAG 2
+#define DECIMAL_FLAG 3
+#define BREAK_FLAG 4
+#define UNUSED_FLAG 5 // always reads as set
+#define OVERFLOW_FLAG 6
+#define NEGATIVE_FLAG 7
+
+// PPU Registers
+#define PPUCTRL 0x2000
+#define PPUMASK 0x2001
+#define PPUSTATUS 0x2002
+#define OAMADDR 0x2003
+#define OAMDATA 0x2004
+#define PPUSCROLL 0x2005
+#define PPUADDR 0x2006
+#define PPUDATA 0x2007
+#define OAMDMA 0x4014
+
+// APU Registers
+#define APU_STATUS 0x4015
+#define APU_FRAME_COUNTER 0x4017
+
+// Controller Register
+#define CONTROLLER_1 0x4016
+#define CONTROLLER_2 0x4017
+
+// Controller Bindings
+#define C1_A 0
+#define C1_B 1
+#define C1_SELECT 2
+#define C1_START 3
+#define C1_UP 4
+#define C1_DOWN 5
+#define C1_LEFT 6
+#define C1_RIGHT 7
+
+#define C2_A 8
+#define C2_B 9
+#define C2_SELECT 10
+#define C2_START 11
+#define C2_UP 12
+#define C2_DOWN 13
+#define C2_LEFT 14
+#define C2_RIGHT 15
+
+// Scheduler events
+#define EVENT_VBLANK 0
+#define EVENT_FRAME_END 1
+#define EVENT_MAPPER_SCANLINE 2
+#define EVENT_APU_FRAME 3
+#define EVENT_COUNT 4
+#define NO_EVENT ~0ULL
+
+// Vectors
+#define NMI_VECTOR 0xFFFA
+#define RESET_VECTOR 0xFFFC
+#define IRQ_VECTOR 0xFFFE
+
+// IRQ sources, the CPU's IRQ line is held low while any of them is set
+#define IRQ_SOURCE_MAPPER 0x01
+#define IRQ_SOURCE_FRAME_COUNTER 0x02
+#define IRQ_SOURCE_DMC 0x04
+
+#define MAPPER_SCANLINE_DOT 260
+
+#define SAVE_STATE_VERSION 4
+
+// Profiler subsystems, build with -DFE_PROFILE to be able to use --profile
+#define PROFILE_EMULATION 0 // everything emulateFrame() runs, the PPU included
+#define PROFILE_PPU 1
+#define PROFILE_PRESENT 2
+#define PROFILE_PACING 3
+#define PROFILE_SUBSYSTEMS 4
+
+#define TRACE_VERSION 1
+#define TRACE_RING_RECORDS (1 << 16) // a power of two
+
+// PPU pipeline log entry kinds, see ppu_log_entry_t
+#define PPU_LOG_WRITE 0 // register write, addr and value
+#define PPU_LOG_READ 1 // PPUSTATUS read, which clears VBlank and the write toggle
+#define PPU_LOG_OAM 2 // OAM DMA byte, addr is the OAM index
+#define PPU_LOG_CHR_PAGE 3 // pattern table slot addr now at CHR memory offset
+#define PPU_LOG_NAMETABLE_PAGE 4 // nametable slot addr now at ppuMem offset
+#define PPU_LOG_VBLANK 5
+#define PPU_LOG_FRAME_END 6
+#define PPU_LOG_SYNC 7 // only catches up, the CPU thread waits for it
+#define PPU_LOG_STOP 8
+#define PPU_LOG_ENTRIES (1 << 16) // a power of two, a frame rarely logs more than a few thousand
+#define PIPELINE_SPINS (1 << 16) // looks at the other thread this often before sleeping while waiting on it
+
+#define RASTER_MAX_THREADS 64
+#define RASTER_PARALLEL_LINES 16 // fewer scanlines than this are rasterized without waking the workers
+
+#define CPU_CLOCK_RATE 1789773.0 // Hz
+#define AUDIO_SAMPLE_RATE FE_AUDIO_SAMPLE_RATE
+#define AUDIO_SAMPLES_PER_CYCLE (AUDIO_SAMPLE_RATE / CPU_CLOCK_RATE)
+#define AUDIO_FRAME_SAMPLES 1024 // room for a frame's worth, about 800
+#define AUDIO_KERNEL_WIDTH 16 // samples a level change is spread over, the output lags by half of it
+#define AUDIO_KERNEL_PHASES 32 // fractions of a sample a level change can start at
+#define AUDIO_CUTOFF 0.45 // of the sample rate
+#define AUDIO_HIGH_PASS 0.995f // pole of the DC blocking filter
+
+#define MOVIE_VERSION 1
+#define MOVIE_OFF 0
+#define MOVIE_PLAY 1
+#define MOVIE_RECORD 2
+
+#define REWIND_KEYFRAME_INTERVAL 60
+#define REWIND_DEFAULT_SECONDS 10
+#define REWIND_DEFAULT_MEMORY (32 * 1024 * 1024)
+
+// PPUCTRL bits
+#define NMI_BIT 7
+#define BG_PATTERN_TABLE_BIT 4
+#define SPRITE_PATTERN_TABLE_BIT 3
+#define VRAM_INC_BIT 2
+
+// PPUMASK bits
+#define SHOW_BG_BIT 3
+#define SHOW_SPRITES_BIT 4
+
+// PPUSTATUS bits
+#define VBLANK_BIT 7
+#define SPRITE_0_HIT_BIT 6
+
+// Sprite attribute bits
+#define SPRITE_PRIORITY_BIT 5
+
+// Sprite line buffer entries
+#define SPRITE_LINE_COLOR 0x1F // palette RAM offset of the sprite pixel, 0 when transparent
+#define SPRITE_LINE_BEHIND_BG 0x20 // only drawn where the background pixel is transparent
+#define SPRITE_LINE_SPRITE_0 0x40
+
+typedef struct {
+    unsigned int coarseXScroll : 5;
+    unsigned int coarseYScroll : 5;
+    unsigned int nametableSelect : 2;
+    unsigned int fineYScroll : 3;
+    unsigned int exactAddr : 14; // this is a full memory address that's used by PPUADDR/PPUDATA; these bits should be distributed to the other fields as well
+} vram_addr_t;
+
+typedef struct {
+    vram_addr_t currentVRamAddr;
+    vram_addr_t tempVRamAddr;
+    unsigned int fineXScroll : 3;
+    unsigned int writeToggle : 1;
+    unsigned char tilePixels[8]; // color indices of the background tile row being drawn
+    unsigned char tilePalette; // palette RAM offset of the background tile being drawn
+    unsigned char pOAM[256];
+    unsigned char sOAM[32];
+    unsigned char spriteLine[SCREEN_WIDTH]; // sprite pixels of the current scanline, see SPRITE_LINE_*
+    unsigned char spritesOnLine;
+    unsigned char ctrl;
+    unsigned char mask;
+    unsigned char status;
+    unsigned char oamAddr;
+    unsigned char dataBuffer;
+    int scanline;
+    int renderX; // next pixel of the current scanline to be rendered
+    unsigned long long frameStart; // master clock time of the current frame's pre-render scanline
+} ppu_t;
+
+typedef struct emulator emulator_t;
+
+// CHR memory decoded into one 2-bit color index per pixel, one entry per 16-byte tile, decoded on
+// first use. Entries belong to CHR memory rather than pattern table slots, so bank switches keep them.
+typedef struct {
+    unsigned char (*pixels)[8][8]; // [tile][fine y][x]
+    unsigned char* valid;
+} tile_cache_t;
+
+// A ROM image mapped or copied into memory, PRG and CHR point straight into it
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    const unsigned char* prg;
+    const unsigned char* chr; // NULL when the cartridge uses CHR RAM
+    const unsigned char* trainer; // NULL when there is none
+    unsigned long long prgSize;
+    unsigned long long chrSize;
+    unsigned int prgRamSize;
+    unsigned int chrRamSize;
+    unsigned short mapper;
+    unsigned char submapper;
+    unsigned char mirroring; // see MIRRORING_*
+    unsigned char battery;
+    unsigned char nes2;
+    unsigned char mapped; // data is a file mapping rather than a copy
+} rom_t;
+
+// Registers of the cartridge's mapper, each mapper only uses the ones it needs
+typedef struct {
+    unsigned char shift; // MMC1 serial port
+    unsigned char shiftCount;
+    unsigned char control; // MMC1 control, MMC3 bank select
+    unsigned char banks[8]; // MMC1 CHR 0, CHR 1 and PRG, MMC3 R0-R7
+    unsigned char irqLatch;
+    unsigned char irqCounter;
+    unsigned char irqReload;
+    unsigned char irqEnabled;
+    int scanline; // next scanline to clock the mapper at dot 260
+    unsigned long long scanlineTime;
+} mapper_state_t;
+
+typedef struct {
+    unsigned short number;
+    const char* name;
+    void (*reset)(emulator_t* emu); // sets the registers' power-on values, NULL if they are all zero
+    void (*sync)(emulator_t* emu); // maps banks and mirroring as the registers select, after a reset or a state load
+    void (*write)(emulator_t* emu, unsigned short mem, unsigned char value); // CPU writes to $8000-$FFFF, NULL if it has no registers
+    void (*scanline)(emulator_t* emu); // clocked at dot 260 of rendered scanlines, NULL if it has no use for it
+} mapper_t;
+
+// Volume envelope of the pulse and noise channels
+typedef struct {
+    unsigned char start;
+    unsigned char loop; // also halts the length counter
+    unsigned char constant;
+    unsigned char volume; // doubles as the divider period
+    unsigned char divider;
+    unsigned char decay;
+} apu_envelope_t;
+
+typedef struct {
+    apu_envelope_t envelope;
+    unsigned char duty;
+    unsigned char step;
+    unsigned char length;
+    unsigned char sweepEnabled;
+    unsigned char sweepPeriod;
+    unsigned char sweepNegate;
+    unsigned char sweepShift;
+    unsigned char sweepReload;
+    unsigned char sweepDivider;
+    unsigned short period;
+    unsigned long long timer; // CPU cycle the sequencer is clocked at next
+} apu_pulse_t;
+
+typedef struct {
+    unsigned char control; // also halts the length counter
+    unsigned char linearPeriod;
+    unsigned char linearCounter;
+    unsigned char linearReload;
+    unsigned char length;
+    unsigned char step;
+    unsigned short period;
+    unsigned long long timer;
+} apu_triangle_t;
+
+typedef struct {
+    apu_envelope_t envelope;
+    unsigned char mode;
+    unsigned char length;
+    unsigned short shift;
+    unsigned short period; // CPU cycles
+    unsigned long long timer;
+} apu_noise_t;
+
+typedef struct {
+    unsigned char irqEnabled;
+    unsigned char loop;
+    unsigned char level;
+    unsigned char sampleBuffer;
+    unsigned char bufferFull;
+    unsigned char shift;
+    unsigned char bits;
+    unsigned char silence;
+    unsigned short period; // CPU cycles
+    unsigned short sampleAddress;
+    unsigned short sampleLength;
+    unsigned short address;
+    unsigned short remaining;
+    unsigned long long timer;
+} apu_dmc_t;
+
+// The 2A03's APU. It is not clocked along with the CPU but run in batches up to it whenever
+// something depends on its state, jumping from one timer or frame counter clock to the next.
+typedef struct {
+    apu_pulse_t pulse[2];
+    apu_triangle_t triangle;
+    apu_noise_t noise;
+    apu_dmc_t dmc;
+    unsigned char enabled; // channels enabled through $4015
+    unsigned char frameMode; // 0: four steps, 1: five steps
+    unsigned char irqInhibit;
+    unsigned char frameStep;
+    unsigned long long frameStart; // CPU cycle the frame counter sequence started at
+    unsigned long long nextFrameStep;
+    unsigned long long clock; // CPU cycles the APU has run to
+    float output; // of the mixer at clock, 0 to 1
+} apu_t;
+
+// Everything the emulated console changes while it runs, saved and loaded as a whole. Pointers
+// into it (bus pages, CHR and nametable slots) are derived and rebuilt after a load.
+typedef struct {
+    unsigned short pc;
+    unsigned char regA, regX, regY, regS;
+    unsigned char flags; // N and Z are not kept up to date here, use getFlags()/setFlags()
+    unsigned char lazyZeroResult; // Z is set when this is zero
+    unsigned char lazyNegativeResult; // N is bit 7 of this
+    unsigned char irqLines; // see IRQ_SOURCE_*
+    unsigned char cpuMem[CPU_RAM_SIZE];
+    unsigned char prgRam[PRG_RAM_SIZE];
+    unsigned char ppuMem[PPU_SIZE];
+    ppu_t ppu;
+    apu_t apu;
+    mapper_state_t mapper;
+    unsigned char mirroring; // nametable layout currently selected, see MIRRORING_*
+    unsigned char readNC1;
+    unsigned char readNC2;
+    unsigned short buttons;
+    unsigned long long instructionCount;
+    unsigned long long frameCount; // frames completed since power-on, indexes the input movie
+    unsigned long long masterClock;
+    unsigned long long eventTimes[EVENT_COUNT];
+    unsigned long long nextEventTime;
+    unsigned char frameComplete;
+} machine_t;
+
+// Precedes the machine state (and CHR RAM, if any) in a save state
+typedef struct {
+    char constant[4];
+    unsigned int version;
+    unsigned int machineSize; // catches builds with a different machine_t layout
+    unsigned int chrRamSize;
+    unsigned long long prgSize;
+    unsigned short mapper;
+} save_state_header_t;
+
+// A frame captured for rewinding, either a whole save state or an XOR delta against its keyframe
+typedef struct {
+    size_t offset; // into the arena
+    size_t size;
+    unsigned long long keyframe; // sequence number of its keyframe, its own for keyframes
+} rewind_frame_t;
+
+// The last frames, packed into a fixed-size arena that is written as a ring. Frames are evicted
+// oldest first, a keyframe together with all of its deltas.
+typedef struct {
+    unsigned char* arena;
+    size_t arenaSize;
+    size_t head; // where the next frame goes
+    rewind_frame_t* frames; // indexed by sequence number modulo capacity
+    unsigned long capacity; // frames kept at most
+    unsigned long keyframeInterval; // short enough that evicting a group never empties the buffer
+    unsigned long long oldest; // sequence number of the oldest frame kept
+    unsigned long long next; // sequence number of the next frame captured
+    size_t stateSize;
+    unsigned char* state; // scratch save state
+    unsigned char* delta; // scratch delta, big enough for the worst case
+} rewind_buffer_t;
+
+// Controller input of a run from power-on, one button word per frame
+typedef struct {
+    unsigned short* frames;
+    unsigned long length;
+    unsigned long capacity;
+    unsigned char mode; // see MOVIE_*
+} movie_t;
+
+// Precedes the input of a movie file, which is stored as runs of (16-bit frame count, 16-bit
+// button word), both little endian
+typedef struct {
+    char constant[4];
+    unsigned int version;
+    unsigned int frames;
+    unsigned int prgHash; // FNV-1a of PRG ROM, catches movies of a different ROM
+} movie_header_t;
+
+// Band-limited synthesis of the APU output. Every level change is added as a step spread over the
+// samples around it, the samples are summed up and read out once per frame.
+typedef struct {
+    float deltas[AUDIO_FRAME_SAMPLES + AUDIO_KERNEL_WIDTH];
+    double startClock; // CPU cycle deltas[0] is at
+    float level; // sum of the deltas read out so far
+    float lastLevel;
+    float highPass; // last output of the DC blocking filter
+    short samples[AUDIO_FRAME_SAMPLES]; // of the last frame, signed 16-bit mono at AUDIO_SAMPLE_RATE
+    unsigned int sampleCount;
+} audio_t;
+
+// Frames the PPU skips drawing, see setRenderSkip()
+typedef struct {
+    unsigned int skip; // frames skipped out of every
+    unsigned int every; // 0 draws every frame
+    unsigned char active; // the current frame is not drawn
+    unsigned char lineSkipped; // the current scanline is not drawn
+    unsigned long long skippedFrames;
+} render_skip_t;
+
+#ifdef FE_PROFILE
+// Where emulated and emulator time goes, per instance
+typedef struct {
+    unsigned long long pcCount[0x10000];
+    unsigned long long pcCycles[0x10000];
+    unsigned long long opcodeCount[256];
+    unsigned long long opcodeCycles[256];
+    unsigned long long time[PROFILE_SUBSYSTEMS]; // performance counter ticks
+    unsigned long long frames;
+} profile_t;
+#endif
+
+// One executed instruction, as the CPU was right before it
+typedef struct {
+    unsigned long long clock; // master clock
+    unsigned short pc;
+    unsigned char opcode;
+    unsigned char operand[2]; // the bytes after the opcode, whether the instruction uses them or not
+    unsigned char a, x, y, p, s;
+} trace_record_t;
+
+// Single producer, single consumer ring of trace records. The emulator only waits when it laps
+// the drain thread, which writes everything it is handed straight to the trace file.
+typedef struct {
+    trace_record_t* records;
+    unsigned long mask; // capacity - 1
+    unsigned long head; // next record to write, only advanced by the emulator
+    unsigned long cachedTail; // the emulator's last look at tail
+    unsigned long tail __attribute__((aligned(64))); // next record to drain, only advanced by the drain thread
+    unsigned char stop;
+    unsigned long long stalls; // times the emulator had to wait for the drain thread
+    FILE* file;
+    pthread_t thread;
+} trace_t;
+
+// Precedes the records of a trace file
+typedef struct {
+    char constant[4];
+    unsigned int version;
+    unsigned int recordSize; // catches builds with a different trace_record_t layout
+} trace_header_t;
+
+// Something the CPU did that rendering depends on, replayed by the render thread at the same master clock time
+typedef struct {
+    unsigned long long clock;
+    unsigned int offset; // see PPU_LOG_CHR_PAGE and PPU_LOG_NAMETABLE_PAGE
+    unsigned short addr;
+    unsigned char kind; // see PPU_LOG_*
+    unsigned char value;
+} ppu_log_entry_t;
+
+// Runs the PPU on a thread of its own, a frame behind the CPU. The render thread replays a log of
+// what the CPU thread did against a shadow emulator, whose PPU is the one that renders. The CPU
+// thread keeps what its reads depend on up to date itself and waits for the shadow to catch up
+// only when a read depends on rendering.
+typedef struct {
+    emulator_t* shadow;
+    ppu_log_entry_t* entries;
+    unsigned long mask; // capacity - 1
+    unsigned long head; // next entry to write, only advanced by the CPU thread
+    unsigned long cachedTail; // the CPU thread's last look at tail
+    unsigned long tail __attribute__((aligned(64))); // next entry to replay, only advanced by the render thread
+    unsigned long long rendered; // frames the render thread has finished, only advanced by it
+    unsigned char hitPossible; // sprite 0 was not at x = 0, where it is never drawn, at some point of the current frame
+    unsigned long long hitCheckedAt; // master clock time the shadow's sprite 0 hit was last looked at
+    unsigned long long syncs; // times the CPU thread waited for the render thread to catch up
+    unsigned int frames[2][SCREEN_WIDTH * SCREEN_HEIGHT]; // finished frames, by parity of their frame count
+    pthread_t thread;
+    unsigned char started; // the render thread is running
+} ppu_pipeline_t;
+
+// A scanline left to the parallel rasterizer: everything rendering it depends on that can change
+// from one scanline to the next, as it was when the scanline started
+typedef struct {
+    vram_addr_t vramAddr;
+    unsigned char ctrl;
+    unsigned char tilePixels[8]; // fetched at the end of the scanline before
+    unsigned char tilePalette;
+    unsigned char* chrPages[8];
+    unsigned int chrPageTiles[8];
+    unsigned char* nametablePages[4];
+} raster_line_t;
+
+typedef struct raster_pool raster_pool_t;
+
+// Renders scanlines into an emulator of its own, which shares the tile cache
+typedef struct {
+    raster_pool_t* pool;
+    emulator_t* scratch;
+    pthread_t thread; // worker 0 has none
+} raster_worker_t;
+
+// Whole scanlines the PPU catches up over only depend on the state they start with, so they are
+// recorded and rasterized side by side once the catch-up is through, instead of one after another.
+// The emulator's thread is worker 0 and renders alongside the rest.
+struct raster_pool {
+    emulator_t* emu;
+    raster_line_t lines[SCREEN_HEIGHT]; // by scanline
+    int from, to; // scanlines recorded and not rasterized yet
+    int next; // next scanline to be taken by a worker
+    int hit; // one of the scanlines had a sprite 0 hit
+    unsigned char stop;
+    int threads;
+    raster_worker_t workers[RASTER_MAX_THREADS];
+    sem_t start; // posted once per worker woken up
+    sem_t done; // posted by each worker when there is nothing left to take
+    unsigned long long jobs; // rasterizations that woke the workers
+    unsigned long long parallelLines;
+};
+
+// Where an observed emulator publishes its frames, see fe_observation_t
+typedef struct {
+    fe_observation_t* region;
+    unsigned char* draw; // the screen the PPU draws into, the one not published
+    char* name; // of the shared memory, NULL when the region is private
+} observer_t;
+
+typedef void (*compose_tile_t)(emulator_t* emu, unsigned int* out, const unsigned char* sprites);
+typedef unsigned char (*bus_read_handler_t)(emulator_t* emu, unsigned short mem);
+typedef void (*bus_write_handler_t)(emulator_t* emu, unsigned short mem, unsigned char value);
+
+// One emulated console: the machine, the cartridge in it and everything derived from the two.
+// Nothing the emulator runs on lives outside of it, so any number of them can run side by side.
+struct emulator {
+    machine_t machine;
+    rom_t cartridge;
+    const mapper_t* mapper;
+    unsigned char* chrRam;
+    tile_cache_t tileCache;
+    // CPU bus page tables, a NULL page is routed to the page's handler instead
+    unsigned char* readPages[256];
+    unsigned char* writePages[256];
+    bus_read_handler_t readHandlers[256];
+    bus_write_handler_t writeHandlers[256];
+    // PPU pattern table slots, 1kb each, pointing into CHR ROM or RAM
+    unsigned char* chrMem;
+    unsigned int chrMemSize;
+    unsigned char* chrPages[8];
+    unsigned int chrPageTiles[8]; // tile cache index of each slot's first tile
+    unsigned char chrWritable;
+    // PPU nametable slots, pointing into the nametable RAM at ppuMem[0x2000]
+    unsigned char* nametablePages[4];
+    rewind_buffer_t rewindBuffer;
+    movie_t movie;
+    trace_t* trace; // NULL unless tracing
+    ppu_pipeline_t* pipeline; // NULL unless the PPU runs on a thread of its own
+    raster_pool_t* raster; // NULL unless whole scanlines are rasterized in parallel
+    observer_t* observer; // NULL unless frames are published for feObserve()
+#ifdef FE_PROFILE
+    profile_t* profile; // NULL unless profiling
+#endif
+    audio_t audio;
+    render_skip_t renderSkip;
+    // Output of the PPU, one 0xRRGGBB pixel per dot, presented once per frame
+    unsigned int framebuffer[SCREEN_WIDTH * SCREEN_HEIGHT];
+    // Palette RAM resolved to RGB, kept in sync with palette writes
+    unsigned int paletteRGB[32] __attribute__((aligned(16)));
+    unsigned char paletteChannels[3][32] __attribute__((aligned(16))); // blue, green and red bytes of paletteRGB
+    unsigned char paletteColors[32]; // NES color index of each palette RAM entry
+};
+
+extern unsigned char overviewAfterInstruction;
+extern compose_tile_t composeTile;
+extern const char* composeTileName;
+extern const char trace_constant[];
+
+unsigned int xxh32(const void* data, size_t size, unsigned int seed);
+int startTrace(emulator_t* emu, const char* path);
+void stopTrace(emulator_t* emu);
+void* traceDrain(void* data);
+void waitForTraceSpace(trace_t* trace);
+int startPipeline(emulator_t* emu);
+void stopPipeline(emulator_t* emu);
+void seedPipeline(emulator_t* emu);
+void flushPipeline(emulator_t* emu);
+void syncPipeline(emulator_t* emu);
+void logPpu(emulator_t* emu, unsigned char kind, unsigned short addr, unsigned char value, unsigned int offset);
+void waitForPipelineSpace(ppu_pipeline_t* pipeline);
+void showPipelinedFrame(emulator_t* emu);
+unsigned char pipelinedRegisterRead(emulator_t* emu, unsigned short mem);
+void replayPpuLogEntry(ppu_pipeline_t* pipeline, const ppu_log_entry_t* entry);
+void* ppuPipelineThread(void* data);
+int startRasterPool(emulator_t* emu, int threads);
+void stopRasterPool(emulator_t* emu);
+void deferScanline(emulator_t* emu);
+void rasterizeDeferred(emulator_t* emu);
+void rasterizeScanlines(raster_worker_t* worker);
+void* rasterWorker(void* data);
+int startObserver(emulator_t* emu, const char* name);
+void stopObserver(emulator_t* emu);
+void publishObservation(emulator_t* emu);
+void observePixels(emulator_t* emu, int from, int to);
+void updateMovie(emulator_t* emu);
+int loadMovieFile(emulator_t* emu, const char* path);
+int saveMovieFile(emulator_t* emu, const char* path);
+void freeMovie(emulator_t* emu);
+unsigned int fnv1a(const void* data, size_t size);
+emulator_t* createEmulator();
+void destroyEmulator(emulator_t* emu);
+void emulateFrame(emulator_t* emu);
+void emulateCycles(emulator_t* emu, unsigned long long cycles);
+void scheduleEvent(emulator_t* emu, int event, unsigned long long time);
+void runDueEvents(emulator_t* emu);
+void resetScheduler(emulator_t* emu);
+unsigned long long ppuScanlineStart(emulator_t* emu, int scanline);
+void ppuVBlankEvent(emulator_t* emu);
+void ppuFrameEndEvent(emulator_t* emu);
+void ppuEnterVBlank(emulator_t* emu);
+void ppuStartFrame(emulator_t* emu);
+void mapperScanlineEvent(emulator_t* emu);
+void apuFrameEvent(emulator_t* emu);
+void ppuCatchUp(emulator_t* emu);
+void evaluateSprites(emulator_t* emu);
+void renderPixels(emulator_t* emu, int from, int to);
+int selectCompositor(const char* name);
+void composeTileScalar(emulator_t* emu, unsigned int* out, const unsigned char* sprites);
+#ifdef FE_X86_SIMD
+void composeTileSSSE3(emulator_t* emu, unsigned int* out, const unsigned char* sprites);
+void composeTileAVX2(emulator_t* emu, unsigned int* out, const unsigned char* sprites);
+#endif
+void resolvePalette(emulator_t* emu);
+void resolvePaletteEntry(emulator_t* emu, int index);
+void feErr(const char* message);
+void feROMErr(const char* message);
+void printBin(unsigned char c);
+uint64_t timestamp();
+uint64_t nanoTimestamp();
+void sleepMilliseconds(unsigned int ms);
+int cpuCount();
+int openROM(const char* path, rom_t* rom);
+int openROMImage(const void* data, size_t size, rom_t* rom);
+int parseROMHeader(rom_t* rom);
+unsigned long long nes2ROMSize(unsigned char lsb, unsigned char msb, unsigned int bankSize);
+void closeROM(rom_t* rom);
+int loadROM(emulator_t* emu, const char* path);
+int loadROMImage(emulator_t* emu, const void* data, size_t size);
+int insertCartridge(emulator_t* emu);
+void ejectCartridge(emulator_t* emu);
+int executeCurrentInstruction(emulator_t* emu);
+unsigned short readAddr(emulator_t* emu, unsigned short addr);
+void setFlag(emulator_t* emu, int bit);
+void clearFlag(emulator_t* emu, int bit);
+int flipFlag(emulator_t* emu, int bit);
+int isFlagSet(emulator_t* emu, int bit);
+unsigned char getFlags(emulator_t* emu);
+void setFlags(emulator_t* emu, unsigned char value);
+int isBitSet(unsigned char field, int bit);
+void setBit(unsigned char* field, int bit);
+void clearBit(unsigned char* field, int bit);
+void m6502pushStack(emulator_t* emu, unsigned char c);
+unsigned char m6502pullStack(emulator_t* emu);
+unsigned char loByte(unsigned short addr);
+unsigned char hiByte(unsigned short addr);
+unsigned short combineBytes(unsigned short lo, unsigned short hi);
+void m6502branch(emulator_t* emu);
+void m6502interrupt(emulator_t* emu, unsigned short addr);
+void m6502jmp(emulator_t* emu, unsigned short addr);
+void mapBusMemory(emulator_t* emu, int firstPage, int lastPage, unsigned char* mem, unsigned int size, int writable);
+void mapBusHandlers(emulator_t* emu, int firstPage, int lastPage, bus_read_handler_t read, bus_write_handler_t write);
+void initBus(emulator_t* emu);
+void mapPrgBank(emulator_t* emu, int firstPage, unsigned int size, int bank);
+void mapChrBank(emulator_t* emu, int firstPage, unsigned int size, int bank);
+void setMirroring(emulator_t* emu, int mirroring);
+void mapperRegisterWrite(emulator_t* emu, unsigned short mem, unsigned char value);
+void nromSync(emulator_t* emu);
+void mmc1Reset(emulator_t* emu);
+void mmc1Write(emulator_t* emu, unsigned short mem, unsigned char value);
+void mmc1UpdateBanks(emulator_t* emu);
+void uxromSync(emulator_t* emu);
+void uxromWrite(emulator_t* emu, unsigned short mem, unsigned char value);
+void cnromSync(emulator_t* emu);
+void cnromWrite(emulator_t* emu, unsigned short mem, unsigned char value);
+void mmc3Reset(emulator_t* emu);
+void mmc3Write(emulator_t* emu, unsigned short mem, unsigned char value);
+void mmc3UpdateBanks(emulator_t* emu);
+void mmc3MapBank(emulator_t* emu, int reg);
+void mmc3Scanline(emulator_t* emu);
+size_t saveStateSize(emulator_t* emu);
+long saveState(emulator_t* emu, unsigned char* buffer, size_t size);
+int loadState(emulator_t* emu, const unsigned char* buffer, size_t size);
+int saveStateFile(emulator_t* emu, const char* path);
+int loadStateFile(emulator_t* emu, const char* path);
+int initRewind(emulator_t* emu, unsigned long frames, size_t memory);
+void freeRewind(emulator_t* emu);
+void captureRewindFrame(emulator_t* emu);
+int rewindFrames(emulator_t* emu, unsigned long frames);
+void evictRewindKeyframe(emulator_t* emu);
+size_t encodeDelta(const unsigned char* base, const unsigned char* current, size_t size, unsigned char* out);
+void applyDelta(unsigned char* target, const unsigned char* delta, size_t size);
+unsigned char openBusRead(emulator_t* emu, unsigned short mem);
+void openBusWrite(emulator_t* emu, unsigned short mem, unsigned char value);
+unsigned char ppuRegisterRead(emulator_t* emu, unsigned short mem);
+void ppuRegisterWrite(emulator_t* emu, unsigned short mem, unsigned char value);
+unsigned char ioRegisterRead(emulator_t* emu, unsigned short mem);
+void ioRegisterWrite(emulator_t* emu, unsigned short mem, unsigned char value);
+void resetAPU(emulator_t* emu);
+void apuCatchUp(emulator_t* emu);
+void apuUpdateOutput(emulator_t* emu);
+float apuMix(apu_t* apu);
+unsigned char apuReadStatus(emulator_t* emu);
+void apuWrite(emulator_t* emu, unsigned short mem, unsigned char value);
+void apuFrameStep(emulator_t* emu);
+void apuQuarterFrame(apu_t* apu);
+void apuHalfFrame(apu_t* apu);
+void apuClockDmc(emulator_t* emu);
+void apuFetchDmcSample(emulator_t* emu);
+void setEnvelope(apu_envelope_t* envelope, unsigned char value);
+void clockEnvelope(apu_envelope_t* envelope);
+unsigned char envelopeVolume(apu_envelope_t* envelope);
+unsigned short pulseSweepTarget(apu_pulse_t* pulse, int channel);
+int isPulseAudible(apu_pulse_t* pulse, int channel);
+void initBandLimitedStep();
+void addAudioDelta(emulator_t* emu, unsigned long long clock, float delta);
+void apuEndFrame(emulator_t* emu);
+void resetAudio(emulator_t* emu);
+void initCore();
+int requireROM(const emulator_t* emu);
+void printEmulatorOverview(emulator_t* emu);
+void loadTwoTiles(emulator_t* emu);
+const unsigned char* tileRow(emulator_t* emu, int table, unsigned char tile, int fineY);
+void decodeTile(emulator_t* emu, unsigned int index);
+void invalidateTile(emulator_t* emu, unsigned short addr);
+void decodeAllTiles(emulator_t* emu);
+unsigned short inc5BitInt(unsigned short addr, int offset);
+void setRenderSkip(emulator_t* emu, unsigned int skip, unsigned int every);
+void requestFrame(emulator_t* emu);
+void updateRenderSkip(emulator_t* emu);
+int isSpriteZeroHitPossible(emulator_t* emu);
+void skipPixels(emulator_t* emu, int from, int to);
+
+#endif
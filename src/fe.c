@@ -1,400 +1,215 @@
 #include <SDL2/SDL.h>
-#include <sys/time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <dirent.h>
+#include "core.h"
 
-#define CPU_SIZE 0x10000
-#define PPU_SIZE 0x4000
-
-#define CPU_PRG_OFFSET 0x8000
-
-#define CPU_CYCLES_PER_FRAME 29781
-#define PPU_CYCLES_PER_FRAME 89342
-
-#define CPU_CYCLES_PER_SCANLINE 114
-#define PPU_CYCLES_PER_SCANLINE 340
-
-#define FRAME_LENGTH_US 16666
-#define SCANLINE_LENGTH_US 64
-
-#define SCANLINES 262
-#define PRERENDER_SCANLINE -1
-#define POSTRENDER_SCANLINE 240
-#define FIRST_VBLANK_SCANLINE 241
-
-#define SCREEN_WIDTH 256
-#define SCREEN_HEIGHT 240
-
-#define IMPL_SIZE 1
-#define IMM_SIZE 2
-#define IND_SIZE 2
-#define ZP_SIZE 2
-#define ABS_SIZE 3
-
-// Flags
-#define CARRY_FLAG 0
-#define ZERO_FLAG 1
-#define INTERRUPT_FLAG 2
-#define DECIMAL_FLAG 3
-#define BREAK_FLAG 4
-#define OVERFLOW_FLAG 6
-#define NEGATIVE_FLAG 7
-
-// PPU Registers
-#define PPUCTRL 0x2000
-#define PPUMASK 0x2001
-#define PPUSTATUS 0x2002
-#define OAMADDR 0x2003
-#define OAMDATA 0x2004
-#define PPUSCROLL 0x2005
-#define PPUADDR 0x2006
-#define PPUDATA 0x2007
-#define OAMDMA 0x4014
-
-// Controller Register
-#define CONTROLLER_1 0x4016
-#define CONTROLLER_2 0x4017
-
-// Controller Bindings
-#define C1_A 0
-#define C1_B 1
-#define C1_SELECT 2
-#define C1_START 3
-#define C1_UP 4
-#define C1_DOWN 5
-#define C1_LEFT 6
-#define C1_RIGHT 7
-
-#define C2_A 8
-#define C2_B 9
-#define C2_SELECT 10
-#define C2_START 11
-#define C2_UP 12
-#define C2_DOWN 13
-#define C2_LEFT 14
-#define C2_RIGHT 15
-
-// Vectors
-#define NMI_VECTOR 0xFFFA
-#define RESET_VECTOR 0xFFFC
-#define IRQ_VECTOR 0xFFFE
-
-// PPUCTRL bits
-#define NMI_BIT 7
-#define BG_PATTERN_TABLE_BIT 4
-#define SPRITE_PATTERN_TABLE_BIT 3
-#define VRAM_INC_BIT 2
-
-// PPUSTATUS bits
-#define VBLANK_BIT 7
-
-// Instruction Opcodes
-#define BRK 0x00
-#define ORA_X_IND 0x01
-#define ORA_ZP 0x05
-#define ASL_ZP 0x06
-#define PHP 0x08
-#define ORA_IMM 0x09
-#define ASL_A 0x0A
-#define ORA_ABS 0x0D
-#define ASL_ABS 0x0E
-#define BPL 0x10
-#define ORA_Y_IND 0x11
-#define ORA_ZP_X 0x15
-#define ASL_ZP_X 0x16
-#define CLC 0x18
-#define ORA_ABS_Y 0x19
-#define ORA_ABS_X 0x1D
-#define ASL_ABS_X 0x1E
-#define JSR 0x20
-#define AND_X_IND 0x21
-#define BIT_ZP 0x24
-#define AND_ZP 0x25
-#define ROL_ZP 0x26
-#define PLP 0x28
-#define AND_IMM 0x29
-#define ROL_A 0x2A
-#define BIT_ABS 0x2C
-#define AND_ABS 0x2D
-#define ROL_ABS 0x2E
-#define BMI 0x30
-#define AND_Y_IND 0x31
-#define AND_ZP_X 0x35
-#define ROL_ZP_X 0x36
-#define SEC 0x38
-#define AND_ABS_Y 0x39
-#define AND_ABS_X 0x3D
-#define ROL_ABS_X 0x3E
-#define RTI 0x40
-#define EOR_X_IND 0x41
-#define EOR_ZP 0x45
-#define LSR_ZP 0x46
-#define PHA 0x48
-#define EOR_IMM 0x49
-#define LSR_A 0x4A
-#define JMP_ABS 0x4C
-#define EOR_ABS 0x4D
-#define LSR_ABS 0x4E
-#define BVC 0x50
-#define EOR_Y_IND 0x51
-#define EOR_ZP_X 0x55
-#define LSR_ZP_X 0x56
-#define CLI 0x58
-#define EOR_ABS_Y 0x59
-#define EOR_ABS_X 0x5D
-#define LSR_ABS_X 0x5E
-#define RTS 0x60
-#define ADC_X_IND 0x61
-#define ADC_ZP 0x65
-#define ROR_ZP 0x66
-#define PLA 0x68
-#define ADC_IMM 0x69
-#define ROR_A 0x6A
-#define JMP_IND 0x6C
-#define ADC_ABS 0x6D
-#define ROR_ABS 0x6E
-#define BVS 0x70
-#define ADC_Y_IND 0x71
-#define ADC_ZP_X 0x75
-#define ROR_ZP_X 0x76
-#define SEI 0x78
-#define ADC_ABS_Y 0x79
-#define ADC_ABS_X 0x7D
-#define ROR_ABS_X 0x7E
-#define STA_X_IND 0x81
-#define STY_ZP 0x84
-#define STA_ZP 0x85
-#define STX_ZP 0x86
-#define DEY 0x88
-#define TXA 0x8A
-#define STY_ABS 0x8C
-#define STA_ABS 0x8D
-#define STX_ABS 0x8E
-#define BCC 0x90
-#define STA_Y_IND 0x91
-#define STY_ZP_X 0x94
-#define STA_ZP_X 0x95
-#define STX_ZP_Y 0x96
-#define TYA 0x98
-#define STA_ABS_Y 0x99
-#define TXS 0x9A
-#define STA_ABS_X 0x9D
-#define LDY_IMM 0xA0
-#define LDA_X_IND 0xA1
-#define LDX_IMM 0xA2
-#define LDY_ZP 0xA4
-#define LDA_ZP 0xA5
-#define LDX_ZP 0xA6
-#define TAY 0xA8
-#define LDA_IMM 0xA9
-#define TAX 0xAA
-#define LDY_ABS 0xAC
-#define LDA_ABS 0xAD
-#define LDX_ABS 0xAE
-#define BCS 0xB0
-#define LDA_Y_IND 0xB1
-#define LDY_ZP_X 0xB4
-#define LDA_ZP_X 0xB5
-#define LDX_ZP_Y 0xB6
-#define CLV 0xB8
-#define LDA_ABS_Y 0xB9
-#define TSX 0xBA
-#define LDY_ABS_X 0xBC
-#define LDA_ABS_X 0xBD
-#define LDX_ABS_Y 0xBE
-#define CPY_IMM 0xC0
-#define CMP_X_IND 0xC1
-#define CPY_ZP 0xC4
-#define CMP_ZP 0xC5
-#define DEC_ZP 0xC6
-#define INY 0xC8
-#define CMP_IMM 0xC9
-#define DEX 0xCA
-#define CPY_ABS 0xCC
-#define CMP_ABS 0xCD
-#define DEC_ABS 0xCE
-#define BNE 0xD0
-#define CMP_Y_IND 0xD1
-#define CMP_ZP_X 0xD5
-#define DEC_ZP_X 0xD6
-#define CLD 0xD8
-#define CMP_ABS_Y 0xD9
-#define CMP_ABS_X 0xDD
-#define DEC_ABS_X 0xDE
-#define CPX_IMM 0xE0
-#define SBC_X_IND 0xE1
-#define CPX_ZP 0xE4
-#define SBC_ZP 0xE5
-#define INC_ZP 0xE6
-#define INX 0xE8
-#define SBC_IMM 0xE9
-#define NOP 0xEA
-#define CPX_ABS 0xEC
-#define SBC_ABS 0xED
-#define INC_ABS 0xEE
-#define BEQ 0xF0
-#define SBC_Y_IND 0xF1
-#define SBC_ZP_X 0xF5
-#define INC_ZP_X 0xF6
-#define SED 0xF8
-#define SBC_ABS_Y 0xF9
-#define SBC_ABS_X 0xFD
-#define INC_ABS_X 0xFE
+#define FRAME_LENGTH_US 16639 // NTSC runs at 60.0988 frames per second
 
+// Front-end pacing, see paceFrame()
+#define PACING_SLEEP 0
+#define PACING_VSYNC 1
+#define PACING_AUDIO 2
+#define PACING_SPIN_US 1500 // left of a sleep to spin through, covers the scheduler's wake-up latency
+
+#define FRAME_LOG_VERSION 1
+
+#define AUDIO_RING_SAMPLES (1 << 14) // a power of two
+#define AUDIO_DEVICE_SAMPLES 512
+#define AUDIO_LATENCY_SAMPLES 2048 // queued for the device at most when audio paces the front-end
+
+// Precedes a frame log, which holds a (framebuffer hash, CPU RAM hash) pair of 32-bit little endian
+// xxHash32 values for every frame
+typedef struct {
+    char constant[4];
+    unsigned int version;
+    unsigned int frames;
+} frame_log_header_t;
+
+// Header of a 16-bit mono PCM WAV file, for --wav
+typedef struct {
+    char riff[4];
+    unsigned int riffSize;
+    char wave[4];
+    char fmt[4];
+    unsigned int fmtSize;
+    unsigned short format;
+    unsigned short channels;
+    unsigned int sampleRate;
+    unsigned int byteRate;
+    unsigned short blockAlign;
+    unsigned short bitsPerSample;
+    char data[4];
+    unsigned int dataSize;
+} wav_header_t;
+
+// Single producer, single consumer ring of samples from the emulator to the SDL audio callback
 typedef struct {
-    unsigned int coarseXScroll : 5;
-    unsigned int coarseYScroll : 5;
-    unsigned int nametableSelect : 2;
-    unsigned int fineYScroll : 3;
-    unsigned int exactAddr : 14; // this is a full memory address that's used by PPUADDR/PPUDATA; these bits should be distributed to the other fields as well
-} vram_addr_t;
+    short samples[AUDIO_RING_SAMPLES];
+    unsigned long head; // only advanced by the emulator
+    unsigned long tail __attribute__((aligned(64))); // only advanced by the audio callback
+    short last; // repeated when the emulator falls behind
+} audio_ring_t;
 
+// Frame time errors of the front-end, reported when it exits
+typedef struct {
+    float* errors; // microseconds off FRAME_LENGTH_US, one per frame shown
+    unsigned long count;
+    unsigned long capacity;
+    double total; // microseconds of all frames
+    Uint64 last; // performance counter when the last frame was shown
+} pacing_stats_t;
+
+// A ROM run for a number of frames by the batch runner, in an emulator of its own
+typedef struct {
+    const char* romPath;
+    const char* moviePath; // NULL runs without input
+    unsigned long frames;
+    int result;
+    unsigned int ramHash; // FNV-1a of CPU RAM after the last frame
+    unsigned int frameHash; // FNV-1a of the last frame
+    uint64_t took;
+} batch_session_t;
+
+// Sessions are handed out to the workers in order, each worker runs one at a time
 typedef struct {
-    vram_addr_t currentVRamAddr;
-    vram_addr_t tempVRamAddr;
-    unsigned int fineXScroll : 3;
-    unsigned int writeToggle : 1;
-    unsigned short patternShiftRHi;
-    unsigned short patternShiftRLo;
-    unsigned char paletteShiftRHi;
-    unsigned char paletteShiftRLo;
-    unsigned char pOAM[256];
-    unsigned char sOAM[32];
-    unsigned char spriteShiftRegs[8][2];
-    unsigned char spriteLatches[8];
-    unsigned char spriteCounters[8];
-} ppu_t;
-
-const unsigned char cycle_count_table[] = {
-    7, 6, 0, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6,
-    2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
-    6, 6, 0, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6,
-    2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
-    6, 6, 0, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6,
-    2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, 
-    6, 6, 0, 8, 3, 3, 5, 0, 4, 2, 2, 0, 5, 4, 6, 0,
-    2, 5, 0, 8, 4, 4, 6, 0, 2, 4, 2, 0, 0, 4, 7, 0,
-    2, 6, 0, 6, 3, 3, 3, 0, 2, 2, 2, 0, 4, 4, 4, 0,
-    2, 5, 0, 6, 4, 4, 4, 0, 2, 5, 2, 0, 0, 4, 0, 0,
-    2, 6, 0, 6, 3, 3, 3, 0, 2, 2, 2, 0, 4, 5, 4, 0,
-    2, 5, 0, 5, 4, 4, 4, 0, 2, 4, 2, 0, 4, 4, 4, 0,
-    2, 6, 0, 8, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,
-    2, 5, 0, 8, 4, 4, 6, 0, 2, 4, 2, 0, 0, 4, 7, 0,
-    2, 6, 0, 8, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,
-    2, 5, 0, 8, 4, 4, 6, 0, 2, 4, 2, 0, 0, 4, 7, 0
-};
-
-const unsigned int palette_to_rgb_table[] = {
-    0x545454, 0x001E74, 0x081090, 0x300088, 0x440064, 0x5C0030, 0x540400, 0x3C1800, 0x202A00, 0x083A00, 0x004000, 0x003C00, 0x00323C, 0x000000, 0x000000, 0x000000,
-    0x989698, 0x084CC4, 0x3032EC, 0x5C1EE4, 0x8814B0, 0xA01464, 0x982220, 0x783C00, 0x545A00, 0x287200, 0x087C00, 0x007628, 0x006678, 0x000000, 0x000000, 0x000000,
-    0xECEEEC, 0x4C9AEC, 0x787CEC, 0xB062EC, 0xE454EC, 0xEC58B4, 0xEC6A64, 0xD48820, 0xA0AA00, 0x74C400, 0x4CD020, 0x38CC6C, 0x38B4CC, 0x3C3C3C, 0x000000, 0x000000,
-    0xECEEEC, 0xA8CCEC, 0xBCBCEC, 0xD4B2EC, 0xECAEEC, 0xECAED4, 0xECB4B0, 0xE4C490, 0xCCD278, 0xB4DE78, 0xA8E290, 0x98E2B4, 0xA0D6E4, 0xA0A2A0, 0x000000, 0x000000
-};
-
-const char ines_constant[] = "NES\x1A";
-
-unsigned char* cpuMem, * ppuMem;
-ppu_t ppu = { { 0, 0, 0, 0 }, { 0, 0, 0, 0 }, 0, 0, 0, 0, 0, 0 };
-unsigned short pc = 0x0000;
-unsigned char regA, regX, regY, regS;
-unsigned char flags;
-
-unsigned char readNC1 = 0;
-unsigned char readNC2 = 0;
-
-unsigned long long instructionCount = 0;
-unsigned short cpuCyclesEmulated = 0;
-unsigned char overviewAfterInstruction = 0;
+    batch_session_t* sessions;
+    int count;
+    SDL_atomic_t next;
+} batch_t;
+
+const char frame_log_constant[] = "FEH\x1A";
+const char usage_message[] = "usage: FE [--headless <frames>] [--wav <file>] [--pacing <sleep|vsync|audio>] [--bench-opcodes <iterations>] [--bench-render <frames>] [--bench-load <directory>] [--bench-mapper <iterations>] [--bench-state <iterations>] [--bench-rewind <frames>] [--rewind <seconds>] [--rewind-memory <megabytes>] [--play <movie>] [--record <movie>] [--profile <json>] [--trace <file>] [--dump-trace <file>] [--golden <frame log>] [--record-golden] [--batch <file>] [--threads <count>] [--compositor <path>] [--pipeline] [--raster-threads <count>] [--render-skip <n>/<m>] [--observe <name>] <rom>";
+
 unsigned char emulationPaused = 0;
-unsigned short buttons = 0;
 
 unsigned char upscale = 3;
+unsigned char headless = 0;
+unsigned char pacingEnabled = 1;
+unsigned char pacingMode = PACING_AUDIO; // falls back to sleeping without an audio device
+unsigned long headlessFrames = 0;
+unsigned long opcodeBenchIterations = 0;
+unsigned long renderBenchFrames = 0;
+const char* loadBenchDirectory = NULL;
+unsigned long mapperBenchIterations = 0;
+unsigned long stateBenchIterations = 0;
+unsigned long rewindBenchFrames = 0;
+unsigned long rewindSeconds = REWIND_DEFAULT_SECONDS;
+size_t rewindMemory = REWIND_DEFAULT_MEMORY;
+const char* moviePlayPath = NULL;
+const char* movieRecordPath = NULL;
+const char* goldenLogPath = NULL;
+unsigned char goldenRecord = 0; // --golden writes the log instead of checking against it
+const char* wavPath = NULL;
+const char* profilePath = NULL;
+const char* tracePath = NULL;
+const char* traceDumpPath = NULL;
+const char* batchPath = NULL;
+int batchThreads = 0; // 0 uses one per CPU
+const char* compositorName = NULL; // NULL picks the best one the CPU supports
+unsigned char pipelineEnabled = 0;
+int rasterThreads = 0; // 0 renders every scanline as the PPU catches up over it
+unsigned int renderSkipFrames = 0;
+unsigned int renderSkipEvery = 0; // 0 draws every frame
+const char* observeName = NULL;
 
 Sint32 controllerBindings[16];
 
 SDL_Window* window = NULL;
-SDL_Surface* screenSurface = NULL;
+SDL_Renderer* renderer = NULL;
+SDL_Texture* screenTexture = NULL;
+SDL_AudioDeviceID audioDevice = 0; // 0 runs silent
+audio_ring_t audioRing;
+Uint64 frameDeadline = 0; // performance counter the current frame is due at
+pacing_stats_t pacingStats;
 
-int safeExit();
 void feInfo(const char* message);
-void feErr(const char* message);
-void feROMErr(const char* message);
-void printBin(unsigned char c);
-uint64_t timestamp();
-int loadROM(FILE* file);
-int executeCurrentInstruction();
-unsigned short readAddr(unsigned short addr);
-void setFlag(int bit);
-void clearFlag(int bit);
-int flipFlag(int bit);
-int isFlagSet(int bit);
-int isBitSet(unsigned char field, int bit);
-void setBit(unsigned char* field, int bit);
-void clearBit(unsigned char* field, int bit);
-void updateFlagConditionally(int condition, int bit);
-void updateNegativeFlag(unsigned char c);
-void updateZeroFlag(unsigned char c);
-void updateSignFlags(unsigned char c);
-void m6502pushStack(unsigned char c);
-unsigned char m6502pullStack();
-unsigned char loByte(unsigned short addr);
-unsigned char hiByte(unsigned short addr);
-unsigned short combineBytes(unsigned short lo, unsigned short hi);
-void m6502branch();
-void m6502interrupt(unsigned short addr);
-void m6502store(unsigned char* r, unsigned short mem, int sz);
-void m6502load_m(unsigned char* r, unsigned short mem, int sz);
-void m6502load_i(unsigned char* r, unsigned char i);
-void m6502cmp_m(unsigned char* r, unsigned short mem, int sz);
-void m6502cmp_i(unsigned char* r, unsigned char i);
-void printEmulatorOverview();
-void loadTwoTiles();
-unsigned short inc5BitInt(unsigned short addr, int offset);
-void updatePixel(int x, int y, int rgb);
-
-// Instructions
-
-void m6502asl_m(unsigned short mem, int sz);
-void m6502asl_a();
-void m6502lsr_m(unsigned short mem, int sz);
-void m6502lsr_a();
-void m6502ora_m(unsigned short mem, int sz);
-void m6502ora_i(unsigned char i);
-void m6502and_m(unsigned short mem, int sz);
-void m6502and_i(unsigned char i);
-void m6502eor_m(unsigned short mem, int sz);
-void m6502eor_i(unsigned char i);
-void m6502rol_m(unsigned short mem, int sz);
-void m6502rol_a();
-void m6502ror_m(unsigned short mem, int sz);
-void m6502ror_a();
-void m6502bit(unsigned short mem, int sz);
-void m6502adc_m(unsigned short mem, int sz);
-void m6502adc_i(unsigned char i);
-void m6502sbc_m(unsigned short mem, int sz);
-void m6502sbc_i(unsigned char i);
-void m6502jmp(unsigned short addr);
-void m6502inc(unsigned short mem, int sz);
-void m6502dec(unsigned short mem, int sz);
+int safeExit(emulator_t* emu, int code);
+int parseArguments(int argc, char* argv[], const char** romPath);
+int runHeadless(emulator_t* emu, unsigned long frames);
+int runGoldenCheck(emulator_t* emu, unsigned long frames, const char* path, int record);
+void writeWavHeader(FILE* file, unsigned long samples);
+void openAudio();
+void audioCallback(void* data, Uint8* stream, int length);
+void queueAudio(emulator_t* emu);
+void paceFrame(emulator_t* emu);
+void sleepUntil(Uint64 deadline);
+void recordFrameTime();
+void printPacingStats();
+int compareFloats(const void* a, const void* b);
+int runRenderBenchmark(emulator_t* emu, unsigned long frames);
+int runLoadBenchmark(const char* path);
+int runBatch(const char* path, int threads);
+int batchWorker(void* data);
+void runBatchSession(batch_session_t* session);
+int runMapperBenchmark(emulator_t* emu, unsigned long iterations);
+int runStateBenchmark(emulator_t* emu, unsigned long iterations);
+int runRewindBenchmark(emulator_t* emu, unsigned long frames, unsigned long seconds, size_t memory);
+int runOpcodeBenchmark(emulator_t* emu, unsigned long iterations);
+int dumpTrace(const char* path);
+#ifdef FE_PROFILE
+void printProfile(emulator_t* emu);
+int writeProfile(emulator_t* emu, const char* path);
+#endif
+void presentFrame(emulator_t* emu);
 
 int WinMain(int argc, char* argv[])
 {
-    regA = regX = regY = regS = flags = (unsigned char) 0;
-    // Create CPU and PPU memory
-    cpuMem = malloc(CPU_SIZE);
-    feInfo("Created emulated CPU memory");
-    ppuMem = malloc(PPU_SIZE);
-    feInfo("Created emulated PPU memory");
-
-    // Initialize PPU registers
-    cpuMem[PPUCTRL] = 0;
-    cpuMem[PPUMASK] = 0;
-    cpuMem[PPUSTATUS] = 0b10100000;
-    cpuMem[OAMADDR] = 0;
-    cpuMem[PPUSCROLL] = 0;
-    cpuMem[PPUADDR] = 0;
-    cpuMem[PPUDATA] = 0;
+    const char* romPath = NULL;
+    if (parseArguments(argc, argv, &romPath) == -1)
+        return -1;
+    if (traceDumpPath != NULL)
+        return dumpTrace(traceDumpPath);
+    if (romPath == NULL && !opcodeBenchIterations && loadBenchDirectory == NULL && batchPath == NULL)
+    {
+        feErr(usage_message);
+        return -1;
+    }
+    if (goldenLogPath != NULL && !headlessFrames)
+    {
+        feErr("--golden needs --headless <frames>");
+        return -1;
+    }
+    if (goldenRecord && goldenLogPath == NULL)
+    {
+        feErr("--record-golden needs --golden <frame log>");
+        return -1;
+    }
+    if (wavPath != NULL && !headlessFrames)
+    {
+        feErr("--wav needs --headless <frames>");
+        return -1;
+    }
+    if (pipelineEnabled && rasterThreads)
+    {
+        feErr("--pipeline and --raster-threads do not go together");
+        return -1;
+    }
+    if (observeName != NULL && (pipelineEnabled || rasterThreads))
+    {
+        feErr("--observe needs the PPU to render in line, without --pipeline or --raster-threads");
+        return -1;
+    }
+    if (selectCompositor(compositorName) == -1)
+        return -1;
+    char message[128];
+    snprintf(message, sizeof(message), "Using %s background compositor", composeTileName);
+    feInfo(message);
+    initBandLimitedStep();
+    if (loadBenchDirectory != NULL)
+        return runLoadBenchmark(loadBenchDirectory);
+    if (batchPath != NULL)
+        return runBatch(batchPath, batchThreads);
+
+    emulator_t* emu = createEmulator();
+    if (emu == NULL)
+    {
+        feErr("Could not allocate the emulator");
+        return -1;
+    }
+    if (opcodeBenchIterations)
+        return safeExit(emu, runOpcodeBenchmark(emu, opcodeBenchIterations));
 
     // Initialize (temporary) controller bindings
     controllerBindings[C1_A] = SDLK_z;
@@ -406,39 +221,83 @@ int WinMain(int argc, char* argv[])
     controllerBindings[C1_LEFT] = SDLK_LEFT;
     controllerBindings[C1_RIGHT] = SDLK_RIGHT;
 
-    FILE* file = fopen("dk.nes", "rb");
-    if (file == NULL)
-    {
-        feInfo("Could not find testing ROM");
-        return safeExit(0);
-    }
-    int rom = loadROM(file);
-    fclose(file);
-    if (rom == -1)
-        return safeExit(-1);
+    if (loadROM(emu, romPath) == -1)
+        return safeExit(emu, -1);
+    snprintf(message, sizeof(message), "Loaded ROM successfully (mapper %d, %s)", emu->mapper->number, emu->mapper->name);
+    feInfo(message);
+    if (moviePlayPath != NULL && loadMovieFile(emu, moviePlayPath) == -1)
+        return safeExit(emu, -1);
+    if (movieRecordPath != NULL)
+        emu->movie.mode = MOVIE_RECORD;
+    if (tracePath != NULL && startTrace(emu, tracePath) == -1)
+        return safeExit(emu, -1);
+#ifdef FE_PROFILE
+    if (profilePath != NULL)
+        emu->profile = calloc(1, sizeof(profile_t));
+#endif
+    char statePath[4096];
+    snprintf(statePath, sizeof(statePath), "%s.state", romPath);
+
+    resetScheduler(emu);
+    if (mapperBenchIterations)
+        return safeExit(emu, runMapperBenchmark(emu, mapperBenchIterations));
+    if (stateBenchIterations)
+        return safeExit(emu, runStateBenchmark(emu, stateBenchIterations));
+    if (rewindBenchFrames)
+        return safeExit(emu, runRewindBenchmark(emu, rewindBenchFrames, rewindSeconds, rewindMemory));
+    if (renderBenchFrames)
+        return safeExit(emu, runRenderBenchmark(emu, renderBenchFrames));
+    if (pipelineEnabled && startPipeline(emu) == -1)
+        return safeExit(emu, -1);
+    if (pipelineEnabled && cpuCount() < 2)
+        feInfo("Only one CPU, the PPU pipeline will be slower than rendering in line");
+    if (rasterThreads && startRasterPool(emu, rasterThreads) == -1)
+        return safeExit(emu, -1);
+    setRenderSkip(emu, renderSkipFrames, renderSkipEvery);
+    if (observeName != NULL && startObserver(emu, observeName) == -1)
+        return safeExit(emu, -1);
+    if (goldenLogPath != NULL)
+        return safeExit(emu, runGoldenCheck(emu, headlessFrames, goldenLogPath, goldenRecord));
+    if (headless)
+        return safeExit(emu, runHeadless(emu, headlessFrames));
 
     if (SDL_Init(SDL_INIT_VIDEO) < 0)
     {
         printf("SDL could not initialize! (%s)\n", SDL_GetError());
-        return safeExit(-1);
+        return safeExit(emu, -1);
     }
 
     window = SDL_CreateWindow("FE", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH * upscale, SCREEN_HEIGHT * upscale, SDL_WINDOW_SHOWN);
     if (window == NULL)
     {
         printf("Window could not be created! (%s)\n", SDL_GetError());
-        return safeExit(-1);
+        return safeExit(emu, -1);
+    }
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | (pacingMode == PACING_VSYNC ? SDL_RENDERER_PRESENTVSYNC : 0));
+    if (renderer == NULL)
+    {
+        printf("Renderer could not be created! (%s)\n", SDL_GetError());
+        return safeExit(emu, -1);
+    }
+    screenTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+    if (screenTexture == NULL)
+    {
+        printf("Screen texture could not be created! (%s)\n", SDL_GetError());
+        return safeExit(emu, -1);
     }
-    screenSurface = SDL_GetWindowSurface(window);
+    openAudio();
+    if (rewindSeconds && initRewind(emu, rewindSeconds * 60, rewindMemory) == -1)
+        return safeExit(emu, -1);
 
+    unsigned char rewinding = 0;
     for (SDL_Event e; e.type != SDL_QUIT; SDL_PollEvent(&e))
     {
         if (e.type == SDL_KEYDOWN)
         {
-            for (int i = 0; i < 16; i++)
+            for (int i = 0; i < 16 && emu->movie.mode != MOVIE_PLAY; i++) // a movie being played is the only input
             {
                 if (e.key.keysym.sym == controllerBindings[i])
-                    buttons |= (1 << i);
+                    emu->machine.buttons |= (1 << i);
             }
             switch (e.key.keysym.sym)
             {
@@ -448,7 +307,7 @@ int WinMain(int argc, char* argv[])
                     {
                         if ((addr & 0x0F) == 0x00)
                             printf("0x%04X | ", addr);
-                        printf("%02X ", ppuMem[addr]);
+                        printf("%02X ", emu->machine.ppuMem[addr]);
                         if ((addr & 0x0F) == 0x0F)
                             printf("\n");
                     }
@@ -461,26 +320,43 @@ int WinMain(int argc, char* argv[])
                     {
                         if ((addr & 0x0F) == 0x00)
                             printf("0x%04X | ", addr);
-                        printf("%02X ", cpuMem[addr]);
+                        printf("%02X ", emu->machine.cpuMem[addr]);
                         if ((addr & 0x0F) == 0x0F)
                             printf("\n");
                     }
                     printf("PPU Primary OAM:\n");
                     for (unsigned short addr = 0x00; addr < 0x100; addr++)
                     {
-                        printf("%02X ", ppu.pOAM[addr]);
+                        printf("%02X ", emu->machine.ppu.pOAM[addr]);
                         if ((addr & 0x0F) == 0x0F)
                             printf("\n");
                     }
                     printf("PPU Secondary OAM:\n");
                     for (unsigned short addr = 0x00; addr < 0x10; addr++)
                     {
-                        printf("%02X ", ppu.sOAM[addr]);
+                        printf("%02X ", emu->machine.ppu.sOAM[addr]);
                         if ((addr & 0x0F) == 0x0F)
                             printf("\n");
                     }
                     break;
                 }
+                case SDLK_F5: // save state next to the ROM
+                {
+                    if (saveStateFile(emu, statePath) == 0)
+                        feInfo("Saved state");
+                    break;
+                }
+                case SDLK_F7: // load state saved with F5
+                {
+                    if (loadStateFile(emu, statePath) == 0)
+                        feInfo("Loaded state");
+                    break;
+                }
+                case SDLK_BACKSPACE: // rewind while held
+                {
+                    rewinding = 1;
+                    break;
+                }
                 case SDLK_p: // pause/unpause emulation
                 {
                     emulationPaused = !emulationPaused;
@@ -494,1514 +370,1236 @@ int WinMain(int argc, char* argv[])
         }
         if (e.type == SDL_KEYUP)
         {
-            for (int i = 0; i < 16; i++)
+            for (int i = 0; i < 16 && emu->movie.mode != MOVIE_PLAY; i++)
             {
                 if (e.key.keysym.sym == controllerBindings[i])
-                    buttons &= ~(1 << i);
+                    emu->machine.buttons &= ~(1 << i);
             }
+            if (e.key.keysym.sym == SDLK_BACKSPACE)
+                rewinding = 0;
         }
         if (emulationPaused)
-            continue;
-        for (int s = -1; s < SCANLINES - 1; s++)
         {
-            uint64_t time = timestamp();
-            // CPU
-            while (cpuCyclesEmulated < CPU_CYCLES_PER_SCANLINE) // emulate CPU cycles for this scanline
-                executeCurrentInstruction();
-            cpuCyclesEmulated = 0;
-            // PPU
-            if (s >= FIRST_VBLANK_SCANLINE)
-                goto completion;
-            if (s == POSTRENDER_SCANLINE)
-            {
-                setBit(cpuMem + PPUSTATUS, VBLANK_BIT);
-                if (isBitSet(cpuMem[PPUCTRL], NMI_BIT)) // generate NMI?
-                    m6502interrupt(combineBytes(cpuMem[NMI_VECTOR], cpuMem[NMI_VECTOR + 1]));
-                goto completion;
-            }
-            if (s == PRERENDER_SCANLINE)
-            {
-                loadTwoTiles(); // load the first two tiles
-                clearBit(cpuMem + PPUSTATUS, VBLANK_BIT); // exit VBlank
-                goto completion;
-            }
-            // cycles 1-64 - secondary OAM clear
-            memset(ppu.sOAM, 0xFF, 32);
-            // cycles 65-256 - sprite register load
-            for (int i = 0, n = 0, y = (ppu.currentVRamAddr.coarseYScroll * 8) + ppu.currentVRamAddr.fineYScroll; i < 256; i += 4)
-            {
-                if (n >= 32) // 8 sprites found
-                    break;
-                unsigned char spriteY = ppu.pOAM[i];
-                // if current sprite is not on this scanline, continue
-                if (y < spriteY || y >= spriteY + 8)
-                    continue;
-                for (int j = 0; j < 4; j++) // copy sprite data into secondary OAM
-                    ppu.sOAM[n + j] = ppu.pOAM[i + j];
-                int startLine = y - spriteY;    
-                unsigned short patternTableAddr = (isBitSet(cpuMem[PPUCTRL], SPRITE_PATTERN_TABLE_BIT) ? 0x1000 : 0x0) + ((((unsigned short) ppu.pOAM[i + 1]) << 4) | startLine);
-                ppu.spriteShiftRegs[n / 4][0] = ppuMem[patternTableAddr + 8];
-                ppu.spriteShiftRegs[n / 4][1] = ppuMem[patternTableAddr];
-                ppu.spriteLatches[n / 4] = ppu.pOAM[i + 2];
-                ppu.spriteCounters[n / 4] = ppu.pOAM[i + 3];
-                n += 4;
-            }
-            // cycles 1-256 - BG rendering
-            unsigned char activeSprites = 0;
-            for (int t = 0; t < 0x20; t++)
-            {
-                for (int p = 0; p < 8; p++)
-                {
-                    // load pixels for the current shift registers
-                    int paletteIndex = ((ppu.paletteShiftRHi & 1) << 1) | (ppu.paletteShiftRLo & 1);
-                    int paletteColorIndex = ((ppu.patternShiftRHi & (1 << 7)) >> 6) | ((ppu.patternShiftRLo & (1 << 7)) >> 7);
-                    int rgb = palette_to_rgb_table[ppuMem[0x3F00 + (4 * paletteIndex) + paletteColorIndex]];
-                    for (int sn = 0; sn < 8; sn++)
-                    {
-                        if (activeSprites & (1 << sn))
-                        {
-                            int spritePaletteIndex = ppu.spriteLatches[sn] & 0b11;
-                            int spritePaletteColorIndex = ((ppu.spriteShiftRegs[sn][0] & (1 << 7)) >> 6) | ((ppu.spriteShiftRegs[sn][1] & (1 << 7)) >> 7);
-                            if (spritePaletteColorIndex != 0)
-                                rgb = palette_to_rgb_table[ppuMem[0x3F10 + (4 * spritePaletteIndex) + spritePaletteColorIndex]];
-                            ppu.spriteShiftRegs[sn][0] <<= 1;
-                            ppu.spriteShiftRegs[sn][1] <<= 1;
-                            if (ppu.spriteCounters[sn] == 0xF9)
-                                activeSprites &= ~(1 << sn);
-                        }
-                        if (--ppu.spriteCounters[sn] == 0)
-                            activeSprites |= (1 << sn);
-                    }
-                    updatePixel((t * 8) + p, s, rgb);
-                    ppu.paletteShiftRHi >>= 1;
-                    ppu.paletteShiftRLo >>= 1;
-                    ppu.patternShiftRHi <<= 1;
-                    ppu.patternShiftRLo <<= 1;
-                }
-                ppu.currentVRamAddr.coarseXScroll++;
-                loadTwoTiles();
-            }
-            if ((++ppu.currentVRamAddr.fineYScroll) == 0)
-                ppu.currentVRamAddr.coarseYScroll++;
-
-completion:
-            //uint64_t took = timestamp() - time;
-            //printf("Completed emulation for scanline %i in %li us! (%f%% of time used, %lli instructions executed total)\n", s, took, took / 0.64, instructionCount);
-            while (timestamp() - time < SCANLINE_LENGTH_US); // wait for alloted scanline time to finish (if needed)
+            SDL_Delay(FRAME_LENGTH_US / 1000);
+            frameDeadline = 0;
+            continue;
         }
-        SDL_UpdateWindowSurface(window);
+        // the framebuffer is not part of a save state, so rewinding goes back two frames and
+        // emulates one to have something to show
+        if (rewinding && rewindFrames(emu, 2) == -1)
+            rewinding = 0;
+        emulateFrame(emu);
+        if (audioDevice != 0)
+            queueAudio(emu);
+        if (pacingEnabled)
+            paceFrame(emu);
+        if (emu->rewindBuffer.arena != NULL)
+            captureRewindFrame(emu);
+        presentFrame(emu);
+        recordFrameTime();
     }
-    return safeExit(0);
+    return safeExit(emu, 0);
 }
 
-int safeExit(int code)
+#ifndef _WIN32
+int main(int argc, char* argv[])
 {
-    SDL_DestroyWindow(window);
-    SDL_Quit();
-    free(cpuMem);
-    feInfo("Emulated CPU memory has been freed");
-    free(ppuMem);
-    feInfo("Emulated PPU memory has been freed");
-    return code;
+    return WinMain(argc, argv);
 }
+#endif
+
 
-int loadROM(FILE* file)
+// Runs a fixed number of frames without SDL or pacing and reports emulation throughput, writing
+// the audio to a WAV file if asked to. With render skipping the same frames are run again drawing
+// every one of them, to compare.
+int runHeadless(emulator_t* emu, unsigned long frames)
 {
-    for (int i = 0; i < 4; i++)
+    FILE* wav = NULL;
+    unsigned long samples = 0;
+    if (wavPath != NULL)
     {
-        int c = fgetc(file);
-        if (c == EOF)
+        wav = fopen(wavPath, "wb");
+        if (wav == NULL)
         {
-            feROMErr("End of file");
+            feErr("Could not write WAV file");
             return -1;
         }
-        if (c != ines_constant[i])
-        {
-            feROMErr("iNES header constant is incorrect");
-            return -1;
-        }
-    }
-    int prgSize = fgetc(file);
-    if (prgSize == EOF)
-    {
-        feROMErr("End of file");
-        return -1;
-    }
-    if (prgSize != 1) // For now, only 16kb PRG
-    {
-        feROMErr("Unsupported PRG ROM size");
-        return -1;
-    }
-    int chrSize = fgetc(file);
-    if (chrSize == EOF)
-    {
-        feROMErr("End of file");
-        return -1;
+        writeWavHeader(wav, 0);
     }
-    if (chrSize != 1) // For now, only 8kb CHR
+    size_t stateSize = saveStateSize(emu);
+    unsigned char* state = emu->renderSkip.every ? malloc(stateSize) : NULL;
+    if (state != NULL)
+        saveState(emu, state, stateSize);
+    unsigned long long startInstructions = emu->machine.instructionCount;
+    unsigned long long startSkipped = emu->renderSkip.skippedFrames;
+    uint64_t start = timestamp();
+    for (unsigned long f = 0; f < frames; f++)
     {
-        feROMErr("Unsupported CHR ROM size");
-        return -1;
+        emulateFrame(emu);
+        if (wav != NULL)
+            samples += fwrite(emu->audio.samples, sizeof(short), emu->audio.sampleCount, wav);
     }
-    int flag6 = fgetc(file);
-    if (flag6 == EOF)
+    if (emu->pipeline != NULL)
+        flushPipeline(emu);
+    uint64_t took = timestamp() - start;
+    if (wav != NULL)
     {
-        feROMErr("End of file");
-        return -1;
+        fseek(wav, 0, SEEK_SET);
+        writeWavHeader(wav, samples);
+        fclose(wav);
+        feInfo("Wrote WAV file");
     }
-    if (flag6 > 1)
+    double seconds = took > 0 ? took / 1000000.0 : 1e-6;
+    unsigned long long instructions = emu->machine.instructionCount - startInstructions;
+    printf("FE: bench: %lu frames in %.3f s\n", frames, seconds);
+    printf("FE: bench: %.1f frames/s (%.2fx real time)\n", frames / seconds, frames / seconds / 60.0);
+    printf("FE: bench: %llu instructions, %.2f M instructions/s\n", instructions, instructions / seconds / 1000000.0);
+    if (emu->pipeline != NULL)
+        printf("FE: bench: waited for the render thread %llu times\n", emu->pipeline->syncs);
+    if (emu->raster != NULL)
+        printf("FE: bench: %llu scanlines rasterized on %d threads, %.1f per frame in %.1f jobs\n", emu->raster->parallelLines, emu->raster->threads, emu->raster->parallelLines / (double) frames, emu->raster->jobs / (double) frames);
+    if (state != NULL)
     {
-        feROMErr("Unsupported format");
-        return -1;
+        unsigned long long skipped = emu->renderSkip.skippedFrames - startSkipped;
+        unsigned int ramHash = fnv1a(emu->machine.cpuMem, CPU_RAM_SIZE);
+        loadState(emu, state, stateSize);
+        free(state);
+        setRenderSkip(emu, 0, 0);
+        start = timestamp();
+        for (unsigned long f = 0; f < frames; f++)
+            emulateFrame(emu);
+        if (emu->pipeline != NULL)
+            flushPipeline(emu);
+        uint64_t drawnTook = timestamp() - start;
+        printf("FE: bench: skipped drawing %llu of %lu frames, %.2fx the speed of drawing all of them\n", skipped, frames, drawnTook / (double) (took > 0 ? took : 1));
+        printf("FE: bench: CPU RAM %s drawing all of them\n", fnv1a(emu->machine.cpuMem, CPU_RAM_SIZE) == ramHash ? "matches" : "differs from");
     }
-    for (int i = 7; i <= 15; i++) // skip bytes 6-15
+    return 0;
+}
+
+void writeWavHeader(FILE* file, unsigned long samples)
+{
+    wav_header_t header;
+    memcpy(header.riff, "RIFF", 4);
+    header.riffSize = sizeof(wav_header_t) - 8 + samples * sizeof(short);
+    memcpy(header.wave, "WAVE", 4);
+    memcpy(header.fmt, "fmt ", 4);
+    header.fmtSize = 16;
+    header.format = 1; // PCM
+    header.channels = 1;
+    header.sampleRate = AUDIO_SAMPLE_RATE;
+    header.byteRate = AUDIO_SAMPLE_RATE * sizeof(short);
+    header.blockAlign = sizeof(short);
+    header.bitsPerSample = 16;
+    memcpy(header.data, "data", 4);
+    header.dataSize = samples * sizeof(short);
+    fwrite(&header, sizeof(wav_header_t), 1, file);
+}
+
+// Runs headless and checks the hashes of every frame and of CPU RAM after it against a golden frame
+// log, stopping at the first frame that differs. With record, the log is written instead.
+int runGoldenCheck(emulator_t* emu, unsigned long frames, const char* path, int record)
+{
+    frame_log_header_t header;
+    FILE* golden = NULL;
+    FILE* log = NULL;
+    if (!record)
     {
-        int c = fgetc(file);
-        if (c == EOF)
+        golden = fopen(path, "rb");
+        if (golden == NULL)
+        {
+            feErr("Could not open frame log, --record-golden records one");
+            return -1;
+        }
+        if (fread(&header, sizeof(frame_log_header_t), 1, golden) != 1 || memcmp(header.constant, frame_log_constant, 4) != 0 || header.version != FRAME_LOG_VERSION)
         {
-            feROMErr("End of file");
+            fclose(golden);
+            feErr("Not a frame log of this version");
             return -1;
         }
-        if (c != 0)
+        if (header.frames != frames)
         {
-            feROMErr("Unsupported format");
+            fclose(golden);
+            printf("FE: golden: %s has %u frames, not %lu\n", path, header.frames, frames);
             return -1;
         }
     }
-    // Copy PRG data into emulated CPU memory
-    for (int i = 0; i < prgSize * 0x4000; i++)
+    else
     {
-        int c = fgetc(file);
-        if (c == EOF)
+        log = fopen(path, "wb");
+        if (log == NULL)
         {
-            feROMErr("End of file");
+            feErr("Could not write frame log");
             return -1;
         }
-        cpuMem[i + CPU_PRG_OFFSET] = (unsigned char) c;
-        if (prgSize == 1) // mirror it for 16kb PRG
-            cpuMem[i + 0x4000 + CPU_PRG_OFFSET] = (unsigned char) c;
+        memset(&header, 0, sizeof(frame_log_header_t));
+        memcpy(header.constant, frame_log_constant, 4);
+        header.version = FRAME_LOG_VERSION;
+        header.frames = frames;
+        fwrite(&header, sizeof(frame_log_header_t), 1, log);
+    }
+    int result = 0;
+    uint64_t hashTook = 0;
+    uint64_t start = timestamp();
+    unsigned long f = 0;
+    for (; f < frames && result == 0; f++)
+    {
+        emulateFrame(emu);
+        if (emu->pipeline != NULL) // the framebuffer would be a frame behind
+            flushPipeline(emu);
+        uint64_t hashStart = timestamp();
+        unsigned int frameHash = xxh32(emu->framebuffer, sizeof(emu->framebuffer), 0);
+        unsigned int ramHash = xxh32(emu->machine.cpuMem, CPU_RAM_SIZE, 0);
+        hashTook += timestamp() - hashStart;
+        unsigned char entry[8] = {
+            frameHash, frameHash >> 8, frameHash >> 16, frameHash >> 24,
+            ramHash, ramHash >> 8, ramHash >> 16, ramHash >> 24
+        };
+        if (log != NULL)
+        {
+            if (fwrite(entry, 8, 1, log) != 1)
+                result = -1;
+            continue;
+        }
+        unsigned char expected[8];
+        if (fread(expected, 8, 1, golden) != 1)
+        {
+            feErr("Frame log is truncated");
+            result = -1;
+        }
+        else if (memcmp(entry, expected, 8) != 0)
+        {
+            int frameDiffers = memcmp(entry, expected, 4) != 0;
+            int ramDiffers = memcmp(entry + 4, expected + 4, 4) != 0;
+            printf("FE: golden: first divergence at frame %lu of %lu (%s%s%s)\n", f, frames, frameDiffers ? "framebuffer" : "", frameDiffers && ramDiffers ? " and " : "", ramDiffers ? "CPU RAM" : "");
+            result = -1;
+        }
     }
-    // Load Reset address from vector
-    pc = combineBytes(cpuMem[CPU_PRG_OFFSET - 0x10 + 0xC + (0x4000 * prgSize)], cpuMem[CPU_PRG_OFFSET - 0x10 + 0xD + (0x4000 * prgSize)]);
-    // Copy CHR data into emulated PPU memory
-    for (int i = 0; i < chrSize * 0x2000; i++)
+    uint64_t took = timestamp() - start;
+    if (log != NULL)
     {
-        int c = fgetc(file);
-        if (c == EOF)
+        if (fclose(log) != 0 || result == -1)
         {
-            feROMErr("End of file");
+            feErr("Could not write frame log");
             return -1;
         }
-        ppuMem[i] = (unsigned char) c;
+        printf("FE: golden: recorded %lu frames to %s\n", frames, path);
+    }
+    else
+    {
+        fclose(golden);
+        if (result == 0)
+            printf("FE: golden: %lu frames match %s\n", frames, path);
+    }
+    double seconds = took > 0 ? took / 1000000.0 : 1e-6;
+    printf("FE: bench: %.1f frames/s, hashing %.1f us/frame\n", f / seconds, f ? hashTook / (double) f : 0.0);
+    return result;
+}
+
+// Runs the game for a second so there is something on screen, then times composing the same
+// frame over and over with the CPU out of the picture
+int runRenderBenchmark(emulator_t* emu, unsigned long frames)
+{
+    for (int f = 0; f < 60; f++)
+        emulateFrame(emu);
+    vram_addr_t startVRamAddr = emu->machine.ppu.currentVRamAddr;
+    unsigned long long frameClock = emu->machine.masterClock;
+    emu->machine.masterClock = ppuScanlineStart(emu, POSTRENDER_SCANLINE);
+    uint64_t start = timestamp();
+    for (unsigned long f = 0; f < frames; f++)
+    {
+        emu->machine.ppu.currentVRamAddr = startVRamAddr;
+        emu->machine.ppu.scanline = PRERENDER_SCANLINE;
+        emu->machine.ppu.renderX = 0;
+        ppuCatchUp(emu);
     }
-    // PlayChoice data discarded
-    feInfo("Loaded ROM successfully");
+    uint64_t took = timestamp() - start;
+    emu->machine.masterClock = frameClock;
+    double seconds = took > 0 ? took / 1000000.0 : 1e-6;
+    printf("FE: bench: composed %lu frames in %.3f s\n", frames, seconds);
+    printf("FE: bench: %.1f us/frame, %.1f frames/s\n", seconds * 1000000.0 / frames, frames / seconds);
     return 0;
 }
 
-int executeCurrentInstruction()
+// Opens and parses every .nes file in a directory, the images are mapped but never attached to the bus
+int runLoadBenchmark(const char* path)
 {
-    unsigned char opcode = cpuMem[pc];
-    cpuCyclesEmulated += cycle_count_table[opcode];
-    //printf("Executing instruction with opcode $%x (pc: $%x)\n", opcode, pc);
-    switch (opcode)
+    DIR* dir = opendir(path);
+    if (dir == NULL)
+    {
+        feErr("Could not open ROM directory");
+        return -1;
+    }
+    unsigned long loaded = 0, failed = 0;
+    unsigned long long bytes = 0;
+    uint64_t took = 0;
+    char file[4096];
+    for (struct dirent* entry; (entry = readdir(dir)) != NULL;)
     {
-        case BRK: // What the hell does this do????
+        size_t length = strlen(entry->d_name);
+        if (length < 4 || (strcmp(entry->d_name + length - 4, ".nes") != 0 && strcmp(entry->d_name + length - 4, ".NES") != 0))
+            continue;
+        snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+        rom_t rom;
+        uint64_t start = timestamp();
+        if (openROM(file, &rom) == 0)
         {
-            pc++;
-            break;
+            loaded++;
+            bytes += rom.prgSize + rom.chrSize;
+            closeROM(&rom);
         }
-        case ORA_X_IND:
+        else
+            failed++;
+        took += timestamp() - start;
+    }
+    closedir(dir);
+    double seconds = took > 0 ? took / 1000000.0 : 1e-6;
+    printf("FE: bench: loaded %lu ROMs (%lu failed) in %.3f s\n", loaded, failed, seconds);
+    printf("FE: bench: %.1f us/ROM, %.1f MB of PRG and CHR\n", loaded + failed ? took / (double) (loaded + failed) : 0.0, bytes / 1000000.0);
+    return 0;
+}
+
+// Runs the sessions of a batch file, one "<rom> <frames> [<movie>]" per line, on a pool of worker threads.
+// Every session runs in an emulator of its own, the workers share nothing but the queue.
+int runBatch(const char* path, int threads)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        feErr("Could not open batch file");
+        return -1;
+    }
+    int count = 0, capacity = 16;
+    batch_session_t* sessions = malloc(capacity * sizeof(batch_session_t));
+    char line[8192 + 32], rom[4096], movie[4096];
+    unsigned long frames;
+    int result = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char* start = line + strspn(line, " \t\r\n");
+        if (*start == '\0' || *start == '#') // blank lines and comments
+            continue;
+        int fields = sscanf(start, "%4095s %lu %4095s", rom, &frames, movie);
+        if (fields < 2 || frames == 0)
         {
-            m6502ora_m(readAddr(regX + cpuMem[pc + 1]), IND_SIZE);
+            feErr("Batch file lines must be \"<rom> <frames> [<movie>]\"");
+            result = -1;
             break;
         }
-        case ORA_ZP:
+        if (count == capacity)
+            sessions = realloc(sessions, (capacity *= 2) * sizeof(batch_session_t));
+        memset(&sessions[count], 0, sizeof(batch_session_t));
+        sessions[count].romPath = strdup(rom);
+        sessions[count].moviePath = fields == 3 ? strdup(movie) : NULL;
+        sessions[count].frames = frames;
+        count++;
+    }
+    fclose(file);
+    if (result == 0 && count == 0)
+    {
+        feErr("Batch file has no sessions");
+        result = -1;
+    }
+    if (result == -1)
+    {
+        for (int i = 0; i < count; i++)
         {
-            m6502ora_m(cpuMem[pc + 1], ZP_SIZE);
-            break;
+            free((char*) sessions[i].romPath);
+            free((char*) sessions[i].moviePath);
         }
-        case ASL_ZP:
+        free(sessions);
+        return -1;
+    }
+    if (threads <= 0)
+        threads = SDL_GetCPUCount();
+    if (threads > count)
+        threads = count;
+
+    // this thread is the last worker, so a pool that fails to start still gets through the batch
+    batch_t batch = { sessions, count };
+    SDL_AtomicSet(&batch.next, 0);
+    SDL_Thread** workers = calloc(threads, sizeof(SDL_Thread*));
+    uint64_t start = timestamp();
+    for (int i = 1; i < threads; i++)
+        workers[i] = SDL_CreateThread(batchWorker, "FE batch worker", &batch);
+    batchWorker(&batch);
+    for (int i = 1; i < threads; i++)
+        SDL_WaitThread(workers[i], NULL);
+    uint64_t took = timestamp() - start;
+    free(workers);
+
+    unsigned long long totalFrames = 0;
+    for (int i = 0; i < count; i++)
+    {
+        batch_session_t* session = &sessions[i];
+        if (session->result == 0)
         {
-            m6502asl_m(cpuMem[pc + 1], ZP_SIZE);
-            break;
+            printf("FE: batch: %s: %lu frames in %.3f s, ram %08x, frame %08x\n", session->romPath, session->frames, session->took / 1000000.0, session->ramHash, session->frameHash);
+            totalFrames += session->frames;
         }
-        case PHP:
+        else
         {
-            m6502pushStack(flags | (1 << BREAK_FLAG));
-            pc++;
-            break;
+            printf("FE: batch: %s: failed\n", session->romPath);
+            result = -1;
         }
-        case ORA_IMM:
+        free((char*) session->romPath);
+        free((char*) session->moviePath);
+    }
+    free(sessions);
+    double seconds = took > 0 ? took / 1000000.0 : 1e-6;
+    printf("FE: bench: %d sessions, %llu frames on %d threads in %.3f s\n", count, totalFrames, threads, seconds);
+    printf("FE: bench: %.1f frames/s\n", totalFrames / seconds);
+    return result;
+}
+
+int batchWorker(void* data)
+{
+    batch_t* batch = data;
+    for (int i; (i = SDL_AtomicAdd(&batch->next, 1)) < batch->count;)
+        runBatchSession(&batch->sessions[i]);
+    return 0;
+}
+
+void runBatchSession(batch_session_t* session)
+{
+    uint64_t start = timestamp();
+    emulator_t* emu = createEmulator();
+    session->result = emu != NULL && loadROM(emu, session->romPath) == 0 ? 0 : -1;
+    if (session->result == 0 && session->moviePath != NULL)
+        session->result = loadMovieFile(emu, session->moviePath);
+    if (session->result == 0)
+        resetScheduler(emu);
+    if (session->result == 0 && pipelineEnabled)
+        session->result = startPipeline(emu);
+    if (session->result == 0 && rasterThreads)
+        session->result = startRasterPool(emu, rasterThreads);
+    if (session->result == 0)
+        setRenderSkip(emu, renderSkipFrames, renderSkipEvery);
+    if (session->result == 0)
+    {
+        for (unsigned long f = 0; f < session->frames; f++)
+            emulateFrame(emu);
+        if (emu->pipeline != NULL)
+            flushPipeline(emu);
+        session->ramHash = fnv1a(emu->machine.cpuMem, CPU_RAM_SIZE);
+        session->frameHash = fnv1a(emu->framebuffer, sizeof(emu->framebuffer));
+    }
+    if (emu != NULL)
+        destroyEmulator(emu);
+    session->took = timestamp() - start;
+}
+
+// Times bank switches made through the loaded mapper's registers the way a game makes them, then
+// the bare PRG and CHR switch primitives underneath
+int runMapperBenchmark(emulator_t* emu, unsigned long iterations)
+{
+    if (emu->mapper->write == NULL)
+    {
+        feErr("The ROM's mapper has no bank registers to benchmark");
+        return -1;
+    }
+    uint64_t start = timestamp();
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        switch (emu->mapper->number)
         {
-            m6502ora_i(cpuMem[pc + 1]);
-            break;
+            case 1: // PRG register, one bit per write
+                for (int b = 0; b < 5; b++)
+                    feWrite(emu, 0xE000, (i >> b) & 1);
+                break;
+            case 4: // cycles through R0-R7
+                feWrite(emu, 0x8000, i & 0b111);
+                feWrite(emu, 0x8001, i >> 3);
+                break;
+            default:
+                feWrite(emu, 0x8000, i);
         }
-        case ASL_A:
-        {
-            m6502asl_a();
-            break;
+    }
+    uint64_t registerTook = timestamp() - start;
+    start = timestamp();
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        mapPrgBank(emu, 0x80, 0x2000, i);
+        mapChrBank(emu, 0, CHR_PAGE_SIZE, i);
+    }
+    uint64_t primitiveTook = timestamp() - start;
+    printf("FE: bench: %s register bank switch: %.1f ns\n", emu->mapper->name, registerTook * 1000.0 / iterations);
+    printf("FE: bench: 8kb PRG + 1kb CHR switch: %.1f ns\n", primitiveTook * 1000.0 / iterations);
+    return 0;
+}
+
+// Times a snapshot taken and restored every frame, then checks that running on from a restored
+// snapshot matches the first run from it exactly
+int runStateBenchmark(emulator_t* emu, unsigned long iterations)
+{
+    for (int f = 0; f < 60; f++)
+        emulateFrame(emu);
+    size_t size = saveStateSize(emu);
+    unsigned char* snapshot = malloc(size);
+    uint64_t start = timestamp();
+    for (unsigned long i = 0; i < iterations; i++)
+        saveState(emu, snapshot, size);
+    uint64_t saveTook = timestamp() - start;
+    start = timestamp();
+    for (unsigned long i = 0; i < iterations; i++)
+        loadState(emu, snapshot, size);
+    uint64_t loadTook = timestamp() - start;
+
+    machine_t* firstRun = malloc(sizeof(machine_t));
+    unsigned int* firstFrame = malloc(sizeof(emu->framebuffer));
+    for (int f = 0; f < 60; f++)
+        emulateFrame(emu);
+    memcpy(firstRun, &emu->machine, sizeof(machine_t));
+    memcpy(firstFrame, emu->framebuffer, sizeof(emu->framebuffer));
+    loadState(emu, snapshot, size);
+    for (int f = 0; f < 60; f++)
+        emulateFrame(emu);
+    int deterministic = memcmp(firstRun, &emu->machine, sizeof(machine_t)) == 0 && memcmp(firstFrame, emu->framebuffer, sizeof(emu->framebuffer)) == 0;
+    free(firstRun);
+    free(firstFrame);
+    free(snapshot);
+
+    printf("FE: bench: %lu byte snapshot\n", (unsigned long) size);
+    printf("FE: bench: save %.2f us, load %.2f us\n", saveTook / (double) iterations, loadTook / (double) iterations);
+    printf("FE: bench: 60 frames replayed from a snapshot %s\n", deterministic ? "match the first run" : "DIVERGE from the first run");
+    return deterministic ? 0 : -1;
+}
+
+// Captures every frame of a run and reports the memory and time it takes, then rewinds half a
+// second and checks that the state matches the one saved at that frame
+int runRewindBenchmark(emulator_t* emu, unsigned long frames, unsigned long seconds, size_t memory)
+{
+    if (initRewind(emu, seconds * 60, memory) == -1)
+        return -1;
+    unsigned char* expected = malloc(emu->rewindBuffer.stateSize);
+    unsigned long long deltaBytes = 0, deltas = 0;
+    uint64_t captureTook = 0;
+    for (unsigned long f = 0; f < frames; f++)
+    {
+        emulateFrame(emu);
+        uint64_t start = timestamp();
+        captureRewindFrame(emu);
+        captureTook += timestamp() - start;
+        rewind_frame_t* frame = &emu->rewindBuffer.frames[(emu->rewindBuffer.next - 1) % emu->rewindBuffer.capacity];
+        if (frame->keyframe != emu->rewindBuffer.next - 1)
+        {
+            deltaBytes += frame->size;
+            deltas++;
+        }
+        if (f + 30 == frames - 1)
+            saveState(emu, expected, emu->rewindBuffer.stateSize);
+    }
+    unsigned long long held = emu->rewindBuffer.next - emu->rewindBuffer.oldest;
+    size_t used = 0;
+    for (unsigned long long f = emu->rewindBuffer.oldest; f < emu->rewindBuffer.next; f++)
+        used += emu->rewindBuffer.frames[f % emu->rewindBuffer.capacity].size;
+    uint64_t start = timestamp();
+    int result = rewindFrames(emu, 30);
+    uint64_t rewindTook = timestamp() - start;
+    saveState(emu, emu->rewindBuffer.state, emu->rewindBuffer.stateSize);
+    int exact = result == 0 && memcmp(expected, emu->rewindBuffer.state, emu->rewindBuffer.stateSize) == 0;
+    free(expected);
+
+    printf("FE: bench: %lu byte keyframes every %lu frames, %.0f bytes per delta frame\n", (unsigned long) emu->rewindBuffer.stateSize, emu->rewindBuffer.keyframeInterval, deltas ? deltaBytes / (double) deltas : 0.0);
+    printf("FE: bench: capture %.2f us/frame\n", captureTook / (double) frames);
+    printf("FE: bench: holding %llu frames in %.2f MB (%.0f bytes/frame) of a %.2f MB arena\n", held, used / 1048576.0, used / (double) held, emu->rewindBuffer.arenaSize / 1048576.0);
+    printf("FE: bench: rewinding 30 frames took %lu us and %s\n", (unsigned long) rewindTook, exact ? "restored the saved state exactly" : "did NOT restore the saved state");
+    return exact ? 0 : -1;
+}
+
+// Operand bytes used by the opcode benchmark so that every addressing mode resolves into scratch RAM at $0300
+#define BENCH_OPERAND_0 0x0000
+#define BENCH_OPERAND_eaImm 0x0000
+#define BENCH_OPERAND_eaZp 0x0010
+#define BENCH_OPERAND_eaZpX 0x0010
+#define BENCH_OPERAND_eaZpY 0x0010
+#define BENCH_OPERAND_eaXInd 0x0010
+#define BENCH_OPERAND_eaYInd 0x0010
+#define BENCH_OPERAND_eaAbs 0x0300
+#define BENCH_OPERAND_eaAbsX 0x0300
+#define BENCH_OPERAND_eaAbsY 0x0300
+#define BENCH_OPERAND(opcode, kind, a, mode, c) [opcode] = BENCH_OPERAND_##mode,
+
+static const unsigned short bench_operand_table[256] = { OPCODE_LIST(BENCH_OPERAND) };
+
+#define BENCH_NAME(opcode, kind, a, b, c) [opcode] = #opcode,
+
+static const char* const opcode_names[256] = { OPCODE_LIST(BENCH_NAME) };
+
+// Executes every documented opcode in isolation from $0400, then a few tight game loops, and reports their throughput
+int runOpcodeBenchmark(emulator_t* emu, unsigned long iterations)
+{
+    const unsigned short base = 0x0400;
+    unsigned long long totalInstructions = 0;
+    uint64_t totalTime = 0;
+    printf("opcode       ns/instr    M instr/s\n");
+    for (int opcode = 0; opcode < 256; opcode++)
+    {
+        if (opcode_names[opcode] == NULL)
+            continue;
+        memset(emu->machine.cpuMem, 0, 0x800);
+        emu->machine.cpuMem[0x10] = 0x00; // zero page pointer to $0300 for the indirect modes
+        emu->machine.cpuMem[0x11] = 0x03;
+        emu->machine.cpuMem[base] = opcode;
+        emu->machine.cpuMem[base + 1] = loByte(bench_operand_table[opcode]);
+        emu->machine.cpuMem[base + 2] = hiByte(bench_operand_table[opcode]);
+        emu->machine.regA = emu->machine.regX = emu->machine.regY = 0;
+        setFlags(emu, 0);
+        emu->machine.regS = 0xFF;
+        uint64_t start = timestamp();
+        for (unsigned long i = 0; i < iterations; i++)
+        {
+            emu->machine.pc = base;
+            executeCurrentInstruction(emu);
+        }
+        uint64_t took = timestamp() - start;
+        totalTime += took;
+        totalInstructions += iterations;
+        double seconds = took > 0 ? took / 1000000.0 : 1e-6;
+        printf("%-10s %9.2f %12.2f\n", opcode_names[opcode], seconds * 1e9 / iterations, iterations / seconds / 1000000.0);
+    }
+    double seconds = totalTime > 0 ? totalTime / 1000000.0 : 1e-6;
+    printf("FE: bench: all opcodes %.2f ns/instr, %.2f M instructions/s\n", seconds * 1e9 / totalInstructions, totalInstructions / seconds / 1000000.0);
+    // Small loops in the shape games spend most of their time in, each ending in a JMP back to $0400
+    static const struct { const char* name; unsigned char code[16]; } kernels[] = {
+        { "delay", { DEX, BNE, 0xFD, JMP_ABS, 0x00, 0x04 } },
+        { "table scan", { LDA_ABS_X, 0x00, 0x03, CMP_IMM, 0x40, BEQ, 0x00, INX, BNE, 0xF6, JMP_ABS, 0x00, 0x04 } },
+        { "frame counter", { INC_ZP, 0x10, LDA_ZP, 0x10, AND_IMM, 0x0F, BNE, 0xF8, ASL_A, JMP_ABS, 0x00, 0x04 } },
+        { "vblank poll", { BIT_ZP, 0x10, BPL, 0xFC, JMP_ABS, 0x00, 0x04 } }
+    };
+    for (int k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+    {
+        memset(emu->machine.cpuMem, 0, 0x800);
+        memcpy(emu->machine.cpuMem + base, kernels[k].code, sizeof(kernels[k].code));
+        emu->machine.regA = emu->machine.regX = emu->machine.regY = 0;
+        setFlags(emu, 0);
+        emu->machine.regS = 0xFF;
+        emu->machine.pc = base;
+        unsigned long long kernelInstructions = iterations * 16ULL;
+        uint64_t start = timestamp();
+        for (unsigned long long i = 0; i < kernelInstructions; i++)
+            executeCurrentInstruction(emu);
+        uint64_t took = timestamp() - start;
+        double kernelSeconds = took > 0 ? took / 1000000.0 : 1e-6;
+        printf("FE: bench: %s loop %.2f M instructions/s\n", kernels[k].name, kernelInstructions / kernelSeconds / 1000000.0);
+    }
+    return 0;
+}
+
+// Disassembly for trace dumps, the mnemonic is the start of the opcode's name
+#define DISASM_KIND_READ 0
+#define DISASM_KIND_LOAD 0
+#define DISASM_KIND_STORE 0
+#define DISASM_KIND_RMW 0
+#define DISASM_KIND_ACCUMULATOR 1
+#define DISASM_KIND_BRANCH 2
+#define DISASM_KIND_IMPLIED 3
+#define DISASM_ENTRY(opcode, kind, a, mode, c) [opcode] = { #opcode, DISASM_KIND_##kind, #mode },
+
+static const struct { const char* name; unsigned char kind; const char* mode; } disasm_table[256] = { OPCODE_LIST(DISASM_ENTRY) };
+
+// Prints a trace file in the format of the nestest log, without the memory values nestest shows
+// next to operands since the trace does not have them
+int dumpTrace(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        feErr("Could not open trace file");
+        return -1;
+    }
+    trace_header_t header;
+    if (fread(&header, sizeof(trace_header_t), 1, file) != 1 || memcmp(header.constant, trace_constant, 4) != 0 || header.version != TRACE_VERSION || header.recordSize != sizeof(trace_record_t))
+    {
+        fclose(file);
+        feErr("Not a trace file of this version");
+        return -1;
+    }
+    static trace_record_t records[4096];
+    size_t count;
+    while ((count = fread(records, sizeof(trace_record_t), 4096, file)) > 0)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            trace_record_t* r = &records[i];
+            unsigned short absolute = combineBytes(r->operand[0], r->operand[1]);
+            char instruction[40];
+            int size = 1;
+            const char* name = disasm_table[r->opcode].name;
+            const char* mode = disasm_table[r->opcode].mode;
+            if (name == NULL)
+                snprintf(instruction, sizeof(instruction), "??? ($%02X)", r->opcode);
+            else if (disasm_table[r->opcode].kind == DISASM_KIND_ACCUMULATOR)
+                snprintf(instruction, sizeof(instruction), "%.3s A", name);
+            else if (disasm_table[r->opcode].kind == DISASM_KIND_BRANCH)
+            {
+                snprintf(instruction, sizeof(instruction), "%.3s $%04X", name, (unsigned short) (r->pc + 2 + (char) r->operand[0]));
+                size = 2;
+            }
+            else if (r->opcode == JMP_IND)
+            {
+                snprintf(instruction, sizeof(instruction), "JMP ($%04X)", absolute);
+                size = 3;
+            }
+            else if (r->opcode == JMP_ABS || r->opcode == JSR)
+            {
+                snprintf(instruction, sizeof(instruction), "%.3s $%04X", name, absolute);
+                size = 3;
+            }
+            else if (disasm_table[r->opcode].kind == DISASM_KIND_IMPLIED)
+                snprintf(instruction, sizeof(instruction), "%.3s", name);
+            else
+            {
+                static const struct { const char* mode; const char* format; int size; } modes[] = {
+                    { "eaImm", "%.3s #$%02X", 2 }, { "eaZp", "%.3s $%02X", 2 }, { "eaZpX", "%.3s $%02X,X", 2 },
+                    { "eaZpY", "%.3s $%02X,Y", 2 }, { "eaXInd", "%.3s ($%02X,X)", 2 }, { "eaYInd", "%.3s ($%02X),Y", 2 },
+                    { "eaAbs", "%.3s $%04X", 3 }, { "eaAbsX", "%.3s $%04X,X", 3 }, { "eaAbsY", "%.3s $%04X,Y", 3 }
+                };
+                for (int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+                {
+                    if (strcmp(mode, modes[m].mode) == 0)
+                    {
+                        size = modes[m].size;
+                        snprintf(instruction, sizeof(instruction), modes[m].format, name, size == 2 ? r->operand[0] : absolute);
+                    }
+                }
+            }
+            char bytes[12];
+            if (size == 1)
+                snprintf(bytes, sizeof(bytes), "%02X", r->opcode);
+            else if (size == 2)
+                snprintf(bytes, sizeof(bytes), "%02X %02X", r->opcode, r->operand[0]);
+            else
+                snprintf(bytes, sizeof(bytes), "%02X %02X %02X", r->opcode, r->operand[0], r->operand[1]);
+            // the master clock starts at the pre-render scanline, which nestest numbers 261
+            unsigned long long dot = r->clock % PPU_CYCLES_PER_FRAME;
+            int scanline = (int) (dot / PPU_CYCLES_PER_SCANLINE) - 1;
+            printf("%04X  %-8s  %-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3d,%3d CYC:%llu\n", r->pc, bytes, instruction, r->a, r->x, r->y, r->p | 0x20, r->s, scanline < 0 ? SCANLINES - 1 : scanline, (int) (dot % PPU_CYCLES_PER_SCANLINE), r->clock / CPU_CLOCK_DIVIDER);
         }
-        case ORA_ABS:
+    }
+    fclose(file);
+    return 0;
+}
+
+#ifdef FE_PROFILE
+// Profiler reports: the hottest PCs and opcodes by cycles, and where each frame's time went
+
+typedef struct {
+    unsigned int key; // PC or opcode
+    unsigned long long count;
+    unsigned long long cycles;
+} profile_entry_t;
+
+int compareProfileEntries(const void* a, const void* b)
+{
+    const profile_entry_t* x = a;
+    const profile_entry_t* y = b;
+    return x->cycles < y->cycles ? 1 : (x->cycles > y->cycles ? -1 : (int) x->key - (int) y->key);
+}
+
+// Collects the executed entries of a pair of count and cycle arrays, hottest first
+size_t sortProfileEntries(const unsigned long long* counts, const unsigned long long* cycles, size_t size, profile_entry_t* out)
+{
+    size_t used = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        if (counts[i])
+            out[used++] = (profile_entry_t) { i, counts[i], cycles[i] };
+    }
+    qsort(out, used, sizeof(profile_entry_t), compareProfileEntries);
+    return used;
+}
+
+void printProfile(emulator_t* emu)
+{
+    static const char* const subsystem_names[PROFILE_SUBSYSTEMS] = { "cpu", "ppu", "present", "pacing" };
+    profile_t* profile = emu->profile;
+    double frames = profile->frames ? profile->frames : 1;
+    double usPerTick = 0.001;
+    printf("FE: profile: %llu frames\n", profile->frames);
+    for (int i = 0; i < PROFILE_SUBSYSTEMS; i++)
+    {
+        unsigned long long ticks = profile->time[i] - (i == PROFILE_EMULATION ? profile->time[PROFILE_PPU] : 0); // the PPU runs inside emulation
+        printf("FE: profile: %-8s %10.1f us/frame\n", subsystem_names[i], ticks * usPerTick / frames);
+    }
+    profile_entry_t* entries = malloc(0x10000 * sizeof(profile_entry_t));
+    size_t count = sortProfileEntries(profile->opcodeCount, profile->opcodeCycles, 256, entries);
+    printf("opcode         executions        cycles\n");
+    for (size_t i = 0; i < count && i < 20; i++)
+        printf("%-10s %14llu %13llu\n", opcode_names[entries[i].key], entries[i].count, entries[i].cycles);
+    count = sortProfileEntries(profile->pcCount, profile->pcCycles, 0x10000, entries);
+    printf("pc             executions        cycles\n");
+    for (size_t i = 0; i < count && i < 20; i++)
+        printf("$%04X      %14llu %13llu\n", entries[i].key, entries[i].count, entries[i].cycles);
+    free(entries);
+}
+
+int writeProfile(emulator_t* emu, const char* path)
+{
+    static const char* const subsystem_names[PROFILE_SUBSYSTEMS] = { "cpu", "ppu", "present", "pacing" };
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+    {
+        feErr("Could not write profile");
+        return -1;
+    }
+    profile_t* profile = emu->profile;
+    double usPerTick = 0.001;
+    fprintf(file, "{\n  \"frames\": %llu,\n  \"subsystems_us\": {", profile->frames);
+    for (int i = 0; i < PROFILE_SUBSYSTEMS; i++)
+    {
+        unsigned long long ticks = profile->time[i] - (i == PROFILE_EMULATION ? profile->time[PROFILE_PPU] : 0);
+        fprintf(file, "%s \"%s\": %.1f", i ? "," : "", subsystem_names[i], ticks * usPerTick);
+    }
+    profile_entry_t* entries = malloc(0x10000 * sizeof(profile_entry_t));
+    size_t count = sortProfileEntries(profile->opcodeCount, profile->opcodeCycles, 256, entries);
+    fprintf(file, " },\n  \"opcodes\": [");
+    for (size_t i = 0; i < count; i++)
+        fprintf(file, "%s\n    { \"opcode\": %u, \"name\": \"%s\", \"count\": %llu, \"cycles\": %llu }", i ? "," : "", entries[i].key, opcode_names[entries[i].key], entries[i].count, entries[i].cycles);
+    count = sortProfileEntries(profile->pcCount, profile->pcCycles, 0x10000, entries);
+    fprintf(file, "\n  ],\n  \"pcs\": [");
+    for (size_t i = 0; i < count; i++)
+        fprintf(file, "%s\n    { \"pc\": %u, \"count\": %llu, \"cycles\": %llu }", i ? "," : "", entries[i].key, entries[i].count, entries[i].cycles);
+    fprintf(file, "\n  ]\n}\n");
+    free(entries);
+    return fclose(file) == 0 ? 0 : -1;
+}
+#endif
+
+// See usage_message for the options
+int parseArguments(int argc, char* argv[], const char** romPath)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--headless") == 0)
         {
-            m6502ora_m(readAddr(pc + 1), ABS_SIZE);
-            break;
+            if (i + 1 >= argc || (headlessFrames = strtoul(argv[i + 1], NULL, 10)) == 0)
+            {
+                feErr("--headless expects a frame count");
+                return -1;
+            }
+            headless = 1;
+            pacingEnabled = 0;
+            i++;
         }
-        case ASL_ABS:
+        else if (strcmp(argv[i], "--bench-opcodes") == 0)
         {
-            m6502asl_m(readAddr(pc + 1), ABS_SIZE);
-            break;
+            if (i + 1 >= argc || (opcodeBenchIterations = strtoul(argv[i + 1], NULL, 10)) == 0)
+            {
+                feErr("--bench-opcodes expects an iteration count");
+                return -1;
+            }
+            headless = 1;
+            i++;
         }
-        case BPL:
+        else if (strcmp(argv[i], "--bench-render") == 0)
         {
-            if (isFlagSet(NEGATIVE_FLAG))
+            if (i + 1 >= argc || (renderBenchFrames = strtoul(argv[i + 1], NULL, 10)) == 0)
             {
-                pc += 2;
-                break;
+                feErr("--bench-render expects a frame count");
+                return -1;
             }
-            m6502branch();
-            break;
+            headless = 1;
+            pacingEnabled = 0;
+            i++;
         }
-        case ORA_Y_IND:
+        else if (strcmp(argv[i], "--bench-load") == 0)
         {
-            m6502ora_m(readAddr(cpuMem[pc + 1]) + regY, IND_SIZE);
-            break;
+            if (i + 1 >= argc)
+            {
+                feErr("--bench-load expects a directory");
+                return -1;
+            }
+            loadBenchDirectory = argv[++i];
+            headless = 1;
         }
-        case ORA_ZP_X:
+        else if (strcmp(argv[i], "--bench-mapper") == 0)
         {
-            m6502ora_m(regX + cpuMem[pc + 1], ZP_SIZE);
-            break;
+            if (i + 1 >= argc || (mapperBenchIterations = strtoul(argv[i + 1], NULL, 10)) == 0)
+            {
+                feErr("--bench-mapper expects an iteration count");
+                return -1;
+            }
+            headless = 1;
+            i++;
         }
-        case ASL_ZP_X:
+        else if (strcmp(argv[i], "--bench-state") == 0)
         {
-            m6502asl_m(regX + cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case CLC:
-        {
-            clearFlag(CARRY_FLAG);
-            pc++;
-            break;
-        }
-        case ORA_ABS_Y:
-        case ORA_ABS_X:
-        {
-            m6502ora_m(readAddr(pc + 1) + (opcode == ORA_ABS_Y ? regY : regX), ABS_SIZE);
-            break;
-        }
-        case ASL_ABS_X:
-        {
-            m6502asl_m(readAddr(pc + 1) + regX, ABS_SIZE);
-            break;
-        }
-        case JSR:
-        {
-            m6502pushStack(hiByte(pc + 2));
-            m6502pushStack(loByte(pc + 2));
-            m6502jmp(readAddr(pc + 1));
-            break;
-        }
-        case AND_X_IND:
-        {
-            m6502and_m(readAddr(regX + cpuMem[pc + 1]), IND_SIZE);
-            break;
-        }
-        case BIT_ZP:
-        {
-            m6502bit(cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case AND_ZP:
-        {
-            m6502and_m(cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case ROL_ZP:
-        {
-            m6502rol_m(cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case PLP:
-        {
-            flags = m6502pullStack();
-            pc++;
-            break;
-        }
-        case AND_IMM:
-        {
-            m6502and_i(cpuMem[pc + 1]);
-            break;
-        }
-        case ROL_A:
-        {
-            m6502rol_a();
-            break;
-        }
-        case BIT_ABS:
-        {
-            m6502bit(readAddr(pc + 1), ABS_SIZE);
-            break;
-        }
-        case AND_ABS:
-        {
-            m6502and_m(readAddr(pc + 1), ABS_SIZE);
-            break;
-        }
-        case ROL_ABS:
-        {
-            m6502rol_m(readAddr(pc + 1), ABS_SIZE);
-            break;
-        }
-        case BMI:
-        {
-            if (!isFlagSet(NEGATIVE_FLAG))
-            {
-                pc += 2;
-                break;
-            }
-            m6502branch();
-            break;
-        }
-        case AND_Y_IND:
-        {
-            m6502and_m(readAddr(cpuMem[pc + 1]) + regY, IND_SIZE);
-            break;
-        }
-        case AND_ZP_X:
-        {
-            m6502and_m(regX + cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case ROL_ZP_X:
-        {
-            m6502rol_m(regX + cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case SEC:
-        {
-            setFlag(CARRY_FLAG);
-            pc++;
-            break;
-        }
-        case AND_ABS_Y:
-        case AND_ABS_X:
-        {
-            m6502and_m(readAddr(pc + 1) + (opcode == AND_ABS_Y ? regY : regX), ABS_SIZE);
-            break;
-        }
-        case ROL_ABS_X:
-        {
-            m6502rol_m(readAddr(pc + 1) + regX, ABS_SIZE);
-            break;
-        }
-        case RTI:
-        {
-            flags = m6502pullStack();
-            unsigned char lo = m6502pullStack();
-            unsigned char hi = m6502pullStack();
-            pc = combineBytes(lo, hi);
-            break;
-        }
-        case EOR_X_IND:
-        {
-            m6502eor_m(readAddr(regX + cpuMem[pc + 1]), IND_SIZE);
-            break;
-        }
-        case EOR_ZP:
-        {
-            m6502eor_m(cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case LSR_ZP:
-        {
-            m6502lsr_m(cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case PHA:
-        {
-            m6502pushStack(regA);
-            pc++;
-            break;
-        }
-        case EOR_IMM:
-        {
-            m6502eor_i(cpuMem[pc + 1]);
-            break;
-        }
-        case LSR_A:
-        {
-            m6502lsr_a();
-            break;
-        }
-        case JMP_ABS:
-        {
-            m6502jmp(readAddr(pc + 1));
-            break;
-        }
-        case EOR_ABS:
-        {
-            m6502eor_m(readAddr(pc + 1), ABS_SIZE);
-            break;
-        }
-        case LSR_ABS:
-        {
-            m6502lsr_m(readAddr(pc + 1), ABS_SIZE);
-            break;
-        }
-        case BVC:
-        {
-            if (isFlagSet(OVERFLOW_FLAG))
-            {
-                pc += 2;
-                break;
-            }
-            m6502branch();
-            break;
-        }
-        case EOR_Y_IND:
-        {
-            m6502eor_m(readAddr(cpuMem[pc + 1]) + regY, IND_SIZE);
-            break;
-        }
-        case EOR_ZP_X:
-        {
-            m6502eor_m(regX + cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case LSR_ZP_X:
-        {
-            m6502lsr_m(regX + cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case CLI:
-        {
-            clearFlag(INTERRUPT_FLAG);
-            pc++;
-            break;
-        }
-        case EOR_ABS_Y:
-        case EOR_ABS_X:
-        {
-            m6502eor_m(readAddr(pc + 1) + (opcode == EOR_ABS_Y ? regY : regX), ABS_SIZE);
-            break;
-        }
-        case LSR_ABS_X:
-        {
-            m6502lsr_m(readAddr(pc + 1) + regX, ABS_SIZE);
-            break;
-        }
-        case RTS:
-        {
-            unsigned char lo = m6502pullStack();
-            unsigned char hi = m6502pullStack();
-            pc = combineBytes(lo, hi);
-            pc++;
-            break;
-        }
-        case ADC_X_IND:
-        {
-            m6502adc_m(readAddr(regX + cpuMem[pc + 1]), IND_SIZE);
-            break;
-        }
-        case ADC_ZP:
-        {
-            m6502adc_m(cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case ROR_ZP:
-        {
-            m6502ror_m(cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case PLA:
-        {
-            regA = m6502pullStack();
-            updateSignFlags(regA);
-            pc++;
-            break;
-        }
-        case ADC_IMM:
-        {
-            m6502adc_i(cpuMem[pc + 1]);
-            break;
-        }
-        case ROR_A:
-        {
-            m6502ror_a();
-            break;
-        }
-        case JMP_IND:
-        {
-            m6502jmp(readAddr(readAddr(pc + 1)));
-            break;
-        }
-        case ADC_ABS:
-        {
-            m6502adc_m(readAddr(pc + 1), ABS_SIZE);
-            break;
-        }
-        case ROR_ABS:
-        {
-            m6502ror_m(readAddr(pc + 1), ABS_SIZE);
-            break;
-        }
-        case BVS:
-        {
-            if (!isFlagSet(OVERFLOW_FLAG))
-            {
-                pc += 2;
-                break;
-            }
-            m6502branch();
-            break;
-        }
-        case ADC_Y_IND:
-        {
-            m6502adc_m(readAddr(cpuMem[pc + 1]) + regY, IND_SIZE);
-            break;
-        }
-        case ADC_ZP_X:
-        {
-            m6502adc_m(regX + cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case ROR_ZP_X:
-        {
-            m6502ror_m(regX + cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case SEI:
-        {
-            setFlag(INTERRUPT_FLAG);
-            pc++;
-            break;
-        }
-        case ADC_ABS_Y:
-        case ADC_ABS_X:
-        {
-            m6502adc_m(readAddr(pc + 1) + (opcode == ADC_ABS_Y ? regY : regX), ABS_SIZE);
-            break;
-        }
-        case ROR_ABS_X:
-        {
-            m6502ror_m(readAddr(pc + 1) + regX, ABS_SIZE);
-            break;
-        }
-        case STA_X_IND:
-        {
-            m6502store(&regA, readAddr(regX + cpuMem[pc + 1]), IND_SIZE);
-            break;
-        }
-        case STY_ZP:
-        {
-            m6502store(&regY, cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case STA_ZP:
-        {
-            m6502store(&regA, cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case STX_ZP:
-        {
-            m6502store(&regX, cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case DEY:
-        {
-            regY--;
-            updateSignFlags(regY);
-            pc++;
-            break;
-        }
-        case TXA:
-        {
-            regA = regX;
-            updateSignFlags(regA);
-            pc++;
-            break;
-        }
-        case STY_ABS:
-        {
-            m6502store(&regY, readAddr(pc + 1), ABS_SIZE);
-            break;
-        }
-        case STA_ABS:
-        {
-            m6502store(&regA, readAddr(pc + 1), ABS_SIZE);
-            break;
-        }
-        case STX_ABS:
-        {
-            m6502store(&regX, readAddr(pc + 1), ABS_SIZE);
-            break;
-        }
-        case BCC:
-        {
-            if (isFlagSet(CARRY_FLAG))
-            {
-                pc += 2;
-                break;
-            }
-            m6502branch();
-            break;
-        }
-        case STA_Y_IND:
-        {
-            m6502store(&regA, readAddr(cpuMem[pc + 1]) + regY, IND_SIZE);
-            break;
-        }
-        case STY_ZP_X:
-        {
-            m6502store(&regY, regX + cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case STA_ZP_X:
-        {
-            m6502store(&regA, regX + cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case STX_ZP_Y:
-        {
-            m6502store(&regX, regY + cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case TYA:
-        {
-            regA = regY;
-            updateSignFlags(regA);
-            pc++;
-            break;
-        }
-        case STA_ABS_Y:
-        case STA_ABS_X:
-        {
-            m6502store(&regA, readAddr(pc + 1) + (opcode == STA_ABS_Y ? regY : regX), ABS_SIZE);
-            break;
-        }
-        case TXS:
-        {
-            regS = regX;
-            updateSignFlags(regS);
-            pc++;
-            break;
-        }
-        case LDY_IMM:
-        {
-            m6502load_i(&regY, cpuMem[pc + 1]);
-            break;
-        }
-        case LDA_X_IND:
-        {
-            m6502load_m(&regA, readAddr(regX + cpuMem[pc + 1]), IND_SIZE);
-            break;
-        }
-        case LDX_IMM:
-        {
-            m6502load_i(&regX, cpuMem[pc + 1]);
-            break;
-        }
-        case LDY_ZP:
-        {
-            m6502load_m(&regY, cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case LDA_ZP:
-        {
-            m6502load_m(&regA, cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case LDX_ZP:
-        {
-            m6502load_m(&regX, cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case TAY:
-        {
-            regY = regA;
-            updateSignFlags(regY);
-            pc++;
-            break;
-        }
-        case LDA_IMM:
-        {
-            m6502load_i(&regA, cpuMem[pc + 1]);
-            break;
-        }
-        case TAX:
-        {
-            regX = regA;
-            updateSignFlags(regX);
-            pc++;
-            break;
-        }
-        case LDY_ABS:
-        {
-            m6502load_m(&regY, readAddr(pc + 1), ABS_SIZE);
-            break;
-        }
-        case LDA_ABS:
-        {
-            m6502load_m(&regA, readAddr(pc + 1), ABS_SIZE);
-            break;
-        }
-        case LDX_ABS:
-        {
-            m6502load_m(&regX, readAddr(pc + 1), ABS_SIZE);
-            break;
-        }
-        case BCS:
-        {
-            if (!isFlagSet(CARRY_FLAG))
-            {
-                pc += 2;
-                break;
-            }
-            m6502branch();
-            break;
-        }
-        case LDA_Y_IND:
-        {
-            m6502load_m(&regA, readAddr(cpuMem[pc + 1]) + regY, IND_SIZE);
-            break;
-        }
-        case LDY_ZP_X:
-        {
-            m6502load_m(&regY, regX + cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case LDA_ZP_X:
-        {
-            m6502load_m(&regA, regX + cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case LDX_ZP_Y:
-        {
-            m6502load_m(&regX, regY + cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case CLV:
-        {
-            clearFlag(OVERFLOW_FLAG);
-            pc++;
-            break;
-        }
-        case LDA_ABS_Y:
-        case LDA_ABS_X:
-        {
-            m6502load_m(&regA, readAddr(pc + 1) + (opcode == LDA_ABS_Y ? regY : regX), ABS_SIZE);
-            break;
-        }
-        case TSX:
-        {
-            regX = regS;
-            updateSignFlags(regX);
-            pc++;
-            break;
-        }
-        case LDY_ABS_X:
-        {
-            m6502load_m(&regY, readAddr(pc + 1) + regX, ABS_SIZE);
-            break;
-        }
-        case LDX_ABS_Y:
-        {
-            m6502load_m(&regX, readAddr(pc + 1) + regY, ABS_SIZE);
-            break;
-        }
-        case CPY_IMM:
-        {
-            m6502cmp_i(&regY, cpuMem[pc + 1]);
-            break;
-        }
-        case CMP_X_IND:
-        {
-            m6502cmp_m(&regA, readAddr(regX + cpuMem[pc + 1]), IND_SIZE);
-            break;
-        }
-        case CPY_ZP:
-        {
-            m6502cmp_m(&regY, cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case CMP_ZP:
-        {
-            m6502cmp_m(&regA, cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case DEC_ZP:
-        {
-            m6502dec(cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case INY:
-        {
-            regY++;
-            updateSignFlags(regY);
-            pc++;
-            break;
-        }
-        case CMP_IMM:
-        {
-            m6502cmp_i(&regA, cpuMem[pc + 1]);
-            break;
-        }
-        case DEX:
-        {
-            regX--;
-            updateSignFlags(regX);
-            pc++;
-            break;
-        }
-        case CPY_ABS:
-        {
-            m6502cmp_m(&regY, readAddr(pc + 1), ABS_SIZE);
-            break;
-        }
-        case CMP_ABS:
-        {
-            m6502cmp_m(&regA, readAddr(pc + 1), ABS_SIZE);
-            break;
-        }
-        case DEC_ABS:
-        {
-            m6502dec(readAddr(pc + 1), ABS_SIZE);
-            break;
-        }
-        case BNE:
-        {
-            if (isFlagSet(ZERO_FLAG))
+            if (i + 1 >= argc || (stateBenchIterations = strtoul(argv[i + 1], NULL, 10)) == 0)
             {
-                pc += 2;
-                break;
+                feErr("--bench-state expects an iteration count");
+                return -1;
             }
-            m6502branch();
-            break;
-        }
-        case CMP_Y_IND:
-        {
-            m6502cmp_m(&regA, readAddr(cpuMem[pc + 1]) + regY, IND_SIZE);
-            break;
-        }
-        case CMP_ZP_X:
-        {
-            m6502cmp_m(&regA, regX + cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case DEC_ZP_X:
-        {
-            m6502dec(regX + cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case CLD:
-        {
-            clearFlag(DECIMAL_FLAG);
-            pc++;
-            break;
-        }
-        case CMP_ABS_Y:
-        {
-            m6502cmp_m(&regA, readAddr(pc + 1) + regY, ABS_SIZE);
-            break;
-        }
-        case CMP_ABS_X:
-        {
-            m6502cmp_m(&regA, readAddr(pc + 1) + regX, ABS_SIZE);
-            break;
-        }
-        case DEC_ABS_X:
-        {
-            m6502dec(readAddr(pc + 1) + regX, ABS_SIZE);
-            break;
-        }
-        case CPX_IMM:
-        {
-            m6502cmp_i(&regX, cpuMem[pc + 1]);
-            break;
+            headless = 1;
+            pacingEnabled = 0;
+            i++;
         }
-        case SBC_X_IND:
+        else if (strcmp(argv[i], "--bench-rewind") == 0)
         {
-            m6502sbc_m(readAddr(regX + cpuMem[pc + 1]), IND_SIZE);
-            break;
-        }
-        case CPX_ZP:
-        {
-            m6502cmp_m(&regX, cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case SBC_ZP:
-        {
-            m6502sbc_m(cpuMem[pc + 1], ZP_SIZE);
-            break;
-        }
-        case INC_ZP:
-        {
-            m6502inc(cpuMem[pc + 1], ZP_SIZE);
-            break;
+            if (i + 1 >= argc || (rewindBenchFrames = strtoul(argv[i + 1], NULL, 10)) == 0)
+            {
+                feErr("--bench-rewind expects a frame count");
+                return -1;
+            }
+            headless = 1;
+            pacingEnabled = 0;
+            i++;
         }
-        case INX:
+        else if (strcmp(argv[i], "--rewind") == 0)
         {
-            regX++;
-            updateSignFlags(regX);
-            pc++;
-            break;
+            if (i + 1 >= argc)
+            {
+                feErr("--rewind expects a number of seconds (0 turns rewinding off)");
+                return -1;
+            }
+            rewindSeconds = strtoul(argv[++i], NULL, 10);
         }
-        case SBC_IMM:
+        else if (strcmp(argv[i], "--rewind-memory") == 0)
         {
-            m6502sbc_i(cpuMem[pc + 1]);
-            break;
+            if (i + 1 >= argc || strtoul(argv[i + 1], NULL, 10) == 0)
+            {
+                feErr("--rewind-memory expects a size in megabytes");
+                return -1;
+            }
+            rewindMemory = strtoul(argv[++i], NULL, 10) * 1024 * 1024;
         }
-        case NOP:
+        else if (strcmp(argv[i], "--profile") == 0)
         {
-            pc++;
-            break;
+#ifndef FE_PROFILE
+            feErr("--profile needs a build with FE_PROFILE defined");
+            return -1;
+#endif
+            if (i + 1 >= argc)
+            {
+                feErr("--profile expects a file to write the JSON profile to");
+                return -1;
+            }
+            profilePath = argv[++i];
         }
-        case CPX_ABS:
+        else if (strcmp(argv[i], "--trace") == 0 || strcmp(argv[i], "--dump-trace") == 0)
         {
-            m6502cmp_m(&regX, readAddr(pc + 1), ABS_SIZE);
-            break;
+            if (i + 1 >= argc)
+            {
+                feErr(argv[i][2] == 't' ? "--trace expects a file to write the trace to" : "--dump-trace expects a trace file");
+                return -1;
+            }
+            if (argv[i][2] == 't')
+                tracePath = argv[++i];
+            else
+                traceDumpPath = argv[++i];
         }
-        case SBC_ABS:
+        else if (strcmp(argv[i], "--wav") == 0)
         {
-            m6502sbc_m(readAddr(pc + 1), ABS_SIZE);
-            break;
+            if (i + 1 >= argc)
+            {
+                feErr("--wav expects a file to write the audio to");
+                return -1;
+            }
+            wavPath = argv[++i];
         }
-        case INC_ABS:
+        else if (strcmp(argv[i], "--golden") == 0)
         {
-            m6502inc(readAddr(pc + 1), ABS_SIZE);
-            break;
+            if (i + 1 >= argc)
+            {
+                feErr("--golden expects a frame log");
+                return -1;
+            }
+            goldenLogPath = argv[++i];
+            headless = 1;
+            pacingEnabled = 0;
         }
-        case BEQ:
+        else if (strcmp(argv[i], "--play") == 0 || strcmp(argv[i], "--record") == 0)
         {
-            if (!isFlagSet(ZERO_FLAG))
+            if (i + 1 >= argc)
             {
-                pc += 2;
-                break;
+                feErr(argv[i][2] == 'p' ? "--play expects an input movie" : "--record expects an input movie");
+                return -1;
+            }
+            if (argv[i][2] == 'p')
+                moviePlayPath = argv[++i];
+            else
+                movieRecordPath = argv[++i];
+            if (moviePlayPath != NULL && movieRecordPath != NULL)
+            {
+                feErr("--play and --record cannot be combined");
+                return -1;
             }
-            m6502branch();
-            break;
         }
-        case SBC_Y_IND:
+        else if (strcmp(argv[i], "--batch") == 0)
         {
-            m6502sbc_m(readAddr(cpuMem[pc + 1]) + regY, IND_SIZE);
-            break;
+            if (i + 1 >= argc)
+            {
+                feErr("--batch expects a batch file");
+                return -1;
+            }
+            batchPath = argv[++i];
+            headless = 1;
+            pacingEnabled = 0;
         }
-        case SBC_ZP_X:
+        else if (strcmp(argv[i], "--threads") == 0)
         {
-            m6502sbc_m(regX + cpuMem[pc + 1], ZP_SIZE);
-            break;
+            if (i + 1 >= argc || (batchThreads = atoi(argv[i + 1])) <= 0)
+            {
+                feErr("--threads expects a thread count");
+                return -1;
+            }
+            i++;
         }
-        case INC_ZP_X:
+        else if (strcmp(argv[i], "--pacing") == 0)
         {
-            m6502inc(regX + cpuMem[pc + 1], ZP_SIZE);
-            break;
+            const char* modes[] = { "sleep", "vsync", "audio" };
+            int mode = i + 1 < argc ? 0 : 3;
+            while (mode < 3 && strcmp(argv[i + 1], modes[mode]) != 0)
+                mode++;
+            if (mode == 3)
+            {
+                feErr("--pacing expects sleep, vsync or audio");
+                return -1;
+            }
+            pacingMode = mode;
+            i++;
         }
-        case SED:
+        else if (strcmp(argv[i], "--compositor") == 0)
         {
-            setFlag(DECIMAL_FLAG);
-            pc++;
-            break;
+            if (i + 1 >= argc)
+            {
+                feErr("--compositor expects scalar, ssse3 or avx2");
+                return -1;
+            }
+            compositorName = argv[++i];
         }
-        case SBC_ABS_Y:
+        else if (strcmp(argv[i], "--record-golden") == 0)
+            goldenRecord = 1;
+        else if (strcmp(argv[i], "--pipeline") == 0)
+            pipelineEnabled = 1;
+        else if (strcmp(argv[i], "--render-skip") == 0)
         {
-            m6502sbc_m(readAddr(pc + 1) + regY, ABS_SIZE);
-            break;
+            if (i + 1 >= argc || sscanf(argv[i + 1], "%u/%u", &renderSkipFrames, &renderSkipEvery) != 2 || renderSkipFrames == 0 || renderSkipFrames > renderSkipEvery)
+            {
+                feErr("--render-skip expects <n>/<m>, skipping n of every m frames");
+                return -1;
+            }
+            i++;
         }
-        case SBC_ABS_X:
+        else if (strcmp(argv[i], "--raster-threads") == 0)
         {
-            m6502sbc_m(readAddr(pc + 1) + regX, ABS_SIZE);
-            break;
+            if (i + 1 >= argc || (rasterThreads = atoi(argv[i + 1])) <= 0 || rasterThreads > RASTER_MAX_THREADS)
+            {
+                feErr("--raster-threads expects a thread count of at most 64");
+                return -1;
+            }
+            i++;
         }
-        case INC_ABS_X:
+        else if (strcmp(argv[i], "--observe") == 0)
         {
-            m6502inc(readAddr(pc + 1) + regX, ABS_SIZE);
-            break;
+            if (i + 1 >= argc)
+            {
+                feErr("--observe expects a shared memory name, like /fe");
+                return -1;
+            }
+            observeName = argv[++i];
         }
-        default:
+        else if (argv[i][0] == '-')
         {
-            printf("Attempted to execute unknown instruction (opcode $%x)\n", opcode);
+            feErr(usage_message);
             return -1;
         }
+        else
+            *romPath = argv[i];
     }
-    if (overviewAfterInstruction)
-        printEmulatorOverview();
-    instructionCount++;
     return 0;
 }
 
-// Reads a little endian 16-bit address at addr
-unsigned short readAddr(unsigned short addr)
-{
-    return (((unsigned short) cpuMem[addr + 1]) << 8) | ((unsigned short) cpuMem[addr]);
-}
-
-void setFlag(int bit)
-{
-    flags |= (1 << bit);
-}
-
-void clearFlag(int bit)
+void feInfo(const char* message)
 {
-    flags &= ~(1 << bit);
+    printf("FE: info: %s\n", message);
 }
 
-int flipFlag(int bit)
+int safeExit(emulator_t* emu, int code)
 {
-    if ((flags & (1 << bit)) == 0)
+    if (!headless)
     {
-        setFlag(bit);
-        return 1;
+        SDL_DestroyTexture(screenTexture);
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        if (audioDevice != 0)
+            SDL_CloseAudioDevice(audioDevice);
+        SDL_Quit();
+        printPacingStats();
     }
-    else
+    if (emu->movie.mode == MOVIE_RECORD && saveMovieFile(emu, movieRecordPath) == 0)
+        feInfo("Saved input movie");
+#ifdef FE_PROFILE
+    if (emu->profile != NULL)
     {
-        clearFlag(bit);
-        return 0;
+        printProfile(emu);
+        if (writeProfile(emu, profilePath) == 0)
+            feInfo("Wrote profile");
     }
+#endif
+    if (emu->trace != NULL)
+    {
+        char message[128];
+        snprintf(message, sizeof(message), "Traced %lu instructions, waited for the trace thread %llu times", emu->trace->head, emu->trace->stalls);
+        feInfo(message);
+    }
+    destroyEmulator(emu);
+    feInfo("Cartridge has been unloaded");
+    return code;
 }
 
-int isFlagSet(int bit)
-{
-    return isBitSet(flags, bit);
-}
-
-int isBitSet(unsigned char field, int bit)
-{
-    return (field & (1 << bit)) != 0;
-}
-
-void setBit(unsigned char* field, int bit)
-{
-    *field |= (1 << bit);
-}
-
-void clearBit(unsigned char* field, int bit)
-{
-    *field &= ~(1 << bit);
-}
-
-void updateFlagConditionally(int condition, int bit)
-{
-    if (condition)
-        setFlag(bit);
-    else
-        clearFlag(bit);
-}
-
-void updateNegativeFlag(unsigned char c)
-{
-    updateFlagConditionally(((char) c) < 0, NEGATIVE_FLAG);
-}
-
-void updateZeroFlag(unsigned char c)
-{
-    updateFlagConditionally(((char) c) == 0, ZERO_FLAG);
-}
-
-void updateSignFlags(unsigned char c)
-{
-    updateNegativeFlag(c);
-    updateZeroFlag(c);
-}
-
-void m6502pushStack(unsigned char c)
-{
-    cpuMem[((unsigned short) 0x0100) + ((unsigned short) regS--)] = c;
-}
-
-unsigned char m6502pullStack()
-{
-    return cpuMem[((unsigned short) 0x0100) + ((unsigned short) ++regS)];
-}
-
-// pc should be on the branch instruction
-void m6502branch()
-{
-    pc += 2;
-    pc += (char) cpuMem[pc - 1];
-}
-
-void m6502interrupt(unsigned short addr)
-{
-    m6502pushStack(hiByte(pc));
-    m6502pushStack(loByte(pc));
-    m6502pushStack(flags);
-    m6502jmp(addr);
-}
-
-void m6502jmp(unsigned short addr)
-{
-    pc = addr;
-}
-
-void m6502asl_m(unsigned short mem, int sz)
-{
-    updateFlagConditionally(isBitSet(cpuMem[mem], 7), CARRY_FLAG);
-    cpuMem[mem] <<= 1;
-    updateSignFlags(cpuMem[mem]);
-    pc += sz;
-}
-
-void m6502asl_a()
-{
-    updateFlagConditionally(isBitSet(regA, 7), CARRY_FLAG);
-    regA <<= 1;
-    updateSignFlags(regA);
-    pc++;
-}
-
-void m6502lsr_m(unsigned short mem, int sz)
-{
-    updateFlagConditionally(isBitSet(cpuMem[mem], 0), CARRY_FLAG);
-    cpuMem[mem] >>= 1;
-    updateSignFlags(cpuMem[mem]);
-    pc += sz;
-}
-
-void m6502lsr_a()
-{
-    updateFlagConditionally(isBitSet(regA, 0), CARRY_FLAG);
-    regA >>= 1;
-    updateSignFlags(regA);
-    pc++;
-}
-
-void m6502rol_m(unsigned short mem, int sz)
-{
-    unsigned char c = (unsigned char) isFlagSet(CARRY_FLAG);
-    updateFlagConditionally(isBitSet(cpuMem[mem], 7), CARRY_FLAG);
-    cpuMem[mem] <<= 1;
-    cpuMem[mem] = ((cpuMem[mem] & ~1) | c);
-    updateSignFlags(cpuMem[mem]);
-    pc += sz;
-}
-
-void m6502rol_a()
-{
-    unsigned char c = (unsigned char) isFlagSet(CARRY_FLAG);
-    updateFlagConditionally(isBitSet(regA, 7), CARRY_FLAG);
-    regA <<= 1;
-    regA = ((regA & ~1) | c);
-    updateSignFlags(regA);
-    pc++;
-}
-
-void m6502ror_m(unsigned short mem, int sz)
-{
-    unsigned char c = (unsigned char) isFlagSet(CARRY_FLAG);
-    updateFlagConditionally(isBitSet(cpuMem[mem], 0), CARRY_FLAG);
-    cpuMem[mem] >>= 1;
-    cpuMem[mem] = (cpuMem[mem] | (c << 7));
-    updateSignFlags(cpuMem[mem]);
-    pc += sz;
-}
-
-void m6502ror_a()
-{
-    unsigned char c = (unsigned char) isFlagSet(CARRY_FLAG);
-    updateFlagConditionally(isBitSet(regA, 0), CARRY_FLAG);
-    regA >>= 1;
-    regA = (regA | (c << 7));
-    updateSignFlags(regA);
-    pc++;
-}
-
-void m6502ora_m(unsigned short mem, int sz)
-{
-    regA |= cpuMem[mem];
-    updateSignFlags(regA);
-    pc += sz;
-}
-
-void m6502ora_i(unsigned char i)
-{
-    regA |= i;
-    updateSignFlags(regA);
-    pc += 2;
-}
-
-void m6502and_m(unsigned short mem, int sz)
-{
-    regA &= cpuMem[mem];
-    updateSignFlags(regA);
-    pc += sz;
-}
-
-void m6502and_i(unsigned char i)
-{
-    regA &= i;
-    updateSignFlags(regA);
-    pc += 2;
-}
-
-void m6502eor_m(unsigned short mem, int sz)
-{
-    regA ^= cpuMem[mem];
-    updateSignFlags(regA);
-    pc += sz;
-}
-
-void m6502eor_i(unsigned char i)
-{
-    regA ^= i;
-    updateSignFlags(regA);
-    pc += 2;
-}
-
-// segments marked with an asterisk for adc and sbc instructions come from https://stackoverflow.com/questions/29193303/6502-emulation-proper-way-to-implement-adc-and-sbc
-
-void m6502adc_m(unsigned short mem, int sz)
-{
-    unsigned short sum = (unsigned short) regA + (unsigned short) cpuMem[mem] + isFlagSet(CARRY_FLAG);
-    updateFlagConditionally(sum > 0xFF, CARRY_FLAG);
-    updateFlagConditionally(~(regA ^ cpuMem[mem]) & (regA ^ sum) & 0x80, OVERFLOW_FLAG);
-    regA = sum;
-    updateSignFlags(regA);
-    pc += sz;
-}
 
-void m6502adc_i(unsigned char i)
+// Uploads the framebuffer in one go and lets SDL scale it to the window
+void presentFrame(emulator_t* emu)
 {
-    unsigned short sum = (unsigned short) regA + (unsigned short) i + isFlagSet(CARRY_FLAG);
-    updateFlagConditionally(sum > 0xFF, CARRY_FLAG);
-    updateFlagConditionally(~(regA ^ i) & (regA ^ sum) & 0x80, OVERFLOW_FLAG);
-    regA = sum;
-    updateSignFlags(regA);
-    pc += 2;
+#ifdef FE_PROFILE
+    unsigned long long profileStart = emu->profile != NULL ? nanoTimestamp() : 0;
+#endif
+    SDL_UpdateTexture(screenTexture, NULL, emu->framebuffer, SCREEN_WIDTH * sizeof(emu->framebuffer[0]));
+    SDL_RenderCopy(renderer, screenTexture, NULL, NULL);
+    SDL_RenderPresent(renderer);
+#ifdef FE_PROFILE
+    if (emu->profile != NULL)
+        emu->profile->time[PROFILE_PRESENT] += nanoTimestamp() - profileStart;
+#endif
 }
 
-void m6502sbc_m(unsigned short mem, int sz)
+// Opens the default audio device, without one the front-end runs silent and paces by the clock
+void openAudio()
 {
-    unsigned short sum = (unsigned short) regA + (unsigned short) ~(cpuMem[mem]) + isFlagSet(CARRY_FLAG);
-    updateFlagConditionally(sum > 0xFF, CARRY_FLAG);
-    updateFlagConditionally(~(regA ^ ~(cpuMem[mem])) & (regA ^ sum) & 0x80, OVERFLOW_FLAG);
-    regA = sum;
-    updateSignFlags(regA);
-    pc += sz;
+    SDL_AudioSpec want, have;
+    memset(&want, 0, sizeof(SDL_AudioSpec));
+    want.freq = AUDIO_SAMPLE_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = AUDIO_DEVICE_SAMPLES;
+    want.callback = audioCallback;
+    want.userdata = &audioRing;
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0 || (audioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0)) == 0)
+    {
+        printf("Audio could not be opened, running silent! (%s)\n", SDL_GetError());
+        return;
+    }
+    SDL_PauseAudioDevice(audioDevice, 0);
 }
 
-void m6502sbc_i(unsigned char i)
+// Runs on SDL's audio thread
+void audioCallback(void* data, Uint8* stream, int length)
 {
-    return m6502adc_i(~i);
+    audio_ring_t* ring = data;
+    short* out = (short*) stream;
+    unsigned long tail = ring->tail;
+    unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < length / (int) sizeof(short); i++)
+    {
+        if (tail != head)
+            ring->last = ring->samples[tail++ & (AUDIO_RING_SAMPLES - 1)];
+        out[i] = ring->last;
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
 }
 
-void m6502bit(unsigned short mem, int sz)
+// Hands the last frame's samples to the audio callback, dropping whatever does not fit
+void queueAudio(emulator_t* emu)
 {
-    flags = (flags & 0b00111111) | (cpuMem[mem] & 0b11000000);
-    updateZeroFlag(cpuMem[mem] & regA);
-    pc += sz;
+    unsigned long head = audioRing.head;
+    unsigned long space = AUDIO_RING_SAMPLES - (head - __atomic_load_n(&audioRing.tail, __ATOMIC_ACQUIRE));
+    unsigned int count = emu->audio.sampleCount < space ? emu->audio.sampleCount : space;
+    for (unsigned int i = 0; i < count; i++)
+        audioRing.samples[(head + i) & (AUDIO_RING_SAMPLES - 1)] = emu->audio.samples[i];
+    __atomic_store_n(&audioRing.head, head + count, __ATOMIC_RELEASE);
 }
 
-void m6502store(unsigned char* r, unsigned short mem, int sz)
+// Holds the front-end to real time, once per frame. With audio pacing and an audio device the
+// device's consumption of samples sets the pace, with vsync presenting does, otherwise frames are
+// due a fixed time apart on the performance counter and the front-end sleeps until then.
+void paceFrame(emulator_t* emu)
 {
-    cpuMem[mem] = *r;
-    if (mem == PPUSCROLL)
-    {
-        if (ppu.writeToggle) // changing y scroll
-        {
-            ppu.currentVRamAddr.coarseYScroll = *r / 8;
-            ppu.currentVRamAddr.fineYScroll = *r % 8;
-            ppu.writeToggle = 0;
-        }
-        else
-        {
-            ppu.currentVRamAddr.coarseXScroll = *r / 8;
-            ppu.fineXScroll = *r % 8;
-            ppu.writeToggle = 1;
-        }
-    }
-    if (mem == PPUADDR) // some goofy bit mirroring because i was lazy earlier
-    {
-        if (ppu.writeToggle) // write latch set, low byte being updated
-        {
-            ppu.currentVRamAddr.exactAddr = (ppu.currentVRamAddr.exactAddr & 0x3F00) | *r;
-            //ppu_obj.currentVRamAddr.fineYScroll = ppu_obj.currentVRamAddr.exactAddr >> 12;
-            //ppu_obj.currentVRamAddr.nametableSelect = (ppu_obj.currentVRamAddr.exactAddr >> 10) & 0b11;
-            //ppu_obj.currentVRamAddr.coarseYScroll = (ppu_obj.currentVRamAddr.coarseYScroll & 0b111) | (((ppu_obj.currentVRamAddr.exactAddr >> 8) & 0b11) << 3);
-            ppu.writeToggle = 0;
-        }
-        else
-        {
-            ppu.currentVRamAddr.exactAddr = (ppu.currentVRamAddr.exactAddr & 0xFF) | (((unsigned short) *r) << 8);
-            //pu_obj.currentVRamAddr.coarseYScroll = (ppu_obj.currentVRamAddr.coarseYScroll & 0b11000) | ((ppu_obj.currentVRamAddr.exactAddr >> 5) & 0b111);
-            //ppu_obj.currentVRamAddr.coarseXScroll = ppu_obj.currentVRamAddr.exactAddr & 0b11111;
-            ppu.writeToggle = 1;
-        }
-    }
-    if (mem == PPUDATA)
+#ifdef FE_PROFILE
+    unsigned long long profileStart = emu->profile != NULL ? nanoTimestamp() : 0;
+#endif
+    if (pacingMode == PACING_AUDIO && audioDevice != 0)
     {
-        ppuMem[ppu.currentVRamAddr.exactAddr] = *r;
-        if(isBitSet(cpuMem[PPUCTRL], VRAM_INC_BIT))
-            ppu.currentVRamAddr.exactAddr += 0x20;
-        else
-            ppu.currentVRamAddr.exactAddr++;
-    }
-    if (mem == OAMDMA) // pretend like i'm not doing this way faster than necessary
-    {
-        unsigned short basePageAddr = ((unsigned short) *r) << 8;
-        for (int i = 0; i < 256; i++)
-            ppu.pOAM[i] = cpuMem[basePageAddr + i];
+        while (audioRing.head - __atomic_load_n(&audioRing.tail, __ATOMIC_ACQUIRE) > AUDIO_LATENCY_SAMPLES)
+            SDL_Delay(1);
     }
-    if (mem == OAMDATA)
-        ppu.pOAM[cpuMem[OAMADDR]] = *r;
-    if (mem == CONTROLLER_1)
+    else if (pacingMode != PACING_VSYNC)
     {
-        if (*r == 0)
-        {
-            readNC1 = 0;
-            readNC2 = 0;
-        }
+        Uint64 period = SDL_GetPerformanceFrequency() * FRAME_LENGTH_US / 1000000;
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (frameDeadline == 0 || now > frameDeadline + period) // starting out, or too far behind to catch up
+            frameDeadline = now;
+        frameDeadline += period;
+        sleepUntil(frameDeadline);
     }
-    pc += sz;
+#ifdef FE_PROFILE
+    if (emu->profile != NULL)
+        emu->profile->time[PROFILE_PACING] += nanoTimestamp() - profileStart;
+#endif
 }
 
-void m6502load_m(unsigned char* r, unsigned short mem, int sz)
+// Sleeps until the performance counter reaches the deadline, spinning through the last
+// PACING_SPIN_US only
+void sleepUntil(Uint64 deadline)
 {
-    if (mem == 0x1898)
-        printEmulatorOverview();
-    *r = cpuMem[mem];
-    updateSignFlags(*r);
-    if (mem == PPUSTATUS)
-        ppu.writeToggle = 0; // reset address latch
-    if (mem == CONTROLLER_1)
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 spin = frequency * PACING_SPIN_US / 1000000;
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (deadline > now + spin)
     {
-        if (readNC1 >= 8)
-            *r = (unsigned char) 1;
-        else
-            *r = (unsigned char) ((buttons & (1 << readNC1)) != 0);
-        readNC1++;
+        Uint64 ns = (deadline - spin - now) * 1000000000 / frequency;
+#ifndef _WIN32
+        struct timespec wake;
+        clock_gettime(CLOCK_MONOTONIC, &wake);
+        wake.tv_sec += (wake.tv_nsec + ns) / 1000000000;
+        wake.tv_nsec = (wake.tv_nsec + ns) % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) != 0); // restarted when interrupted
+#else
+        SDL_Delay(ns / 1000000); // no clock_nanosleep here, SDL asks Windows for 1 ms timer resolution
+#endif
     }
-    pc += sz;
-}
-
-void m6502load_i(unsigned char* r, unsigned char i)
-{
-    *r = i;
-    updateSignFlags(*r);
-    pc += 2;
-}
-
-void m6502cmp_m(unsigned char* r, unsigned short mem, int sz)
-{
-    unsigned short sum = (unsigned short) *r + (unsigned short) ~(cpuMem[mem]) + isFlagSet(CARRY_FLAG);
-    if (sum > 0xFF)
-        setFlag(CARRY_FLAG);
-    updateSignFlags((char) (*r) - (char) (cpuMem[mem]));
-    pc += sz;
-}
-
-void m6502cmp_i(unsigned char* r, unsigned char i)
-{
-    unsigned short sum = (unsigned short) *r + (unsigned short) ~i + isFlagSet(CARRY_FLAG);
-    if (sum > 0xFF)
-        setFlag(CARRY_FLAG);
-    updateSignFlags((char) (*r) - (char) i);
-    pc += 2;
-}
-
-void m6502inc(unsigned short mem, int sz)
-{
-    cpuMem[mem]++;
-    updateSignFlags(cpuMem[mem]);
-    pc += sz;
-}
-
-void m6502dec(unsigned short mem, int sz)
-{
-    cpuMem[mem]--;
-    updateSignFlags(cpuMem[mem]);
-    pc += sz;
-}
-
-unsigned char loByte(unsigned short addr)
-{
-    return (unsigned char) addr;
-}
-
-unsigned char hiByte(unsigned short addr)
-{
-    return (unsigned char) (addr >> 8);
-}
-
-unsigned short combineBytes(unsigned short lo, unsigned short hi)
-{
-    return (((unsigned short) hi) << 8) | lo;
-}
-
-void printEmulatorOverview()
-{
-    printf("-- EMULATOR STATE --\n");
-    printf("a: $%x      x: $%x      y: $%x      s: $%x\n", regA, regX, regY, regS);
-    printf("pc: $%x     flags: %%", pc);
-    printBin(flags);
-    printf("\n");
-}
-
-void feInfo(const char* message)
-{
-    printf("FE: info: %s\n", message);
-}
-
-void feErr(const char* message)
-{
-    printf("FE: error: %s\n", message);
-}
-
-void feROMErr(const char* message)
-{
-    printf("FE: error: Could not load ROM: %s\n", message);
+    while (SDL_GetPerformanceCounter() < deadline);
 }
 
-void printBin(unsigned char c)
+// Called whenever a frame has been shown
+void recordFrameTime()
 {
-    char number[10];
-    number[8] = '\n';
-    number[9] = '\0';
-    for (int i = 0; i < 8; i++)
-        number[7 - i] = ((c >> i) & 1) ? '1' : '0';
-    printf(number);
-}
-
-// sum stack overflow code
-uint64_t timestamp()
-{
-    struct timeval tv;
-    gettimeofday(&tv,NULL);
-    return tv.tv_sec*(uint64_t)1000000+tv.tv_usec;
-}
-
-void loadTwoTiles()
-{
-    // nametable 0 base + nametable offset + coarse y offset + coarse x offset
-    unsigned short nametableIndex = (0x20 * ppu.currentVRamAddr.coarseYScroll) + (ppu.currentVRamAddr.coarseXScroll);
-    unsigned short tileAddr = 0x2000 + (ppu.currentVRamAddr.nametableSelect * 0x400) + nametableIndex;
-    // fine y offset
-    int startLine = ppu.currentVRamAddr.fineYScroll;
-    unsigned short patternTableAddr = (isBitSet(cpuMem[PPUCTRL], BG_PATTERN_TABLE_BIT) ? 0x1000 : 0x0) + ((((unsigned short) ppuMem[tileAddr]) << 4) | startLine);
-    ppu.patternShiftRHi = ppuMem[patternTableAddr + 8];
-    ppu.patternShiftRLo = ppuMem[patternTableAddr];
-    // attr table 0 base + attr table offset 
-    unsigned short attrAddr = 0x23C0 + (ppu.currentVRamAddr.nametableSelect * 0x400) + ((nametableIndex / 0x80) * 8) + ((nametableIndex / 4) % 8);
-    ppu.paletteShiftRHi = ppu.paletteShiftRLo = 0;
-    unsigned char loAttrBitIndex = ((1 << (4 * ((nametableIndex / 0x40) % 2)))) << (2 * ((nametableIndex / 0x02) % 2));
-    if (ppuMem[attrAddr] & (loAttrBitIndex << 1))
-        ppu.paletteShiftRHi = ~ppu.paletteShiftRHi;
-    if (ppuMem[attrAddr] & loAttrBitIndex)
-        ppu.paletteShiftRLo = ~ppu.paletteShiftRLo;
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (pacingStats.last != 0)
+    {
+        if (pacingStats.count == pacingStats.capacity)
+        {
+            unsigned long capacity = pacingStats.capacity ? pacingStats.capacity * 2 : 4096;
+            float* errors = realloc(pacingStats.errors, capacity * sizeof(float));
+            if (errors == NULL)
+                return;
+            pacingStats.errors = errors;
+            pacingStats.capacity = capacity;
+        }
+        double took = (now - pacingStats.last) * 1000000.0 / SDL_GetPerformanceFrequency();
+        pacingStats.errors[pacingStats.count++] = took > FRAME_LENGTH_US ? took - FRAME_LENGTH_US : FRAME_LENGTH_US - took;
+        pacingStats.total += took;
+    }
+    pacingStats.last = now;
 }
 
-unsigned short inc5BitInt(unsigned short addr, int offset)
+void printPacingStats()
 {
-    unsigned short bi = ((addr >> offset) & 0b11111);
-    bi++;
-    if (bi > 0b11111) bi = 0;
-    return (addr & (~(((unsigned short) 0b11111) << offset))) | (bi << offset);
+    if (pacingStats.count == 0)
+        return;
+    double sum = 0;
+    for (unsigned long i = 0; i < pacingStats.count; i++)
+        sum += pacingStats.errors[i];
+    qsort(pacingStats.errors, pacingStats.count, sizeof(float), compareFloats);
+    printf("FE: pacing: %lu frames, %.1f us per frame on average\n", pacingStats.count, pacingStats.total / pacingStats.count);
+    printf("FE: pacing: frame time error %.1f us mean, %.1f us p99\n", sum / pacingStats.count, pacingStats.errors[pacingStats.count * 99 / 100]);
+    free(pacingStats.errors);
+    memset(&pacingStats, 0, sizeof(pacing_stats_t));
 }
 
-void updatePixel(int x, int y, int rgb)
+int compareFloats(const void* a, const void* b)
 {
-    SDL_Rect rect;
-    rect.x = x * upscale;
-    rect.y = y * upscale;
-    rect.w = rect.h = upscale;
-    SDL_FillRect(screenSurface, &rect, rgb);
+    float x = *(const float*) a;
+    float y = *(const float*) b;
+    return (x > y) - (x < y);
 }
\ No newline at end of file
@@ -0,0 +1,19 @@
+@echo off
+rem Builds FE and the test ROMs, runs the libfe API checks (test\api.c), then runs the test ROMs
+rem and every ROM in test\ against its golden frame log (<rom>.golden, a missing one fails),
+rem <rom>.fem next to a ROM is played as its input. FE.exe --headless 600 --golden <log>
+rem --record-golden <rom> records a log after an intended change.
+call build.bat || exit /b 1
+gcc -Wall -Iinclude src/core.c test/api.c -o api_test.exe -pthread || exit /b 1
+set failed=0
+api_test.exe || set failed=1
+for %%r in (test priority) do FE.exe --headless 600 --golden "test\%%r.golden" "%%r.nes" || set failed=1
+for %%f in (test\*.nes) do (
+    if exist "%%~dpnf.fem" (
+        FE.exe --headless 600 --play "%%~dpnf.fem" --golden "%%~dpnf.golden" "%%f" || set failed=1
+    ) else (
+        FE.exe --headless 600 --golden "%%~dpnf.golden" "%%f" || set failed=1
+    )
+)
+if %failed%==1 echo Golden frame logs do not match
+exit /b %failed%
@@ -0,0 +1,104 @@
+#include <fe.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Checks of libfe through include/fe.h alone, without SDL or test ROMs: ROMs are built in memory
+
+#define PRG_SIZE 0x4000
+#define CHR_SIZE 0x2000
+#define IMAGE_SIZE (16 + PRG_SIZE + CHR_SIZE)
+
+int failures = 0;
+
+void check(int condition, const char* what)
+{
+    if (!condition)
+    {
+        printf("FE: test: FAILED %s\n", what);
+        failures++;
+    }
+}
+
+// An NROM image whose reset handler counts $00 up and reads controller 2 into $02 (bit-reversed)
+// forever, with the mapper number of its header changed
+unsigned char* buildImage(int mapper)
+{
+    unsigned char* image = calloc(IMAGE_SIZE, 1);
+    if (image == NULL)
+        exit(1);
+    memcpy(image, "NES\x1A\x01\x01", 6);
+    image[6] = (mapper & 0x0F) << 4;
+    image[7] = mapper & 0xF0;
+    static const unsigned char code[] = {
+        0x78, // SEI
+        0xE6, 0x00, // INC $00
+        0xA9, 0x01, 0x8D, 0x16, 0x40, // LDA #1, STA $4016
+        0xA9, 0x00, 0x8D, 0x16, 0x40, // LDA #0, STA $4016
+        0xA2, 0x00, // LDX #0
+        0xAD, 0x17, 0x40, // LDA $4017
+        0x4A, // LSR A
+        0x26, 0x01, // ROL $01
+        0xE8, // INX
+        0xE0, 0x08, // CPX #8
+        0xD0, 0xF5, // BNE to the LDA $4017
+        0xA5, 0x01, 0x85, 0x02, // LDA $01, STA $02
+        0x4C, 0x01, 0xC0 // JMP $C001
+    };
+    unsigned char* prg = image + 16;
+    memcpy(prg, code, sizeof(code));
+    prg[0x3FFC] = 0x00; // reset vector, $C000
+    prg[0x3FFD] = 0xC0;
+    return image;
+}
+
+int main(void)
+{
+    fe_emulator_t* emu = feCreate();
+    if (emu == NULL)
+        return 1;
+    unsigned char state[16];
+
+    // nothing runs without a ROM
+    check(feStepFrames(emu, 1) == -1, "stepping frames without a ROM");
+    check(feStepCycles(emu, 100) == -1, "stepping cycles without a ROM");
+    check(feStateSize(emu) == 0, "state size without a ROM");
+    check(feSaveState(emu, state, sizeof(state)) == -1, "saving a state without a ROM");
+    check(feLoadState(emu, state, sizeof(state)) == -1, "loading a state without a ROM");
+
+    // a ROM rejected after its header parsed leaves no cartridge behind
+    unsigned char* unsupported = buildImage(7);
+    check(feLoadROM(emu, unsupported, IMAGE_SIZE) == -1, "loading a ROM of an unsupported mapper");
+    check(feStepFrames(emu, 1) == -1, "stepping frames after a rejected ROM");
+    check(feSaveState(emu, state, sizeof(state)) == -1, "saving a state after a rejected ROM");
+    free(unsupported);
+    unsigned char* truncated = buildImage(0);
+    check(feLoadROM(emu, truncated, IMAGE_SIZE - 1) == -1, "loading a truncated ROM");
+    check(feStepFrames(emu, 1) == -1, "stepping frames after a truncated ROM");
+
+    // and a good ROM still goes in after them
+    check(feLoadROM(emu, truncated, IMAGE_SIZE) == 0, "loading a ROM after rejected ones");
+    check(feLoadROM(emu, truncated, IMAGE_SIZE) == -1, "loading a second ROM");
+    free(truncated);
+    check(feStepFrames(emu, 2) == 0 && feFrameCount(emu) == 2, "stepping frames");
+    check(feRAM(emu)[0] != 0 && feRead(emu, 0x0000) == feRAM(emu)[0], "running the ROM");
+
+    // controller 2 is the high byte of the input
+    feSetInput(emu, (FE_BUTTON_A << 8) | FE_BUTTON_B);
+    feStepFrames(emu, 1);
+    check(feRAM(emu)[2] == 0x80, "reading controller 2");
+
+    // states restore the machine exactly
+    size_t size = feStateSize(emu);
+    unsigned char* saved = malloc(size);
+    check(saved != NULL && feSaveState(emu, saved, size) == 0, "saving a state");
+    unsigned char counter = feRAM(emu)[0];
+    feStepFrames(emu, 1);
+    check(feLoadState(emu, saved, size) == 0 && feRAM(emu)[0] == counter, "loading a state");
+    free(saved);
+
+    feDestroy(emu);
+    if (failures == 0)
+        printf("FE: test: all passed\n");
+    return failures != 0;
+}
\ No newline at end of file
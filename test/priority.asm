@@ -0,0 +1,191 @@
+; Sprites in front of and behind a background of glyphs, sweeping across it a pixel a frame. Every
+; other sprite has the priority bit set and only shows through the glyphs' transparent pixels.
+
+; PPU IO ports
+PPUCTRL = $2000
+PPUMASK = $2001
+PPUSTATUS = $2002
+OAMADDR = $2003
+PPUSCROLL = $2005
+PPUADDR = $2006
+PPUDATA = $2007
+OAMDMA = $4014
+
+; Zero page
+frame = $10
+temp = $11
+
+    .segment "HEADER"
+
+    .byte "NES", $1A ; iNES Header
+    .byte 1 ; PRG data size (16kb)
+    .byte 1 ; CHR data size (8kb)
+    .byte $01, $00 ; Mapper
+
+    .segment "STARTUP"
+
+    .segment "CODE"
+
+WaitForVBlank:
+    bit PPUSTATUS
+    bpl WaitForVBlank
+    rts
+
+Reset:
+    sei
+    cld
+    ldx #$40
+    stx $4017
+    ldx #$FF
+    txs
+    inx
+    stx PPUCTRL
+    stx PPUMASK
+    stx $4010
+
+    jsr WaitForVBlank
+
+ClearMemory:
+    lda #$00
+    sta $0000, x
+    sta $0100, x
+    sta $0300, x
+    sta $0400, x
+    sta $0500, x
+    sta $0600, x
+    sta $0700, x
+    lda #$FF
+    sta $0200, x
+    inx
+    bne ClearMemory
+
+    jsr WaitForVBlank
+
+    lda #$3F
+    sta PPUADDR
+    lda #$00
+    sta PPUADDR
+LoadPalette:
+    lda Palette, x
+    sta PPUDATA
+    inx
+    cpx #$20
+    bne LoadPalette
+
+    ; glyphs 0-31 over and over, the attribute table picks palettes from the same bytes
+    lda #$20
+    sta PPUADDR
+    lda #$00
+    sta PPUADDR
+    tax
+    ldy #$04
+FillNametable:
+    txa
+    and #$1F
+    sta PPUDATA
+    inx
+    bne FillNametable
+    dey
+    bne FillNametable
+
+    ; 8 rows of 8 sprites, even ones in front of the background and odd ones behind it
+    ldy #$00
+InitSprites:
+    tya
+    and #$38
+    sta temp
+    asl
+    adc temp
+    adc #$10
+    sta $0200, x ; y = 16 + row * 24
+    lda #$11
+    sta $0201, x ; the H glyph
+    tya
+    lsr
+    and #$03
+    sta temp
+    tya
+    and #$01
+    asl
+    asl
+    asl
+    asl
+    asl
+    ora temp
+    sta $0202, x ; priority bit and palette
+    tya
+    and #$07
+    asl
+    asl
+    asl
+    asl
+    asl
+    adc #$08
+    sta $0203, x ; x = 8 + column * 32
+    inx
+    inx
+    inx
+    inx
+    iny
+    cpy #$40
+    bne InitSprites
+
+    jsr WaitForVBlank
+
+    lda #%10011000
+    sta PPUCTRL
+
+    lda #%00011110
+    sta PPUMASK
+
+    ; reads of PPUSTATUS have the PPU catch up a few pixels at a time
+Forever:
+    bit PPUSTATUS
+    jmp Forever
+
+NMI:
+    pha
+    txa
+    pha
+
+    lda #$00
+    sta OAMADDR
+    lda #$02
+    sta OAMDMA
+
+    ldx #$03
+MoveSprites:
+    inc $0200, x
+    inx
+    inx
+    inx
+    inx
+    bne MoveSprites
+
+    inc frame
+    lda #%10011000
+    sta PPUCTRL
+    lda frame
+    lsr
+    sta PPUSCROLL
+    lda #$00
+    sta PPUSCROLL
+
+    pla
+    tax
+    pla
+    rti
+
+Palette:
+    .byte $0F, $30, $16, $27, $0F, $2C, $1A, $38, $0F, $24, $11, $3A, $0F, $15, $2B, $20
+    .byte $0F, $01, $12, $21, $0F, $06, $17, $28, $0F, $09, $19, $29, $0F, $04, $14, $34
+
+    .segment "VECTORS"
+
+    .word NMI
+    .word Reset
+    .word 0
+
+    .segment "CHARS"
+
+    .incbin "graphics.chr"
\ No newline at end of file